@@ -0,0 +1,805 @@
+/* Copyright (c) 2011 Eric McCorkle.  All rights reserved. */
+
+/* Host benchmark of the core, stage by stage, for every model and
+ * input.  The inputs are the recording, moved to each model's header
+ * length, and synthetic strokes of 0 to 16 contacts from
+ * well_test_synth().  Each stage runs over the frames of an input,
+ * frame after frame, in batches of BENCH_BATCH; a sample is the mean
+ * time per frame of a batch, less that of an empty stage.  Stages are
+ * timed BENCH_ROUNDS times, keeping the best round, so that a burst of
+ * noise on the host does not count as a regression.  Shared hosts also
+ * change speed by half from one second to the next, so each round is
+ * timed next to one of fixed reference work, bench_sort(), and the
+ * round kept is the one that took the least against it.  The output is
+ * one line per model, input and stage,
+ *
+ *   model input stage p50_ns p99_ns ref_ns allocs
+ *
+ * where ref_ns is the reference's p50 in the round kept and allocs
+ * counts the calls to the allocator while the stage ran;
+ * it must be 0.  "chain" is the kernel's frame path from the frame to
+ * one reader's packet, each stage run only where the kernel runs it;
+ * it costs about the sum of len, filter, decode, track, predict or
+ * scroll, put and encode, less on the recording, whose repeated and
+ * idle frames skip the later stages.
+ *
+ * Without -b, each stage is measured BENCH_RETRIES times and the
+ * median printed, which is what a baseline records.  With -b, the p50
+ * of each line is checked against a baseline in the same form, scaled
+ * by the ratio of the two ref_ns, and the exit status is non-zero if
+ * any is more than -t percent (and BENCH_SLACK ns) slower in each of
+ * BENCH_RETRIES passes over the inputs, or if anything allocates.  The
+ * default of twice as slow is what such a host allows; on a quiet one,
+ * -t 25 finds smaller regressions.
+ *
+ *   bench_core [-m model] [-r frames] [-b baseline] [-t percent]
+ */
+#include <sys/param.h>
+#include <sys/time.h>
+
+#include <math.h>
+#include <unistd.h>
+
+#include "well_core.h"
+#include "well_test.h"
+
+#define BENCH_SAMPLES 64
+#define BENCH_BATCH 128
+#define BENCH_ROUNDS 5
+#define BENCH_RETRIES 3
+#define BENCH_SLACK 5.0     /* ns, the noise of the empty stage */
+#define BENCH_THRESHOLD 100 /* percent */
+#define BENCH_HORIZON 16    /* ms of prediction */
+#define BENCH_SYNTH 64      /* frames of a synthetic input */
+#define BENCH_REC_MODEL DEV_WELLSPRING3 /* of the recording */
+#define BENCH_NAME 16
+#define BENCH_LAYOUTS 3
+#define BENCH_INPUTS (WELL_MAX_FINGERS + 4) /* rec, f0 to f16, idle, rest */
+#define BENCH_SORT 64       /* values sorted by the reference work */
+#define BENCH_WARMUP 500    /* ms */
+
+/* Zone layouts of 1, 4 and WELL_ZONE_MAX rectangles: the clickpad's
+ * default, a clickpad with a middle button and scroll edges, and the
+ * kernel's bench layout.  The lookup is one cell whatever the layout,
+ * so all three should cost the same.
+ */
+static const char *const bench_layouts[BENCH_LAYOUTS] = {
+	"right:500,800,1000,1000",
+	"right:500,800,1000,1000 middle:400,800,600,1000 "
+	    "vscroll:920,0,1000,800 vscroll:0,0,80,800",
+	"right:500,800,1000,1000 middle:400,800,600,1000 "
+	    "vscroll:920,0,1000,800 right:0,0,100,100 middle:100,0,200,100 "
+	    "vscroll:200,0,300,100 right:300,0,400,100 middle:400,0,500,100 "
+	    "vscroll:500,0,600,100 right:600,0,700,100 middle:700,0,800,100 "
+	    "vscroll:800,0,900,100 right:0,300,150,450 "
+	    "middle:150,300,300,450 vscroll:300,300,450,450 "
+	    "right:450,300,600,450",
+};
+
+/* The allocator, counted while a stage runs; see the Makefile. */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+void __real_free(void *p);
+
+static int bench_counting;
+static u_int bench_allocs;
+
+void *
+__wrap_malloc(size_t size)
+{
+	bench_allocs += bench_counting;
+	return (__real_malloc(size));
+}
+
+void *
+__wrap_calloc(size_t n, size_t size)
+{
+	bench_allocs += bench_counting;
+	return (__real_calloc(n, size));
+}
+
+void *
+__wrap_realloc(void *p, size_t size)
+{
+	bench_allocs += bench_counting;
+	return (__real_realloc(p, size));
+}
+
+void
+__wrap_free(void *p)
+{
+	bench_allocs += bench_counting && p != NULL;
+	__real_free(p);
+}
+
+struct bench {
+	const struct well_dev_params *params;
+	struct well_test_frame *raw;   /* the input, as received */
+	struct well_frame     *frames; /* ... decoded */
+	int                   *dx;     /* ... primary finger motion */
+	int                   *dy;
+	u_int                  n;
+	struct well_frame      frame;
+	struct well_norm       norm[2];
+	struct well_accel      accel;
+	struct well_track      track;
+	struct well_pred       pred;
+	struct well_scroll     scroll;
+	struct well_filter     filter;
+	struct well_zone_map   zones[BENCH_LAYOUTS];
+	struct well_ring       ring;
+	struct well_event      events[WELL_RING_LEN];
+	struct well_event      in[WELL_RING_LEN]; /* the input's events */
+	mousemode_t            mode;
+	struct timeval         time;
+	uint8_t                buf[MOUSE_SYS_PACKETSIZE];
+	uint32_t               sort[BENCH_SORT];
+	int                    sink;
+};
+
+typedef void bench_fn(struct bench *b, u_int i);
+
+static void
+bench_nop(struct bench *b, u_int i)
+{
+	b->sink += i;
+}
+
+/* The reference work, an insertion sort of pseudo-random values:
+ * loads, stores and branches like the stages, so that it slows down
+ * with them when the host does.
+ */
+static void
+bench_sort(struct bench *b, u_int i)
+{
+	uint32_t t, x = 1;
+	u_int j, k;
+
+	for (j = 0; j < BENCH_SORT; j++)
+		b->sort[j] = x = x * 1103515245 + 12345;
+	for (j = 1; j < BENCH_SORT; j++) {
+		t = b->sort[j];
+		for (k = j; k > 0 && b->sort[k - 1] > t; k--)
+			b->sort[k] = b->sort[k - 1];
+		b->sort[k] = t;
+	}
+	b->sink += b->sort[i % BENCH_SORT];
+}
+
+static void
+bench_len(struct bench *b, u_int i)
+{
+	b->sink += well_frame_len(b->params, b->raw[i].len);
+}
+
+static void
+bench_decode(struct bench *b, u_int i)
+{
+	well_decode_frame(b->params, b->raw[i].data, b->raw[i].len,
+	    &b->frame);
+}
+
+static void
+bench_filter(struct bench *b, u_int i)
+{
+	b->sink += well_filter(&b->filter, b->params, b->raw[i].data,
+	    b->raw[i].len);
+}
+
+/* All contacts of a frame to output units. */
+static void
+bench_norm(struct bench *b, u_int i)
+{
+	const struct well_frame *f = &b->frames[i];
+	u_int k;
+
+	for (k = 0; k < f->nfingers; k++)
+		b->sink += well_normalize(&b->norm[WELL_AXIS_X], f->x[k]) +
+		    well_normalize(&b->norm[WELL_AXIS_Y], f->y[k]);
+}
+
+static void
+bench_accel(struct bench *b, u_int i)
+{
+	int dx = b->dx[i], dy = b->dy[i];
+
+	well_accel(&b->accel, &dx, &dy);
+	b->sink += dx + dy;
+}
+
+/* All contacts of a frame, at a non-square scale. */
+static void
+bench_ellipse(struct bench *b, u_int i)
+{
+	const struct well_frame *f = &b->frames[i];
+	struct well_contact c;
+	u_int k;
+
+	for (k = 0; k < f->nfingers; k++) {
+		well_ellipse(300, 200, f->touch_major[k], f->touch_minor[k],
+		    f->orientation[k], &c);
+		b->sink += c.major + c.angle;
+	}
+}
+
+/* Zones of all contacts of a frame, in layout "z". */
+static void
+bench_zone(struct bench *b, u_int i, u_int z)
+{
+	const struct well_frame *f = &b->frames[i];
+	u_int k;
+
+	for (k = 0; k < f->nfingers; k++)
+		b->sink += well_zone(&b->zones[z], f->x[k], f->y[k]);
+}
+
+static void
+bench_zone1(struct bench *b, u_int i)
+{
+	bench_zone(b, i, 0);
+}
+
+static void
+bench_zone4(struct bench *b, u_int i)
+{
+	bench_zone(b, i, 1);
+}
+
+static void
+bench_zone16(struct bench *b, u_int i)
+{
+	bench_zone(b, i, 2);
+}
+
+/* One frame interval on the virtual clock. */
+static void
+bench_tick(struct bench *b)
+{
+	b->time.tv_usec += 8000;
+	if (b->time.tv_usec >= 1000000) {
+		b->time.tv_sec++;
+		b->time.tv_usec -= 1000000;
+	}
+}
+
+/* Primary finger motion, scrolling with two fingers like the kernel. */
+static void
+bench_track(struct bench *b, u_int i)
+{
+	const struct well_frame *f = &b->frames[i];
+	int dx, dy;
+
+	well_track(&b->track, b->norm, f, f->nfingers == 2, &dx, &dy);
+	b->sink += dx + dy;
+}
+
+static void
+bench_predict(struct bench *b, u_int i)
+{
+	int pdx, pdy;
+
+	bench_tick(b);
+	well_predict(&b->pred, &b->time, BENCH_HORIZON, b->dx[i], b->dy[i],
+	    &pdx, &pdy);
+	b->sink += pdx + pdy;
+}
+
+static void
+bench_scroll(struct bench *b, u_int i)
+{
+	bench_tick(b);
+	b->sink += well_scroll(&b->scroll, &b->time, b->dy[i]);
+}
+
+static void
+bench_put(struct bench *b, u_int i)
+{
+	well_event_put(&b->ring, b->events, &b->time, b->dx[i], b->dy[i], 0,
+	    b->frames[i].buttons);
+}
+
+static void
+bench_encode(struct bench *b, u_int i)
+{
+	b->sink += well_encode(&b->mode, 1,
+	    &b->in[i & (WELL_RING_LEN - 1)], b->buf);
+}
+
+/* The kernel's frame path for one reader: length check, repeat
+ * filter, decode, tracking, then scrolling or prediction, and the
+ * event stored and encoded when there is one.
+ */
+static void
+bench_chain(struct bench *b, u_int i)
+{
+	struct well_frame *f = &b->frame;
+	struct well_event *ev;
+	int len, scroll, dx, dy, dz = 0, pdx = 0, pdy = 0;
+
+	if ((len = well_frame_len(b->params, b->raw[i].len)) < 0 ||
+	    well_filter(&b->filter, b->params, b->raw[i].data, len))
+		return;
+	well_decode_frame(b->params, b->raw[i].data, len, f);
+	bench_tick(b);
+	scroll = f->nfingers == 2;
+	switch (well_track(&b->track, b->norm, f, scroll, &dx, &dy)) {
+	case WELL_TRACK_MOVE:
+		if (scroll) {
+			dz = well_scroll(&b->scroll, &b->time, dy);
+			dx = dy = 0;
+		} else
+			well_predict(&b->pred, &b->time, BENCH_HORIZON, dx,
+			    dy, &pdx, &pdy);
+		break;
+	case WELL_TRACK_CHANGE:
+		well_predict_reset(&b->pred, &b->time, &pdx, &pdy);
+		if (scroll)
+			well_scroll_reset(&b->scroll, &b->time);
+		break;
+	case WELL_TRACK_IDLE:
+		return;
+	}
+	ev = well_event_put(&b->ring, b->events, &b->time, dx, dy, dz,
+	    f->buttons);
+	ev->pdx = pdx;
+	ev->pdy = pdy;
+	b->sink += well_encode(&b->mode, 1, ev, b->buf);
+}
+
+static const struct {
+	const char *name;
+	bench_fn   *fn;
+} bench_stages[] = {
+	{ "len",     bench_len },
+	{ "decode",  bench_decode },
+	{ "filter",  bench_filter },
+	{ "norm",    bench_norm },
+	{ "accel",   bench_accel },
+	{ "ellipse", bench_ellipse },
+	{ "zone1",   bench_zone1 },
+	{ "zone4",   bench_zone4 },
+	{ "zone16",  bench_zone16 },
+	{ "track",   bench_track },
+	{ "predict", bench_predict },
+	{ "scroll",  bench_scroll },
+	{ "put",     bench_put },
+	{ "encode",  bench_encode },
+	{ "chain",   bench_chain },
+};
+
+#define BENCH_N nitems(bench_stages)
+
+#define BENCH_SLOW 0x1
+#define BENCH_ALLOCS 0x2
+
+/* A measure of a stage. */
+struct bench_measure {
+	double p50;
+	double p99;
+	double ref;
+};
+
+/* The measures of one input. */
+struct bench_result {
+	char                 input[BENCH_NAME];
+	struct bench_measure m[BENCH_N];
+	u_int                allocs[BENCH_N];
+	int                  bad;
+};
+
+static struct bench_result bench_results[DEV_WELLSPRING_N][BENCH_INPUTS];
+
+/* A line of the baseline. */
+struct bench_line {
+	int    model;
+	char   input[BENCH_NAME];
+	char   stage[BENCH_NAME];
+	double p50;
+	double ref;
+};
+
+static int
+bench_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+/* Time one stage in batches of "batch" frames, leaving sorted samples
+ * in "ns", less "zero" each.
+ */
+static void
+bench_stage(struct bench *b, bench_fn *fn, u_int batch, double zero,
+    double *ns)
+{
+	uint64_t t0;
+	u_int i, j, k;
+
+	bench_counting = 1;
+	for (i = k = 0; i < BENCH_SAMPLES; i++) {
+		t0 = well_test_ns();
+		for (j = 0; j < batch; j++, k = k + 1 < b->n ? k + 1 : 0)
+			fn(b, k);
+		ns[i] = (double)(well_test_ns() - t0) / batch - zero;
+	}
+	bench_counting = 0;
+	qsort(ns, BENCH_SAMPLES, sizeof(*ns), bench_cmp);
+}
+
+/* The best of BENCH_ROUNDS timings, each next to one of the reference
+ * work: the round where the stage took the least against the reference
+ * gives the p50, the p99 and the reference's p50.
+ */
+static void
+bench_best(struct bench *b, bench_fn *fn, double zero, double *p50,
+    double *p99, double *ref)
+{
+	double ns[BENCH_SAMPLES], sort[BENCH_SAMPLES];
+	u_int r;
+
+	*p50 = *p99 = 0;
+	*ref = -1;
+	for (r = 0; r < BENCH_ROUNDS; r++) {
+		bench_stage(b, bench_sort, 1, 0, sort);
+		bench_stage(b, fn, BENCH_BATCH, zero, ns);
+		if (*ref < 0 || MAX(ns[BENCH_SAMPLES / 2], 0) * *ref <
+		    *p50 * sort[BENCH_SAMPLES / 2]) {
+			*p50 = MAX(ns[BENCH_SAMPLES / 2], 0);
+			*p99 = MAX(ns[BENCH_SAMPLES * 99 / 100], 0);
+			*ref = sort[BENCH_SAMPLES / 2];
+		}
+	}
+}
+
+/* Load a baseline; returns the number of lines. */
+static u_int
+bench_load(const char *path, struct bench_line **linesp)
+{
+	struct bench_line *lines = NULL, *l;
+	char line[128];
+	double p99;
+	u_int n = 0, cap = 0;
+	FILE *fp;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		err(2, "%s", path);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (n == cap) {
+			cap = MAX(2 * cap, 256);
+			if ((lines = realloc(lines,
+			    cap * sizeof(*lines))) == NULL)
+				err(2, "realloc");
+		}
+		l = &lines[n];
+		if (line[0] != '#' && sscanf(line,
+		    "%d %15s %15s %lf %lf %lf", &l->model, l->input, l->stage,
+		    &l->p50, &p99, &l->ref) == 6 && l->ref > 0)
+			n++;
+	}
+	fclose(fp);
+	*linesp = lines;
+	return (n);
+}
+
+/* The line of the baseline for a stage, or NULL if it has none. */
+static const struct bench_line *
+bench_want(const struct bench_line *lines, u_int n, int model,
+    const char *input, const char *stage)
+{
+	u_int i;
+
+	for (i = 0; i < n; i++)
+		if (lines[i].model == model &&
+		    strcmp(lines[i].input, input) == 0 &&
+		    strcmp(lines[i].stage, stage) == 0)
+			return (&lines[i]);
+	return (NULL);
+}
+
+/* Whether "p50", timed next to "ref" of the reference work, is over
+ * the baseline "l" at the same speed of the host.
+ */
+static int
+bench_over(double p50, double ref, const struct bench_line *l,
+    int threshold)
+{
+	double want;
+
+	if (l == NULL)
+		return (0);
+	want = l->p50 * ref / l->ref;
+	return (p50 > MAX(want * (100 + threshold) / 100, want + BENCH_SLACK));
+}
+
+/* Measures of a stage by the time they took against the reference. */
+static int
+bench_mcmp(const void *a, const void *b)
+{
+	const struct bench_measure *x = a, *y = b;
+
+	return (bench_cmp(&(double){ x->p50 / x->ref },
+	    &(double){ y->p50 / y->ref }));
+}
+
+/* Time every stage of the input in "b" into "res", on the first
+ * "pass" over the inputs or again on a later one; returns BENCH_SLOW
+ * and BENCH_ALLOCS as they apply.  Checking against a baseline, each
+ * stage is measured once a pass and the measure that took the least
+ * against the reference is kept.  Recording one, each is measured
+ * BENCH_RETRIES times and the median kept, so that the baseline is not
+ * a lucky measure that checks on the same host would then fail.
+ */
+static int
+bench_input(struct bench *b, int model, u_int pass, struct bench_result *res,
+    const struct bench_line *lines, u_int nlines, int threshold)
+{
+	struct bench_measure m[BENCH_RETRIES], *p;
+	const struct bench_line *l;
+	double zero, z99, ref;
+	u_int i, n;
+
+	res->bad = 0;
+	bench_best(b, bench_nop, 0, &zero, &z99, &ref);
+	for (i = 0; i < BENCH_N; i++) {
+		if (pass == 0)
+			res->allocs[i] = 0;
+		res->allocs[i] -= bench_allocs;
+		for (n = 0; n < (nlines == 0 ? BENCH_RETRIES : 1); n++)
+			bench_best(b, bench_stages[i].fn, zero, &m[n].p50,
+			    &m[n].p99, &m[n].ref);
+		res->allocs[i] += bench_allocs;
+		qsort(m, n, sizeof(*m), bench_mcmp);
+		p = &m[n / 2];
+		if (pass == 0 || bench_mcmp(p, &res->m[i]) < 0)
+			res->m[i] = *p;
+
+		l = bench_want(lines, nlines, model, res->input,
+		    bench_stages[i].name);
+		if (bench_over(res->m[i].p50, res->m[i].ref, l, threshold))
+			res->bad |= BENCH_SLOW;
+		if (res->allocs[i] != 0)
+			res->bad |= BENCH_ALLOCS;
+	}
+	return (res->bad);
+}
+
+/* Print the lines of one input. */
+static void
+bench_print(int model, const struct bench_result *res,
+    const struct bench_line *lines, u_int nlines, int threshold)
+{
+	const struct bench_measure *p;
+	const struct bench_line *l;
+	u_int i;
+
+	for (i = 0; i < BENCH_N; i++) {
+		p = &res->m[i];
+		printf("%d %s %s %.1f %.1f %.1f %u", model, res->input,
+		    bench_stages[i].name, p->p50, p->p99, p->ref,
+		    res->allocs[i]);
+		l = bench_want(lines, nlines, model, res->input,
+		    bench_stages[i].name);
+		if (bench_over(p->p50, p->ref, l, threshold))
+			printf(" # over %.1f", l->p50 * p->ref / l->ref);
+		if (res->allocs[i] != 0)
+			printf(" # allocates");
+		printf("\n");
+	}
+}
+
+/* The recording, moved to the finger records of "params". */
+static u_int
+bench_rec(const struct well_dev_params *params,
+    const struct well_test_frame *rec, u_int n, struct well_test_frame *raw)
+{
+	const struct well_dev_params *from = &well_dev_params[BENCH_REC_MODEL];
+	int fingers;
+	u_int i;
+
+	for (i = 0; i < n; i++) {
+		memset(raw[i].data, 0, sizeof(raw[i].data));
+		fingers = MAX(well_frame_len(from, rec[i].len) -
+		    (int)from->finger_offset, 0);
+		memcpy(raw[i].data, rec[i].data,
+		    MIN(from->finger_offset, params->finger_offset));
+		memcpy(raw[i].data + params->finger_offset,
+		    rec[i].data + from->finger_offset, fingers);
+		raw[i].len = params->finger_offset + fingers;
+	}
+	return (n);
+}
+
+/* Decode an input and reset the state the stages carry. */
+static void
+bench_setup(struct bench *b)
+{
+	const struct well_frame *f, *p;
+	int pdx, pdy;
+	u_int i;
+
+	for (i = 0; i < b->n; i++)
+		well_decode_frame(b->params, b->raw[i].data,
+		    MAX(well_frame_len(b->params, b->raw[i].len), 0),
+		    &b->frames[i]);
+	for (i = 0; i < b->n; i++) {
+		f = &b->frames[i];
+		p = &b->frames[i > 0 ? i - 1 : b->n - 1];
+		b->dx[i] = b->dy[i] = 0;
+		if (f->nfingers > 0 && p->nfingers > 0) {
+			b->dx[i] = (f->x[0] - p->x[0]) >> 3;
+			b->dy[i] = (f->y[0] - p->y[0]) >> 3;
+		}
+	}
+
+	memset(&b->track, 0, sizeof(b->track));
+	memset(&b->filter, 0, sizeof(b->filter));
+	/* Encode reads events of its own, so that what it encodes does
+	 * not depend on how often put ran before it.
+	 */
+	memset(&b->ring, 0, sizeof(b->ring));
+	for (i = 0; i < WELL_RING_LEN; i++)
+		well_event_put(&b->ring, b->in, &b->time, b->dx[i % b->n],
+		    b->dy[i % b->n], 0, b->frames[i % b->n].buttons);
+	memset(&b->ring, 0, sizeof(b->ring));
+	memset(b->events, 0, sizeof(b->events));
+	well_norm_init(&b->norm[WELL_AXIS_X], &b->params->x_calib);
+	well_norm_init(&b->norm[WELL_AXIS_Y], &b->params->y_calib);
+	for (i = 0; i < BENCH_LAYOUTS; i++)
+		if (well_zone_compile(b->params, bench_layouts[i],
+		    &b->zones[i]) != 0)
+			errx(2, "layout %u does not compile", i);
+	well_accel_init(&b->accel, 4);
+	well_accel_init(&b->track.accel, 4);
+	well_predict_reset(&b->pred, &b->time, &pdx, &pdy);
+	well_scroll_reset(&b->scroll, &b->time);
+}
+
+/* Load input "in" into "b" and name it: the recording, f0 to f16,
+ * then idle and rest, where only the frame counter in the header
+ * changes, as the pad sends them with nothing or a resting finger on
+ * it.  The filter skips all but the first frame of those.
+ */
+static void
+bench_input_load(struct bench *b, u_int in,
+    const struct well_test_frame *rec, u_int nrec, char *input)
+{
+	u_int fingers;
+
+	if (in == 0) {
+		snprintf(input, BENCH_NAME, "rec");
+		b->n = bench_rec(b->params, rec, nrec, b->raw);
+		return;
+	}
+	if (in <= WELL_MAX_FINGERS + 1) {
+		snprintf(input, BENCH_NAME, "f%u", in - 1);
+		for (b->n = 0; b->n < BENCH_SYNTH; b->n++)
+			well_test_synth(b->params, in - 1, b->n,
+			    &b->raw[b->n]);
+		return;
+	}
+	fingers = in - WELL_MAX_FINGERS - 2;
+	snprintf(input, BENCH_NAME, fingers == 0 ? "idle" : "rest");
+	for (b->n = 0; b->n < BENCH_SYNTH; b->n++) {
+		well_test_synth(b->params, fingers, 0, &b->raw[b->n]);
+		b->raw[b->n].data[0] = b->n;
+	}
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: bench_core [-m model] [-r frames] "
+	    "[-b baseline] [-t percent]\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	static struct bench b;
+	struct bench_line *lines = NULL;
+	struct well_test_frame *rec;
+	const char *path = "data/stroke.frames", *base = NULL;
+	struct bench_result *res;
+	uint64_t t0;
+	int ch, model, more, only = -1, threshold = BENCH_THRESHOLD;
+	u_int i, in, nlines = 0, nrec, pass, slow = 0, leaks = 0;
+
+	while ((ch = getopt(argc, argv, "b:m:r:t:")) != -1)
+		switch (ch) {
+		case 'b':
+			base = optarg;
+			break;
+		case 'm':
+			only = atoi(optarg);
+			if (only < 0 || only >= DEV_WELLSPRING_N)
+				usage();
+			break;
+		case 'r':
+			path = optarg;
+			break;
+		case 't':
+			threshold = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	if (optind != argc)
+		usage();
+
+	if (base != NULL)
+		nlines = bench_load(base, &lines);
+	if ((nrec = well_test_load(path, &rec)) == 0)
+		errx(2, "%s: no frames", path);
+	memset(&b, 0, sizeof(b));
+	i = MAX(nrec, BENCH_SYNTH);
+	if ((b.raw = calloc(i, sizeof(*b.raw))) == NULL ||
+	    (b.frames = calloc(i, sizeof(*b.frames))) == NULL ||
+	    (b.dx = calloc(i, sizeof(*b.dx))) == NULL ||
+	    (b.dy = calloc(i, sizeof(*b.dy))) == NULL)
+		err(2, "calloc");
+	b.mode.level = 1;
+	b.mode.syncmask[1] = MOUSE_MSC_SYNC;
+
+	printf("# %u frames of %s as rec, %d frames of 0 to %d contacts "
+	    "as f0 to f%d\n", nrec, path, BENCH_SYNTH, WELL_MAX_FINGERS,
+	    WELL_MAX_FINGERS);
+	printf("# %d frames of no contact as idle, of one resting as rest\n",
+	    BENCH_SYNTH);
+	for (model = 0; model < DEV_WELLSPRING_N; model++)
+		printf("# model %d: %s\n", model, well_dev_params[model].name);
+	printf("# model input stage p50_ns p99_ns ref_ns allocs\n");
+
+	/* Let the host come up to speed before the first stage. */
+	t0 = well_test_ns();
+	while (well_test_ns() - t0 < BENCH_WARMUP * 1000000ULL)
+		bench_sort(&b, 0);
+
+	/* Noise on a shared host comes in bursts longer than an input, so
+	 * inputs with a slow stage are measured again after all the
+	 * others rather than at once.
+	 */
+	for (pass = 0, more = 1; pass < BENCH_RETRIES && more; pass++) {
+		more = 0;
+		for (model = 0; model < DEV_WELLSPRING_N; model++) {
+			if (only >= 0 && model != only)
+				continue;
+			b.params = &well_dev_params[model];
+			for (in = 0; in < BENCH_INPUTS; in++) {
+				res = &bench_results[model][in];
+				if (pass > 0 && !(res->bad & BENCH_SLOW))
+					continue;
+				bench_input_load(&b, in, rec, nrec,
+				    res->input);
+				bench_setup(&b);
+				more |= bench_input(&b, model, pass, res,
+				    lines, nlines, threshold) & BENCH_SLOW;
+			}
+		}
+	}
+	for (model = 0; model < DEV_WELLSPRING_N; model++) {
+		if (only >= 0 && model != only)
+			continue;
+		for (in = 0; in < BENCH_INPUTS; in++) {
+			res = &bench_results[model][in];
+			bench_print(model, res, lines, nlines, threshold);
+			slow += res->bad & BENCH_SLOW ? 1 : 0;
+			leaks += res->bad & BENCH_ALLOCS ? 1 : 0;
+		}
+	}
+
+	free(lines);
+	free(rec);
+	free(b.raw);
+	free(b.frames);
+	free(b.dx);
+	free(b.dy);
+	if (slow != 0)
+		fprintf(stderr, "bench_core: %u inputs slower than the "
+		    "baseline\n", slow);
+	if (leaks != 0)
+		fprintf(stderr, "bench_core: %u inputs allocate\n", leaks);
+	return (slow != 0 || (base != NULL && leaks != 0));
+}
@@ -0,0 +1,124 @@
+/* Copyright (c) 2011 Eric McCorkle.  All rights reserved. */
+
+/* Fuzz target over the frame path of the core: well_frame_len(),
+ * well_decode_frame(), well_track() and well_ellipse() on every
+ * contact, as the kernel runs them on each frame.  An input is
+ *
+ *   model, sx (2 bytes), sy (2 bytes), frame as received
+ *
+ * with the model taken modulo DEV_WELLSPRING_N and the scales, Q8 in
+ * big endian, plus one, covering all that the size sysctls accept.
+ * Besides crashes, it aborts on any input that takes longer than
+ * WELL_FUZZ_BUDGET ns (50000 unless set in the environment) three
+ * times in a row, so that libFuzzer keeps it as a crash.
+ *
+ * Built with -fsanitize=fuzzer it is a libFuzzer target; otherwise
+ * main() below runs the inputs named on the command line, which is
+ * how "make check" replays the corpus of slow inputs in data/corpus.
+ * With -v it prints the time each input takes.
+ */
+#include <sys/param.h>
+#include <sys/time.h>
+
+#include "well_core.h"
+#include "well_test.h"
+
+#define FUZZ_HEADER 5
+#define FUZZ_BUDGET 50000 /* ns */
+#define FUZZ_TRIES 3
+#define FUZZ_MAXLEN 512   /* FUZZ_MAXLEN in the Makefile */
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static uint64_t fuzz_budget;
+static uint64_t fuzz_last; /* ns taken by the last input */
+
+static void
+fuzz_frame(const uint8_t *data, size_t size)
+{
+	const struct well_dev_params *params;
+	struct well_norm norm[2];
+	struct well_track track;
+	struct well_frame frame;
+	struct well_contact c;
+	u_int i;
+	int len, sx, sy, dx, dy;
+
+	params = &well_dev_params[data[0] % DEV_WELLSPRING_N];
+	sx = (data[1] << 8 | data[2]) + 1;
+	sy = (data[3] << 8 | data[4]) + 1;
+	data += FUZZ_HEADER;
+	size -= FUZZ_HEADER;
+
+	if ((len = well_frame_len(params, MIN(size, INT_MAX))) < 0)
+		return;
+	well_norm_init(&norm[WELL_AXIS_X], &params->x_calib);
+	well_norm_init(&norm[WELL_AXIS_Y], &params->y_calib);
+	memset(&track, 0, sizeof(track));
+	well_accel_init(&track.accel, WELL_ACCEL_FACTOR_MAX);
+
+	well_decode_frame(params, data, len, &frame);
+	well_track(&track, norm, &frame, 0, &dx, &dy);
+	for (i = 0; i < frame.nfingers; i++)
+		well_ellipse(sx, sy, frame.touch_major[i],
+		    frame.touch_minor[i], frame.orientation[i], &c);
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	uint64_t t0;
+	char *env;
+	int i;
+
+	if (size < FUZZ_HEADER)
+		return (0);
+	if (fuzz_budget == 0) {
+		env = getenv("WELL_FUZZ_BUDGET");
+		fuzz_budget = env != NULL ? strtoull(env, NULL, 10) : 0;
+		if (fuzz_budget == 0)
+			fuzz_budget = FUZZ_BUDGET;
+	}
+
+	/* A single slow run may be the scheduler's doing. */
+	for (i = 0; i < FUZZ_TRIES; i++) {
+		t0 = well_test_ns();
+		fuzz_frame(data, size);
+		fuzz_last = well_test_ns() - t0;
+		if (fuzz_last <= fuzz_budget)
+			return (0);
+	}
+	fprintf(stderr, "%zu byte input took %ju ns, over the budget of "
+	    "%ju\n", size, (uintmax_t)fuzz_last, (uintmax_t)fuzz_budget);
+	abort();
+}
+
+#ifndef WELL_LIBFUZZER
+int
+main(int argc, char **argv)
+{
+	uint8_t buf[FUZZ_MAXLEN];
+	size_t size;
+	FILE *fp;
+	int i, verbose = 0;
+
+	if (argc > 1 && strcmp(argv[1], "-v") == 0) {
+		verbose = 1;
+		argc--;
+		argv++;
+	}
+	for (i = 1; i < argc; i++) {
+		if ((fp = fopen(argv[i], "r")) == NULL)
+			err(1, "%s", argv[i]);
+		size = fread(buf, 1, sizeof(buf), fp);
+		if (ferror(fp))
+			err(1, "%s", argv[i]);
+		fclose(fp);
+		LLVMFuzzerTestOneInput(buf, size);
+		if (verbose)
+			printf("%ju %s\n", (uintmax_t)fuzz_last, argv[i]);
+	}
+	printf("fuzz: %d inputs ok\n", argc - 1);
+	return (0);
+}
+#endif
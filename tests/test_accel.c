@@ -0,0 +1,120 @@
+/* Copyright (c) 2011 Eric McCorkle.  All rights reserved. */
+
+/* Pointer acceleration: the curve is monotonic in speed for every
+ * factor, factor 0 leaves motion alone, factor 1 leaves it alone up to
+ * WELL_ACCEL_THRESHOLD, and the Q8 remainder carried between frames
+ * loses no motion over long runs of small deltas.
+ */
+#include <sys/param.h>
+#include <sys/time.h>
+
+#include "well_core.h"
+#include "well_test.h"
+
+#define ACCEL_SPEED_MAX 64   /* deltas checked, past the last bucket */
+#define ACCEL_RUN 100000     /* frames of the remainder check */
+
+/* Output of one delta along X from a fresh state. */
+static int
+accel_once(int factor, int d)
+{
+	struct well_accel accel;
+	int dx = d, dy = 0;
+
+	well_accel_init(&accel, factor);
+	well_accel(&accel, &dx, &dy);
+	return (dx);
+}
+
+static void
+accel_curve(int factor)
+{
+	struct well_accel accel;
+	int d, gain, i, out, prev;
+
+	well_accel_init(&accel, factor);
+	for (i = 1; i < WELL_ACCEL_BUCKETS; i++) {
+		CHECK(accel.gain[i] >= accel.gain[i - 1],
+		    "factor %d: gain %d falls at bucket %d", factor,
+		    accel.gain[i], i);
+		CHECK(accel.gain[i] >= WELL_ACCEL_ONE &&
+		    accel.gain[i] <= WELL_ACCEL_MAX,
+		    "factor %d: gain %d out of range", factor, accel.gain[i]);
+	}
+
+	prev = 0;
+	for (d = 0; d <= ACCEL_SPEED_MAX; d++) {
+		out = accel_once(factor, d);
+		CHECK(out >= prev, "factor %d: delta %d gives %d, below %d",
+		    factor, d, out, prev);
+		CHECK(out >= d, "factor %d: delta %d slowed to %d", factor, d,
+		    out);
+		/* Negative motion rounds down as well. */
+		gain = accel.gain[MIN(d, WELL_ACCEL_BUCKETS - 1)];
+		CHECK(accel_once(factor, -d) ==
+		    -((d * gain + WELL_ACCEL_ONE - 1) >> WELL_ACCEL_SHIFT),
+		    "factor %d: delta %d gives %d", factor, -d,
+		    accel_once(factor, -d));
+		prev = out;
+	}
+}
+
+static void
+accel_identity(void)
+{
+	int d;
+
+	for (d = -ACCEL_SPEED_MAX; d <= ACCEL_SPEED_MAX; d++)
+		CHECK(accel_once(0, d) == d, "factor 0: delta %d gives %d", d,
+		    accel_once(0, d));
+	for (d = -WELL_ACCEL_THRESHOLD; d <= WELL_ACCEL_THRESHOLD; d++)
+		CHECK(accel_once(1, d) == d, "factor 1: delta %d gives %d", d,
+		    accel_once(1, d));
+}
+
+/* Random small deltas: the output must add up to the floor of the
+ * exact scaled sum, whatever the mix of gains and signs.
+ */
+static void
+accel_carry(int factor)
+{
+	struct well_accel accel;
+	int64_t want_x, want_y, got_x, got_y;
+	u_int ax, ay, speed;
+	int dx, dy, i, gain;
+
+	srandom(factor + 1);
+	well_accel_init(&accel, factor);
+	want_x = want_y = got_x = got_y = 0;
+	for (i = 0; i < ACCEL_RUN; i++) {
+		dx = (int)(random() % 9) - 4;
+		dy = (int)(random() % 7) - 3;
+		ax = abs(dx);
+		ay = abs(dy);
+		speed = MAX(ax, ay) + (MIN(ax, ay) >> 1);
+		gain = accel.gain[MIN(speed, WELL_ACCEL_BUCKETS - 1)];
+		want_x += dx * gain;
+		want_y += dy * gain;
+		well_accel(&accel, &dx, &dy);
+		got_x += dx;
+		got_y += dy;
+	}
+	CHECK(got_x == want_x >> WELL_ACCEL_SHIFT &&
+	    got_y == want_y >> WELL_ACCEL_SHIFT,
+	    "factor %d: moved %jd,%jd for %jd,%jd", factor, (intmax_t)got_x,
+	    (intmax_t)got_y, (intmax_t)(want_x >> WELL_ACCEL_SHIFT),
+	    (intmax_t)(want_y >> WELL_ACCEL_SHIFT));
+}
+
+int
+main(void)
+{
+	int factor;
+
+	accel_identity();
+	for (factor = 0; factor <= WELL_ACCEL_FACTOR_MAX; factor++) {
+		accel_curve(factor);
+		accel_carry(factor);
+	}
+	return (well_test_done("accel"));
+}
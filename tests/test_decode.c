@@ -0,0 +1,111 @@
+/* Copyright (c) 2011 Eric McCorkle.  All rights reserved. */
+
+/* Decoding: every back end of the finger record transpose must give
+ * the scalar one's frame, for random records and every contact count
+ * of every model.  Also reports the time per frame of each back end
+ * for 1, 4 and 16 contacts.
+ */
+#include <sys/param.h>
+#include <sys/time.h>
+
+#include "well_core.h"
+#include "well_test.h"
+
+#define DECODE_ROUNDS 200   /* random frames per count */
+#define DECODE_TIMED 200000 /* frames per timing */
+#define DECODE_BEST 5       /* timings, keeping the best */
+
+static const char *decode_names[WELL_DECODE_N] = {
+	[WELL_DECODE_SCALAR] = "scalar",
+	[WELL_DECODE_SSE2]   = "sse2",
+};
+
+static void
+decode_fill(uint8_t *data, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		data[i] = random();
+}
+
+static void
+decode_check(int backend)
+{
+	const struct well_dev_params *params;
+	struct well_frame want, got;
+	uint8_t data[WELL_TYPE_2_OFFSET + WELL_FINGER_DATALEN];
+	int len, model, n, round;
+
+	srandom(backend + 1);
+	for (model = 0; model < DEV_WELLSPRING_N; model++) {
+		params = &well_dev_params[model];
+		for (n = 0; n <= WELL_MAX_FINGERS; n++)
+			for (round = 0; round < DECODE_ROUNDS; round++) {
+				len = params->finger_offset +
+				    n * WELL_FINGER_SIZE;
+				decode_fill(data, len);
+				memset(&want, 0, sizeof(want));
+				memset(&got, 0, sizeof(got));
+				well_decode_select(WELL_DECODE_SCALAR);
+				well_decode_frame(params, data, len, &want);
+				well_decode_select(backend);
+				well_decode_frame(params, data, len, &got);
+				CHECK(memcmp(&want, &got, sizeof(want)) == 0,
+				    "%s: %s, %d contacts: frames differ",
+				    decode_names[backend], params->name, n);
+			}
+	}
+}
+
+/* ns per frame of "n" contacts. */
+static double
+decode_time(int backend, int n)
+{
+	const struct well_dev_params *params;
+	struct well_frame frame;
+	uint8_t data[WELL_TYPE_2_OFFSET + WELL_FINGER_DATALEN];
+	volatile int sink;
+	uint64_t t0, best = UINT64_MAX;
+	int i, k, len;
+
+	params = &well_dev_params[DEV_WELLSPRING3];
+	len = params->finger_offset + n * WELL_FINGER_SIZE;
+	decode_fill(data, len);
+	well_decode_select(backend);
+	for (k = 0; k < DECODE_BEST; k++) {
+		t0 = well_test_ns();
+		for (i = 0; i < DECODE_TIMED; i++) {
+			data[params->finger_offset + 2] = i;
+			well_decode_frame(params, data, len, &frame);
+			sink = frame.x[0];
+		}
+		best = MIN(best, well_test_ns() - t0);
+	}
+	(void)sink;
+	return ((double)best / DECODE_TIMED);
+}
+
+int
+main(void)
+{
+	static const int counts[] = { 1, 4, 16 };
+	int backend;
+	u_int i;
+
+	for (backend = 0; backend < WELL_DECODE_N; backend++) {
+		if (well_decode_select(backend) != 0) {
+			printf("%s: not in this build\n",
+			    decode_names[backend]);
+			continue;
+		}
+		decode_check(backend);
+		printf("%s:", decode_names[backend]);
+		for (i = 0; i < nitems(counts); i++)
+			printf(" %d contacts %.1f ns", counts[i],
+			    decode_time(backend, counts[i]));
+		printf("\n");
+	}
+	well_decode_select(WELL_DECODE_SCALAR);
+	return (well_test_done("decode"));
+}
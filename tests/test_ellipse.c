@@ -0,0 +1,147 @@
+/* Copyright (c) 2011 Eric McCorkle.  All rights reserved. */
+
+/* Contact ellipses, well_ellipse(), against the same geometry in
+ * double precision: 108000 ellipses (30 major axes from 4 to 30000
+ * sensor units, 20 minor to major ratios, 180 orientations) at each of
+ * five scale pairs, up to the largest scale the size sysctls accept.
+ * Axes must be within 1 unit plus 2.5%, and angles within 0.14 degree
+ * unless the ellipse is near-circular: the error of the angle grows
+ * as the axes come together, and it is only checked while they are
+ * ELL_GAP units apart or more.  The largest scales also check that
+ * the arctangent does not overflow.
+ */
+#include <sys/param.h>
+#include <sys/time.h>
+
+#include <math.h>
+
+#include "well_core.h"
+#include "well_test.h"
+
+#define ELL_MAJORS 30
+#define ELL_RATIOS 20
+#define ELL_ORIENTS 180
+#define ELL_MAJOR_MIN 4
+#define ELL_MAJOR_MAX 30000
+#define ELL_ORIENT_MAX 16384 /* a quarter turn, as reported */
+#define ELL_AXIS_ABS 1.0     /* units */
+#define ELL_AXIS_REL 0.025
+#define ELL_ANGLE 14         /* 1/100 degree */
+#define ELL_GAP 32           /* units between the axes of a round one */
+#define ELL_AXIS_MAX 0xffff  /* exported axes saturate */
+
+static const struct {
+	int sx, sy; /* Q8 */
+} ell_scales[] = {
+	{ 256, 256 },
+	{ 300, 200 },
+	{ 200, 300 },
+	{ 64, 1024 },
+	{ 65536, 40000 },
+};
+
+struct ell_err {
+	double axis;   /* worst axis error, over the allowed one */
+	int    angle;  /* worst angle error, 1/100 degree */
+	u_int  count;
+	u_int  angles; /* ellipses with their angle checked */
+};
+
+/* The ellipse in double precision: singular values of the scaled axis
+ * vectors, and the angle of the major one.
+ */
+static void
+ell_ref(double sx, double sy, int major, int minor, int orientation,
+    double *rmajor, double *rminor, double *rangle)
+{
+	double t, ux, uy, vx, vy, p, q, r, d;
+	int o;
+
+	o = MIN(MAX(ELL_ORIENT_MAX - orientation, -ELL_ORIENT_MAX),
+	    ELL_ORIENT_MAX);
+	t = o * M_PI / 2 / ELL_ORIENT_MAX;
+	ux = major * sx * cos(t);
+	uy = major * sy * sin(t);
+	vx = -minor * sx * sin(t);
+	vy = minor * sy * cos(t);
+
+	p = (ux * ux + vx * vx + uy * uy + vy * vy) / 2;
+	q = (ux * ux + vx * vx - uy * uy - vy * vy) / 2;
+	r = ux * uy + vx * vy;
+	d = hypot(q, r);
+	*rmajor = sqrt(p + d);
+	*rminor = sqrt(MAX(p - d, 0));
+	*rangle = atan2(r, q) / 2 * 18000 / M_PI;
+}
+
+/* Difference of two axis angles, which are the same modulo 180. */
+static int
+ell_angle_diff(int a, double b)
+{
+	double d = fmod(fabs(a - b), 18000);
+
+	return (lround(MIN(d, 18000 - d)));
+}
+
+static void
+ell_check(int sx, int sy, int major, int minor, int orientation,
+    struct ell_err *e)
+{
+	struct well_contact c;
+	double rmajor, rminor, rangle, tol, err;
+	int da;
+
+	well_ellipse(sx, sy, major, minor, orientation, &c);
+	ell_ref(sx / 256.0, sy / 256.0, major, minor, orientation, &rmajor,
+	    &rminor, &rangle);
+
+	if (rmajor - rminor >= ELL_GAP) {
+		da = ell_angle_diff(c.angle, rangle);
+		CHECK(da <= ELL_ANGLE, "scale %d,%d, axes %d,%d at %d: angle "
+		    "%d, not %.0f", sx, sy, major, minor, orientation, c.angle,
+		    rangle);
+		e->angle = MAX(e->angle, da);
+		e->angles++;
+	}
+
+	rmajor = MIN(rmajor, ELL_AXIS_MAX);
+	rminor = MIN(rminor, ELL_AXIS_MAX);
+	tol = ELL_AXIS_ABS + ELL_AXIS_REL * rmajor;
+	err = MAX(fabs(c.major - rmajor), fabs(c.minor - rminor));
+	CHECK(err <= tol, "scale %d,%d, axes %d,%d at %d: %u,%u, not "
+	    "%.1f,%.1f", sx, sy, major, minor, orientation, c.major, c.minor,
+	    rmajor, rminor);
+	e->axis = MAX(e->axis, err - tol);
+	e->count++;
+}
+
+int
+main(void)
+{
+	struct ell_err e;
+	double step;
+	u_int s;
+	int i, j, k, major;
+
+	step = pow((double)ELL_MAJOR_MAX / ELL_MAJOR_MIN,
+	    1.0 / (ELL_MAJORS - 1));
+	for (s = 0; s < nitems(ell_scales); s++) {
+		memset(&e, 0, sizeof(e));
+		e.axis = -HUGE_VAL;
+		for (i = 0; i < ELL_MAJORS; i++) {
+			major = lround(ELL_MAJOR_MIN * pow(step, i));
+			for (j = 1; j <= ELL_RATIOS; j++)
+				for (k = 0; k < ELL_ORIENTS; k++)
+					ell_check(ell_scales[s].sx,
+					    ell_scales[s].sy, major,
+					    major * j / ELL_RATIOS,
+					    2 * ELL_ORIENT_MAX * k /
+					    (ELL_ORIENTS - 1), &e);
+		}
+		printf("scale %d,%d: %u ellipses, axes %+.2f of the bound, "
+		    "%u angles within %d.%02d degree\n", ell_scales[s].sx,
+		    ell_scales[s].sy, e.count, e.axis, e.angles,
+		    e.angle / 100, e.angle % 100);
+	}
+	return (well_test_done("ellipse"));
+}
@@ -0,0 +1,205 @@
+/* Copyright (c) 2011 Eric McCorkle.  All rights reserved. */
+
+/* Scrolling and momentum, on a virtual clock: frames and momentum
+ * ticks are fed at fixed simulated times, so every run is the same.
+ * Checks the wheel steps of a steady scroll, the start threshold and
+ * the clamp of a fling, and that momentum decays in the direction of
+ * the scroll, adds up to what the decay predicts, and always stops,
+ * even at the slowest decay allowed.  A fling a frame or two after the
+ * scroll starts must carry the velocity of those frames, whatever the
+ * interval of the scroll before.
+ */
+#include <sys/param.h>
+#include <sys/time.h>
+
+#include <math.h>
+#include <string.h>
+
+#include "well_core.h"
+#include "well_test.h"
+
+#define KIN_FRAME 8000     /* us between frames */
+#define KIN_FRAMES 50      /* frames of the steady scroll */
+#define KIN_TICKS_MAX 5000 /* bound on any coast */
+
+struct kin_run {
+	int steps;  /* wheel steps while scrolling */
+	int ticks;  /* momentum ticks until it stopped */
+	int coast;  /* wheel steps of the momentum */
+	int turns;  /* steps against the scroll */
+	int rises;  /* ticks where the velocity grew */
+};
+
+static void
+kin_advance(struct timeval *tv, int us)
+{
+	tv->tv_usec += us;
+	tv->tv_sec += tv->tv_usec / 1000000;
+	tv->tv_usec %= 1000000;
+}
+
+/* Scroll "dy" per frame for "frames" frames "us" apart, lift off and
+ * coast with "decay".  Returns whether momentum started.
+ */
+static int
+kin_run(int dy, int frames, int us, u_int decay, struct kin_run *run)
+{
+	struct well_scroll scroll;
+	struct timeval tv = { 1000, 0 };
+	int dz, i, kv, started;
+
+	memset(&scroll, 0, sizeof(scroll));
+	memset(run, 0, sizeof(*run));
+	well_scroll_reset(&scroll, &tv);
+	for (i = 0; i < frames; i++) {
+		kin_advance(&tv, us);
+		run->steps += well_scroll(&scroll, &tv, dy);
+	}
+
+	started = well_scroll_fling(&scroll);
+	CHECK(abs(scroll.kv) <= WELL_KINETIC_MAX, "fling %d over the clamp",
+	    scroll.kv);
+	while (started && run->ticks < KIN_TICKS_MAX) {
+		kv = scroll.kv;
+		run->ticks++;
+		if (!well_scroll_coast(&scroll, decay, &dz))
+			break;
+		run->coast += dz;
+		if (dz * dy > 0)
+			run->turns++;
+		if (abs(scroll.kv) > abs(kv))
+			run->rises++;
+	}
+	CHECK(scroll.kv == 0 || !started,
+	    "decay %u: still coasting after %d ticks", decay, run->ticks);
+	return (started);
+}
+
+/* Steps of a coast from "kv", by the same recurrence in floating
+ * point.
+ */
+static double
+kin_expect(double kv, u_int decay)
+{
+	double sum = 0;
+
+	for (;;) {
+		kv *= decay / (double)WELL_KINETIC_ONE;
+		if (fabs(kv) < WELL_KINETIC_MIN)
+			return (sum / WELL_SCROLL_STEP);
+		sum += kv;
+	}
+}
+
+static void
+kin_steady(int dy)
+{
+	struct well_scroll scroll;
+	struct timeval tv = { 1000, 0 };
+	struct kin_run run;
+	int i, want;
+
+	/* Fingers moving down scroll down, one step per 16 units. */
+	CHECK(kin_run(dy, KIN_FRAMES, KIN_FRAME, 243, &run),
+	    "dy %d: no momentum", dy);
+	want = -dy * KIN_FRAMES * WELL_KINETIC_ONE;
+	want = want >= 0 ? want / WELL_SCROLL_STEP :
+	    -((-want + WELL_SCROLL_STEP - 1) / WELL_SCROLL_STEP);
+	CHECK(run.steps == want, "dy %d: %d steps, not %d", dy, run.steps,
+	    want);
+	CHECK(run.turns == 0 && run.rises == 0,
+	    "dy %d: coast turned %d times, sped up %d times", dy, run.turns,
+	    run.rises);
+
+	/* Compare the coast with the velocity the fling starts from. */
+	memset(&scroll, 0, sizeof(scroll));
+	well_scroll_reset(&scroll, &tv);
+	for (i = 0; i < KIN_FRAMES; i++) {
+		kin_advance(&tv, KIN_FRAME);
+		well_scroll(&scroll, &tv, dy);
+	}
+	well_scroll_fling(&scroll);
+	CHECK(fabs(run.coast - kin_expect(scroll.kv, 243)) <= 1.5,
+	    "dy %d: coasted %d steps, not about %.1f", dy, run.coast,
+	    kin_expect(scroll.kv, 243));
+}
+
+/* Scroll at another pace, reset and fling after "frames" frames of
+ * "dy" "us" apart: the momentum is that of those frames.
+ */
+static void
+kin_reset(int dy, int frames, int us, int before)
+{
+	struct well_scroll scroll;
+	struct timeval tv = { 1000, 0 };
+	int64_t want;
+	int i;
+
+	memset(&scroll, 0, sizeof(scroll));
+	if (before != 0) {
+		well_scroll_reset(&scroll, &tv);
+		for (i = 0; i < KIN_FRAMES; i++) {
+			kin_advance(&tv, before);
+			well_scroll(&scroll, &tv, dy / 2);
+		}
+		kin_advance(&tv, 500000);
+	}
+	well_scroll_reset(&scroll, &tv);
+	for (i = 0; i < frames; i++) {
+		kin_advance(&tv, us);
+		well_scroll(&scroll, &tv, dy);
+	}
+
+	want = (int64_t)-dy * WELL_KINETIC_ONE * WELL_KINETIC_TICK * 1000 /
+	    us;
+	want = MIN(MAX(want, -WELL_KINETIC_MAX), WELL_KINETIC_MAX);
+	CHECK(well_scroll_fling(&scroll) &&
+	    llabs(scroll.kv - want) <= llabs(want) / 8,
+	    "dy %d, %d frames %d us apart after %d us: fling %d, not %jd",
+	    dy, frames, us, before, scroll.kv, (intmax_t)want);
+}
+
+int
+main(void)
+{
+	struct kin_run run;
+	u_int decay;
+
+	kin_steady(-10);
+	kin_steady(10);
+	kin_steady(-37);
+
+	/* Flings right after the reset. */
+	kin_reset(-10, 1, KIN_FRAME, 0);
+	kin_reset(-10, 2, KIN_FRAME, 0);
+	kin_reset(12, 2, KIN_FRAME, 0);
+	kin_reset(-10, 2, KIN_FRAME, 4 * KIN_FRAME);
+	kin_reset(-10, 2, 4 * KIN_FRAME, KIN_FRAME / 4);
+	kin_reset(-20, 3, KIN_FRAME / 2, 2 * KIN_FRAME);
+
+	/* Too slow for momentum. */
+	CHECK(!kin_run(-1, KIN_FRAMES, KIN_FRAME, 243, &run),
+	    "slow scroll started momentum");
+
+	/* No decay at all stops at the first tick. */
+	CHECK(kin_run(-20, KIN_FRAMES, KIN_FRAME, 0, &run) &&
+	    run.ticks == 1 && run.coast == 0,
+	    "decay 0: %d ticks, %d steps", run.ticks, run.coast);
+
+	/* Every allowed decay stops, and so does a fling clamped to
+	 * WELL_KINETIC_MAX from an absurd frame interval.
+	 */
+	for (decay = 0; decay < WELL_KINETIC_ONE; decay++) {
+		kin_run(-40, KIN_FRAMES, KIN_FRAME, decay, &run);
+		CHECK(run.rises == 0, "decay %u: sped up", decay);
+	}
+	kin_run(-1000, KIN_FRAMES, 100, WELL_KINETIC_ONE - 1, &run);
+	CHECK(run.ticks > 1 && run.ticks < KIN_TICKS_MAX && run.rises == 0,
+	    "fastest fling: %d ticks", run.ticks);
+
+	/* Out of range decays are held below one. */
+	kin_run(-40, KIN_FRAMES, KIN_FRAME, 1000, &run);
+	CHECK(run.ticks < KIN_TICKS_MAX, "decay 1000 never stops");
+
+	return (well_test_done("kinetic"));
+}
@@ -0,0 +1,85 @@
+/* Copyright (c) 2011 Eric McCorkle.  All rights reserved. */
+
+/* Normalization: well_normalize() must equal the division it replaces,
+ * floor((raw - min) * res / (max - min)) with raw clamped to the
+ * calibrated range, for every raw value of every axis of every model.
+ * Also reports the throughput of both.
+ */
+#include <sys/param.h>
+#include <sys/time.h>
+
+#include "well_core.h"
+#include "well_test.h"
+
+#define NORM_MARGIN 512  /* raw values checked beyond each end */
+#define NORM_ROUNDS 64   /* passes over the range for the timing */
+
+static int
+norm_div(const struct well_calib *calib, int raw)
+{
+	raw = MIN(MAX(raw, calib->min), calib->max);
+	return ((int64_t)(raw - calib->min) * calib->res /
+	    (calib->max - calib->min));
+}
+
+static void
+norm_check(const char *model, const char *axis,
+    const struct well_calib *calib)
+{
+	struct well_norm norm;
+	int raw, got, want;
+
+	well_norm_init(&norm, calib);
+	for (raw = calib->min - NORM_MARGIN; raw <= calib->max + NORM_MARGIN;
+	    raw++) {
+		got = well_normalize(&norm, raw);
+		want = norm_div(calib, raw);
+		CHECK(got == want, "%s %s: raw %d gives %d, not %d", model,
+		    axis, raw, got, want);
+	}
+}
+
+/* Time both forms over the X range of a model, in ns per value. */
+static void
+norm_time(const struct well_calib *calib)
+{
+	struct well_norm norm;
+	volatile int sink;
+	uint64_t t0, t1, t2;
+	int raw, round, sum;
+
+	well_norm_init(&norm, calib);
+	sum = 0;
+	t0 = well_test_ns();
+	for (round = 0; round < NORM_ROUNDS; round++)
+		for (raw = calib->min; raw <= calib->max; raw++)
+			sum += well_normalize(&norm, raw);
+	t1 = well_test_ns();
+	for (round = 0; round < NORM_ROUNDS; round++)
+		for (raw = calib->min; raw <= calib->max; raw++)
+			sum += norm_div(calib, raw);
+	t2 = well_test_ns();
+	sink = sum;
+	(void)sink;
+
+	printf("normalize %.2f ns, divide %.2f ns per value\n",
+	    (double)(t1 - t0) / NORM_ROUNDS / (calib->max - calib->min + 1),
+	    (double)(t2 - t1) / NORM_ROUNDS / (calib->max - calib->min + 1));
+}
+
+int
+main(void)
+{
+	const struct well_dev_params *params;
+	int i;
+
+	for (i = 0; i < DEV_WELLSPRING_N; i++) {
+		params = &well_dev_params[i];
+		norm_check(params->name, "x", &params->x_calib);
+		norm_check(params->name, "y", &params->y_calib);
+		norm_check(params->name, "pressure", &params->press_calib);
+		norm_check(params->name, "width", &params->width_calib);
+	}
+	norm_time(&well_dev_params[DEV_WELLSPRING].x_calib);
+	return (well_test_done("norm"));
+}
@@ -0,0 +1,113 @@
+/* Copyright (c) 2011 Eric McCorkle.  All rights reserved. */
+
+/* Pointer prediction, on a virtual clock.  At a steady speed the
+ * offset converges to the motion over the horizon; it stays within
+ * WELL_PREDICT_MAX, drops to nothing on a reversal, and whatever was
+ * handed out is taken back whole by well_predict_reset(), so that a
+ * predicting reader ends up where the finger is.
+ */
+#include <sys/param.h>
+#include <sys/time.h>
+
+#include "well_core.h"
+#include "well_test.h"
+
+#define PRED_FRAME 8000   /* us between frames */
+#define PRED_HORIZON 16   /* ms, two frames */
+#define PRED_WARMUP 12    /* frames for the gain to settle */
+#define PRED_STROKES 2000
+
+static void
+pred_advance(struct timeval *tv, int us)
+{
+	tv->tv_usec += us;
+	tv->tv_sec += tv->tv_usec / 1000000;
+	tv->tv_usec %= 1000000;
+}
+
+/* Steady motion (vx, vy) per frame predicts about two frames of it. */
+static void
+pred_steady(int vx, int vy)
+{
+	struct well_pred pred;
+	struct timeval tv = { 1000, 0 };
+	int i, pdx, pdy, sx = 0, sy = 0;
+
+	memset(&pred, 0, sizeof(pred));
+	well_predict_reset(&pred, &tv, &pdx, &pdy);
+	for (i = 0; i < PRED_WARMUP; i++) {
+		pred_advance(&tv, PRED_FRAME);
+		well_predict(&pred, &tv, PRED_HORIZON, vx, vy, &pdx, &pdy);
+		sx += pdx;
+		sy += pdy;
+	}
+	CHECK(abs(pred.ox - MIN(MAX(2 * vx, -WELL_PREDICT_MAX),
+	    WELL_PREDICT_MAX)) <= 1 &&
+	    abs(pred.oy - MIN(MAX(2 * vy, -WELL_PREDICT_MAX),
+	    WELL_PREDICT_MAX)) <= 1,
+	    "speed %d,%d: offset %d,%d", vx, vy, pred.ox, pred.oy);
+	CHECK(sx == pred.ox && sy == pred.oy,
+	    "speed %d,%d: handed out %d,%d for an offset of %d,%d", vx, vy,
+	    sx, sy, pred.ox, pred.oy);
+
+	/* A reversal drops the prediction at once. */
+	pred_advance(&tv, PRED_FRAME);
+	well_predict(&pred, &tv, PRED_HORIZON, -vx, -vy, &pdx, &pdy);
+	CHECK(pred.ox == 0 && pred.oy == 0,
+	    "speed %d,%d: offset %d,%d after a reversal", vx, vy, pred.ox,
+	    pred.oy);
+}
+
+/* Random strokes, ended by a lift-off or a rest at random: the
+ * retraction always cancels all that was handed out.
+ */
+static void
+pred_retract(void)
+{
+	struct well_pred pred;
+	struct timeval tv = { 1000, 0 };
+	int i, k, n, dx, dy, pdx, pdy, sx, sy;
+
+	srandom(1);
+	memset(&pred, 0, sizeof(pred));
+	for (k = 0; k < PRED_STROKES; k++) {
+		well_predict_reset(&pred, &tv, &pdx, &pdy);
+		sx = sy = 0;
+		n = 1 + random() % 40;
+		dx = (int)(random() % 61) - 30;
+		dy = (int)(random() % 61) - 30;
+		for (i = 0; i < n; i++) {
+			pred_advance(&tv,
+			    PRED_FRAME / 2 + random() % PRED_FRAME);
+			/* Some strokes slow to a stop before they end. */
+			if (k % 3 == 0 && i > n / 2)
+				dx = dy = 0;
+			well_predict(&pred, &tv, PRED_HORIZON,
+			    dx + (int)(random() % 5) - 2,
+			    dy + (int)(random() % 5) - 2, &pdx, &pdy);
+			CHECK(abs(pred.ox) <= WELL_PREDICT_MAX &&
+			    abs(pred.oy) <= WELL_PREDICT_MAX,
+			    "stroke %d: offset %d,%d", k, pred.ox, pred.oy);
+			sx += pdx;
+			sy += pdy;
+		}
+		well_predict_reset(&pred, &tv, &pdx, &pdy);
+		CHECK(sx + pdx == 0 && sy + pdy == 0,
+		    "stroke %d: %d,%d left after the retraction", k, sx + pdx,
+		    sy + pdy);
+		well_predict_reset(&pred, &tv, &pdx, &pdy);
+		CHECK(pdx == 0 && pdy == 0, "stroke %d: retracted twice", k);
+	}
+}
+
+int
+main(void)
+{
+	pred_steady(10, 0);
+	pred_steady(0, -7);
+	pred_steady(5, 3);
+	pred_steady(-50, 40);
+	pred_steady(1, 1);
+	pred_retract();
+	return (well_test_done("predict"));
+}
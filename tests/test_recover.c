@@ -0,0 +1,252 @@
+/* Copyright (c) 2011 Eric McCorkle.  All rights reserved. */
+
+/* Error recovery, on a virtual clock in ms.  A pipe completes a
+ * transfer every REC_FRAME ms while it runs, failing inside the given
+ * bursts, and the mode reset takes REC_RESET ms, failing inside its
+ * own bursts; the recovery machine decides when the pipe runs, as the
+ * kernel does.  Checks that short bursts never stop the pipe, that the
+ * backoff doubles up to its cap, that the pipe comes back once the
+ * errors stop, and that it gives up after exactly the budget, failed
+ * resets included.
+ */
+#include <sys/param.h>
+#include <sys/time.h>
+
+#include <string.h>
+
+#include "well_core.h"
+#include "well_test.h"
+
+#define REC_FRAME 8     /* ms between transfers */
+#define REC_RESET 2     /* ms for a mode reset */
+#define REC_END 60000   /* ms simulated */
+#define REC_DELAYS 32
+
+struct rec_burst {
+	int from;
+	int to;         /* ms, exclusive */
+};
+
+struct rec_run {
+	struct well_recover rec;
+	u_int delay[REC_DELAYS]; /* backoffs in order */
+	u_int ndelays;
+	u_int errors;   /* transfers that failed */
+	int giveup;     /* ms it gave up at, or -1 */
+	int good;       /* ms of the last good transfer */
+	int recovered;  /* attempts of the last episode that ended */
+};
+
+static const struct well_recover_cfg rec_cfg = { 8, 10, 2000 };
+
+static int
+rec_in(const struct rec_burst *b, int t)
+{
+	for (; b != NULL && b->to > b->from; b++)
+		if (t >= b->from && t < b->to)
+			return (1);
+	return (0);
+}
+
+/* Take action "act" at "t", with the pipe stopped unless it says go. */
+static int
+rec_act(struct rec_run *run, int act, u_int delay, int t, int *timer)
+{
+	switch (act) {
+	case WELL_RECOVER_GO:
+		return (t + REC_FRAME);
+	case WELL_RECOVER_WAIT:
+		if (run->ndelays < REC_DELAYS)
+			run->delay[run->ndelays] = delay;
+		run->ndelays++;
+		*timer = t + delay;
+		break;
+	case WELL_RECOVER_GIVEUP:
+		CHECK(run->giveup < 0, "gave up twice");
+		run->giveup = t;
+		break;
+	}
+	return (-1);
+}
+
+/* Run the pipe with transfers failing in "xfer" and resets failing in
+ * "reset", from a running start and with "run" carried over.
+ */
+static void
+rec_sim(struct rec_run *run, const struct well_recover_cfg *cfg,
+    const struct rec_burst *xfer, const struct rec_burst *reset, int end)
+{
+	int act, next = 0, timer = -1, done = -1;
+	u_int delay = 0, tries;
+	int t;
+
+	run->giveup = -1;
+	run->ndelays = 0;
+	for (t = 0; t < end; t++) {
+		if (timer == t) {
+			timer = -1;
+			if (well_recover_timeout(&run->rec))
+				done = t + REC_RESET;
+		}
+		if (done == t) {
+			done = -1;
+			act = well_recover_reset(&run->rec, !rec_in(reset, t),
+			    cfg, &delay);
+			next = rec_act(run, act, delay, t, &timer);
+		}
+		if (next != t)
+			continue;
+		if (rec_in(xfer, t)) {
+			run->rec.errs++;
+			run->errors++;
+		} else {
+			run->good = t;
+			if ((tries = well_recover_good(&run->rec)) != 0)
+				run->recovered = tries;
+		}
+		act = well_recover_setup(&run->rec, cfg, &delay);
+		next = rec_act(run, act, delay, t, &timer);
+	}
+	CHECK(timer < 0 || timer >= end, "timer left at %d", timer);
+}
+
+static void
+rec_start(struct rec_run *run)
+{
+	memset(run, 0, sizeof(*run));
+	well_recover_clear(&run->rec);
+}
+
+/* Bursts shorter than the threshold never stop the pipe. */
+static void
+rec_short(void)
+{
+	struct rec_burst xfer[] = {
+		{ 100, 100 + REC_FRAME * (WELL_ERR_THRESHOLD - 1) },
+		{ 500, 500 + REC_FRAME * (WELL_ERR_THRESHOLD - 1) },
+		{ 0, 0 }
+	};
+	struct rec_run run;
+
+	rec_start(&run);
+	rec_sim(&run, &rec_cfg, xfer, NULL, 1000);
+	CHECK(run.errors == 2 * (WELL_ERR_THRESHOLD - 1),
+	    "short bursts: %u errors", run.errors);
+	CHECK(run.ndelays == 0 && run.rec.total == 0 &&
+	    run.rec.state == WELL_RECOVER_NONE,
+	    "short bursts: %u backoffs, %u attempts, state %u", run.ndelays,
+	    run.rec.total, run.rec.state);
+	CHECK(run.good >= 1000 - REC_FRAME, "short bursts: pipe stopped at %d",
+	    run.good);
+}
+
+/* A burst long enough for a few attempts, then good frames. */
+static void
+rec_burst(void)
+{
+	struct rec_burst xfer[] = { { 100, 400 }, { 0, 0 } };
+	struct rec_run run;
+	u_int i;
+
+	rec_start(&run);
+	rec_sim(&run, &rec_cfg, xfer, NULL, 5000);
+	CHECK(run.ndelays >= 3 && run.ndelays < rec_cfg.budget,
+	    "burst: %u backoffs", run.ndelays);
+	for (i = 0; i < run.ndelays && i < REC_DELAYS; i++)
+		CHECK(run.delay[i] == rec_cfg.base << i,
+		    "burst: backoff %u is %u ms", i, run.delay[i]);
+	CHECK(run.rec.state == WELL_RECOVER_NONE && run.rec.tries == 0 &&
+	    run.rec.errs == 0, "burst: state %u, %u tries, %u errors",
+	    run.rec.state, run.rec.tries, run.rec.errs);
+	CHECK(run.recovered == (int)run.ndelays &&
+	    run.rec.total == run.ndelays,
+	    "burst: recovered after %d attempts, %u in all, %u backoffs",
+	    run.recovered, run.rec.total, run.ndelays);
+	CHECK(run.good >= 5000 - REC_FRAME, "burst: pipe stopped at %d",
+	    run.good);
+
+	/* A second episode starts from the first backoff again, and adds
+	 * to the total.
+	 */
+	rec_sim(&run, &rec_cfg, xfer, NULL, 5000);
+	CHECK(run.delay[0] == rec_cfg.base && run.rec.tries == 0 &&
+	    run.rec.total == 2 * (u_int)run.recovered,
+	    "burst again: first backoff %u, %u tries, %u in all",
+	    run.delay[0], run.rec.tries, run.rec.total);
+}
+
+/* Errors that never stop: exactly the budget, then no more. */
+static void
+rec_forever(const struct well_recover_cfg *cfg,
+    const struct rec_burst *reset)
+{
+	struct rec_burst xfer[] = { { 100, REC_END }, { 0, 0 } };
+	struct rec_burst again[] = { { 0, REC_END }, { 0, 0 } };
+	struct rec_run run;
+	u_int errors, i, want;
+
+	rec_start(&run);
+	rec_sim(&run, cfg, xfer, reset, REC_END);
+	CHECK(run.giveup > 0 && run.rec.state == WELL_RECOVER_FAILED,
+	    "budget %u: state %u, gave up at %d", cfg->budget, run.rec.state,
+	    run.giveup);
+	CHECK(run.rec.tries == cfg->budget && run.rec.total == cfg->budget &&
+	    run.ndelays == cfg->budget,
+	    "budget %u: %u tries, %u in all, %u backoffs", cfg->budget,
+	    run.rec.tries, run.rec.total, run.ndelays);
+	for (i = 0; i < run.ndelays && i < REC_DELAYS; i++) {
+		want = i < 16 ? MIN(cfg->base << i, cfg->max) : cfg->max;
+		CHECK(run.delay[i] == want, "budget %u: backoff %u is %u ms, "
+		    "not %u", cfg->budget, i, run.delay[i], want);
+	}
+
+	/* Failed, a transfer still in flight stops the pipe for good. */
+	errors = run.errors;
+	rec_sim(&run, cfg, again, reset, 1000);
+	CHECK(run.errors == errors + 1 && run.rec.total == cfg->budget &&
+	    run.giveup < 0, "failed: %u more errors, %u attempts",
+	    run.errors - errors, run.rec.total);
+}
+
+/* Failed resets count as attempts, and a good one resumes. */
+static void
+rec_resets(void)
+{
+	struct rec_burst xfer[] = { { 100, 200 }, { 0, 0 } };
+	struct rec_burst reset[] = { { 0, 400 }, { 0, 0 } };
+	struct rec_run run;
+
+	rec_start(&run);
+	rec_sim(&run, &rec_cfg, xfer, reset, 5000);
+	CHECK(run.rec.state == WELL_RECOVER_NONE && run.recovered >= 4,
+	    "failed resets: state %u, recovered after %d attempts",
+	    run.rec.state, run.recovered);
+	CHECK(run.ndelays == (u_int)run.recovered &&
+	    run.delay[run.ndelays - 1] ==
+	    rec_cfg.base << (run.ndelays - 1),
+	    "failed resets: %u backoffs for %d attempts", run.ndelays,
+	    run.recovered);
+}
+
+int
+main(void)
+{
+	struct well_recover_cfg capped = { 8, 10, 300 };
+	struct well_recover_cfg one = { 1, 10, 2000 };
+	struct well_recover_cfg none = { 0, 10, 2000 };
+	struct well_recover_cfg long_ = { 20, 10, 2000 };
+	struct rec_burst always[] = { { 0, REC_END }, { 0, 0 } };
+
+	rec_short();
+	rec_burst();
+	rec_forever(&rec_cfg, NULL);
+	rec_forever(&capped, NULL);
+	rec_forever(&one, NULL);
+	rec_forever(&long_, NULL);
+	rec_forever(&rec_cfg, always);
+	rec_resets();
+
+	/* No budget gives up at once. */
+	rec_forever(&none, NULL);
+	return (well_test_done("recover"));
+}
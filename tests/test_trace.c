@@ -0,0 +1,127 @@
+/* Copyright (c) 2011 Eric McCorkle.  All rights reserved. */
+
+/* Tracepoints in the host build: a function registered for a point is
+ * called each time the core fires it, with the probe's arguments, and
+ * no longer once it is unregistered.  The recording is decoded and
+ * tracked here, and replayed by "welluser -t", which must print one
+ * frame:decoded per frame.
+ */
+#include <sys/param.h>
+#include <sys/time.h>
+
+#include "well_core.h"
+#include "well_test.h"
+
+#define TRACE_FRAMES "data/stroke.frames"
+#define TRACE_MODEL DEV_WELLSPRING3
+
+static u_int trace_count[WELL_TRACE_N];
+static uintptr_t trace_args[WELL_TRACE_N][3];
+
+static void
+trace_hit(int point, uintptr_t a0, uintptr_t a1, uintptr_t a2)
+{
+	trace_count[point]++;
+	trace_args[point][0] = a0;
+	trace_args[point][1] = a1;
+	trace_args[point][2] = a2;
+}
+
+static void
+trace_core(void)
+{
+	const struct well_dev_params *params = &well_dev_params[TRACE_MODEL];
+	struct well_test_frame *raw;
+	struct well_norm norm[2];
+	struct well_track track;
+	struct well_frame frame;
+	uintptr_t *args = trace_args[WELL_TRACE_contacts_change];
+	u_int i, n, fingers, decoded = 0, changes = 0;
+	int len, dx, dy;
+
+	CHECK(well_trace_register(WELL_TRACE_frame_decoded, trace_hit) ==
+	    NULL, "frame:decoded registered already");
+	CHECK(well_trace_register(WELL_TRACE_contacts_change, trace_hit) ==
+	    NULL, "contacts:change registered already");
+	CHECK(well_trace_register(WELL_TRACE_N, trace_hit) == NULL &&
+	    well_trace_register(-1, trace_hit) == NULL,
+	    "registered a point out of range");
+
+	well_norm_init(&norm[WELL_AXIS_X], &params->x_calib);
+	well_norm_init(&norm[WELL_AXIS_Y], &params->y_calib);
+	memset(&track, 0, sizeof(track));
+	n = well_test_load(TRACE_FRAMES, &raw);
+	for (i = 0; i < n; i++) {
+		if ((len = well_frame_len(params, raw[i].len)) < 0)
+			continue;
+		well_decode_frame(params, raw[i].data, len, &frame);
+		decoded++;
+		CHECK(trace_count[WELL_TRACE_frame_decoded] == decoded &&
+		    trace_args[WELL_TRACE_frame_decoded][0] ==
+		    (uintptr_t)params &&
+		    trace_args[WELL_TRACE_frame_decoded][1] ==
+		    (uintptr_t)&frame,
+		    "frame %u: frame:decoded fired %u times", i,
+		    trace_count[WELL_TRACE_frame_decoded]);
+
+		fingers = track.fingers;
+		well_track(&track, norm, &frame, 0, &dx, &dy);
+		if (frame.nfingers != fingers) {
+			changes++;
+			CHECK(args[0] == (uintptr_t)&track &&
+			    args[1] == fingers && args[2] == frame.nfingers,
+			    "frame %u: contacts:change %ju to %ju, not %u to "
+			    "%u", i, (uintmax_t)args[1], (uintmax_t)args[2],
+			    fingers, frame.nfingers);
+		}
+		CHECK(trace_count[WELL_TRACE_contacts_change] == changes,
+		    "frame %u: contacts:change fired %u times, not %u", i,
+		    trace_count[WELL_TRACE_contacts_change], changes);
+	}
+	CHECK(changes > 1, "the recording has %u changes", changes);
+
+	/* Unregistered, it stays quiet. */
+	CHECK(well_trace_register(WELL_TRACE_frame_decoded, NULL) ==
+	    trace_hit, "frame:decoded lost its function");
+	well_decode_frame(params, raw[0].data,
+	    well_frame_len(params, raw[0].len), &frame);
+	CHECK(trace_count[WELL_TRACE_frame_decoded] == decoded,
+	    "frame:decoded fired once unregistered");
+	well_trace_register(WELL_TRACE_contacts_change, NULL);
+	free(raw);
+}
+
+/* welluser -t prints a frame:decoded line per frame it decodes. */
+static void
+trace_replay(void)
+{
+	const struct well_dev_params *params = &well_dev_params[TRACE_MODEL];
+	struct well_test_frame *raw;
+	char cmd[128], line[256];
+	u_int i, n, want = 0, got = 0;
+	FILE *fp;
+
+	n = well_test_load(TRACE_FRAMES, &raw);
+	for (i = 0; i < n; i++)
+		if (well_frame_len(params, raw[i].len) >= 0)
+			want++;
+	free(raw);
+
+	snprintf(cmd, sizeof(cmd), "./welluser -q -t -m %d -r %s 2>&1",
+	    TRACE_MODEL, TRACE_FRAMES);
+	if ((fp = popen(cmd, "r")) == NULL)
+		err(1, "%s", cmd);
+	while (fgets(line, sizeof(line), fp) != NULL)
+		if (strncmp(line, "frame:decoded ", 14) == 0)
+			got++;
+	CHECK(pclose(fp) == 0, "%s failed", cmd);
+	CHECK(got == want, "welluser traced %u frames, not %u", got, want);
+}
+
+int
+main(void)
+{
+	trace_core();
+	trace_replay();
+	return (well_test_done("trace"));
+}
@@ -0,0 +1,211 @@
+/* Copyright (c) 2011 Eric McCorkle.  All rights reserved. */
+
+/* Tracking of the primary finger, well_track(), against a model of
+ * the rules it implements: motion only while the finger count holds,
+ * accelerated for pointing and not for scrolling, with the remainder
+ * dropped when the count changes.  The recording is run through the
+ * core here, and through welluser's replay backend, which must print
+ * the same motion.
+ */
+#include <sys/param.h>
+#include <sys/time.h>
+
+#include "well_core.h"
+#include "well_test.h"
+
+#define TRACK_FRAMES "data/stroke.frames"
+#define TRACK_MODEL DEV_WELLSPRING3
+#define TRACK_ACCEL 4
+
+/* The rules, written out plainly. */
+struct track_ref {
+	struct well_accel accel;
+	u_int             fingers;
+	int               x;
+	int               y;
+};
+
+static void
+track_ref(struct track_ref *ref, const struct well_norm *norm,
+    const struct well_frame *frame, int scroll, int *dx, int *dy)
+{
+	int x, y;
+
+	*dx = *dy = 0;
+	if (frame->nfingers > 0) {
+		x = well_normalize(&norm[WELL_AXIS_X], frame->x[0]);
+		y = well_normalize(&norm[WELL_AXIS_Y], frame->y[0]);
+		if (frame->nfingers == ref->fingers) {
+			*dx = x - ref->x;
+			*dy = y - ref->y;
+			if (!scroll)
+				well_accel(&ref->accel, dx, dy);
+		} else {
+			ref->accel.rx = 0;
+			ref->accel.ry = 0;
+		}
+		ref->x = x;
+		ref->y = y;
+	}
+	ref->fingers = frame->nfingers;
+}
+
+/* Decode the recording, keeping the frames that have a valid length. */
+static u_int
+track_load(const struct well_dev_params *params, struct well_frame **framesp)
+{
+	struct well_test_frame *raw;
+	struct well_frame *frames;
+	u_int i, n, k;
+	int len;
+
+	n = well_test_load(TRACK_FRAMES, &raw);
+	if ((frames = calloc(n, sizeof(*frames))) == NULL)
+		err(1, "calloc");
+	for (i = k = 0; i < n; i++)
+		if ((len = well_frame_len(params, raw[i].len)) >= 0)
+			well_decode_frame(params, raw[i].data, len,
+			    &frames[k++]);
+	free(raw);
+	*framesp = frames;
+	return (k);
+}
+
+/* The core against the model, scrolling with two fingers like the
+ * kernel does.
+ */
+static void
+track_core(const struct well_norm *norm, const struct well_frame *frames,
+    u_int n)
+{
+	struct well_track track;
+	struct track_ref ref;
+	u_int i, fingers;
+	int dx, dy, rdx, rdy, ret, scroll, moves = 0, changes = 0;
+
+	memset(&track, 0, sizeof(track));
+	memset(&ref, 0, sizeof(ref));
+	well_accel_init(&track.accel, TRACK_ACCEL);
+	well_accel_init(&ref.accel, TRACK_ACCEL);
+	for (i = 0; i < n; i++) {
+		fingers = track.fingers;
+		scroll = frames[i].nfingers == 2;
+		ret = well_track(&track, norm, &frames[i], scroll, &dx, &dy);
+		track_ref(&ref, norm, &frames[i], scroll, &rdx, &rdy);
+		CHECK(dx == rdx && dy == rdy, "frame %u: %d,%d, not %d,%d", i,
+		    dx, dy, rdx, rdy);
+		if (frames[i].nfingers != fingers) {
+			CHECK(ret == WELL_TRACK_CHANGE, "frame %u: %d, not a "
+			    "change", i, ret);
+			changes++;
+		} else if (fingers == 0)
+			CHECK(ret == WELL_TRACK_IDLE, "frame %u: %d, not idle",
+			    i, ret);
+		else {
+			CHECK(ret == WELL_TRACK_MOVE, "frame %u: %d, not a "
+			    "move", i, ret);
+			moves++;
+		}
+	}
+	/* The recording has to exercise both. */
+	CHECK(moves > 0 && changes > 1, "%d moves, %d changes", moves,
+	    changes);
+}
+
+/* A finger landing far away does not move the pointer, and the
+ * remainder of the acceleration goes with the change.
+ */
+static void
+track_jump(const struct well_norm *norm)
+{
+	struct well_track track;
+	struct well_frame frame;
+	int dx, dy;
+
+	memset(&track, 0, sizeof(track));
+	memset(&frame, 0, sizeof(frame));
+	well_accel_init(&track.accel, TRACK_ACCEL);
+	frame.nfingers = 1;
+	frame.x[0] = norm[WELL_AXIS_X].min;
+	frame.y[0] = norm[WELL_AXIS_Y].min;
+	well_track(&track, norm, &frame, 0, &dx, &dy);
+	track.accel.rx = track.accel.ry = WELL_ACCEL_ONE - 1;
+
+	frame.nfingers = 2;
+	frame.x[0] = norm[WELL_AXIS_X].max;
+	frame.y[0] = norm[WELL_AXIS_Y].max;
+	CHECK(well_track(&track, norm, &frame, 0, &dx, &dy) ==
+	    WELL_TRACK_CHANGE && dx == 0 && dy == 0,
+	    "second finger moved %d,%d", dx, dy);
+	CHECK(track.accel.rx == 0 && track.accel.ry == 0,
+	    "remainder %d,%d kept", track.accel.rx, track.accel.ry);
+
+	frame.nfingers = 0;
+	CHECK(well_track(&track, norm, &frame, 0, &dx, &dy) ==
+	    WELL_TRACK_CHANGE && dx == 0 && dy == 0,
+	    "lift-off moved %d,%d", dx, dy);
+	CHECK(well_track(&track, norm, &frame, 0, &dx, &dy) ==
+	    WELL_TRACK_IDLE, "no finger, not idle");
+}
+
+/* welluser replaying the recording prints the model's motion, frame
+ * by frame.  It does not scroll.
+ */
+static void
+track_replay(const struct well_norm *norm, const struct well_frame *frames,
+    u_int n)
+{
+	struct track_ref ref;
+	char cmd[128], line[1024];
+	u_int i = 0, fingers, buttons;
+	int dx, dy, rdx, rdy;
+	FILE *fp;
+
+	snprintf(cmd, sizeof(cmd), "./welluser -a %d -m %d -r %s 2>/dev/null",
+	    TRACK_ACCEL, TRACK_MODEL, TRACK_FRAMES);
+	if ((fp = popen(cmd, "r")) == NULL)
+		err(1, "%s", cmd);
+
+	memset(&ref, 0, sizeof(ref));
+	well_accel_init(&ref.accel, TRACK_ACCEL);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "%u %x %d %d", &fingers, &buttons, &dx,
+		    &dy) != 4) {
+			CHECK(0, "welluser: bad line \"%s\"", line);
+			continue;
+		}
+		if (i >= n) {
+			i++;
+			continue;
+		}
+		track_ref(&ref, norm, &frames[i], 0, &rdx, &rdy);
+		CHECK(fingers == frames[i].nfingers &&
+		    buttons == frames[i].buttons && dx == rdx && dy == rdy,
+		    "welluser frame %u: %u %x %d,%d, not %u %x %d,%d", i,
+		    fingers, buttons, dx, dy, frames[i].nfingers,
+		    frames[i].buttons, rdx, rdy);
+		i++;
+	}
+	CHECK(pclose(fp) == 0, "%s failed", cmd);
+	CHECK(i == n, "welluser printed %u frames, not %u", i, n);
+}
+
+int
+main(void)
+{
+	const struct well_dev_params *params = &well_dev_params[TRACK_MODEL];
+	struct well_norm norm[2];
+	struct well_frame *frames;
+	u_int n;
+
+	well_norm_init(&norm[WELL_AXIS_X], &params->x_calib);
+	well_norm_init(&norm[WELL_AXIS_Y], &params->y_calib);
+	n = track_load(params, &frames);
+
+	track_core(norm, frames, n);
+	track_jump(norm);
+	track_replay(norm, frames, n);
+
+	free(frames);
+	return (well_test_done("track"));
+}
@@ -0,0 +1,120 @@
+/* Copyright (c) 2011 Eric McCorkle.  All rights reserved. */
+
+/* Zone maps: well_zone_compile() must reject what the sysctl rejects
+ * and leave every cell to the last rectangle touching it, with the
+ * specification's top left corner at the sensor's minimum X and
+ * maximum Y.  well_zone() must then find, for a contact anywhere on
+ * the sensor or beyond its edges, the zone of the cell it falls in,
+ * for every model.
+ */
+#include <sys/param.h>
+#include <sys/time.h>
+
+#include <errno.h>
+
+#include "well_core.h"
+#include "well_test.h"
+
+static const char *const zone_bad[] = {
+	"right",                        /* no rectangle */
+	"right:0,0,100",                /* too few values */
+	"right:0,0,100,100,5",          /* too many */
+	"right:0,0,100,1001",           /* off the pad */
+	"right:100,0,100,100",          /* empty */
+	"right:0,200,100,100",          /* upside down */
+	"left:0,0,100,100",             /* no such zone */
+	"right:0,0,100,100x",
+	"right:-1,0,100,100",
+};
+
+/* Raw position of thousandths "tx" from the left and "ty" from the
+ * top of the sensor.
+ */
+static void
+zone_at(const struct well_dev_params *params, int tx, int ty, int *x, int *y)
+{
+	*x = params->x_calib.min +
+	    (int64_t)tx * (params->x_calib.max - params->x_calib.min) / 1000;
+	*y = params->y_calib.max -
+	    (int64_t)ty * (params->y_calib.max - params->y_calib.min) / 1000;
+}
+
+static void
+zone_check(const struct well_dev_params *params)
+{
+	struct well_zone_map map;
+	char spec[WELL_ZONE_SPEC_LEN + 64];
+	u_int i, n;
+	int x, y;
+
+	for (i = 0; i < nitems(zone_bad); i++)
+		CHECK(well_zone_compile(params, zone_bad[i], &map) == EINVAL,
+		    "%s: \"%s\" accepted", params->name, zone_bad[i]);
+
+	/* One rectangle more than a map holds, and a specification
+	 * longer than the buffer.
+	 */
+	spec[0] = '\0';
+	for (n = 0; n <= WELL_ZONE_MAX; n++)
+		strcat(spec, "right:0,0,10,10 ");
+	CHECK(well_zone_compile(params, spec, &map) == EINVAL,
+	    "%s: %u rectangles accepted", params->name, n);
+	memset(spec, ' ', sizeof(spec) - 1);
+	spec[sizeof(spec) - 1] = '\0';
+	CHECK(well_zone_compile(params, spec, &map) == EINVAL,
+	    "%s: %zu byte specification accepted", params->name,
+	    sizeof(spec) - 1);
+
+	/* Nothing but blanks is no zone at all. */
+	CHECK(well_zone_compile(params, " \t\n", &map) == 0,
+	    "%s: blank specification rejected", params->name);
+	zone_at(params, 500, 500, &x, &y);
+	CHECK(well_zone(&map, x, y) == WELL_ZONE_NONE,
+	    "%s: zone in a blank map", params->name);
+	CHECK(well_zone(NULL, x, y) == WELL_ZONE_NONE,
+	    "%s: zone without a map", params->name);
+
+	/* The clickpad's right corner, a middle strip over it and a
+	 * scroll edge; the strip wins where it overlaps.
+	 */
+	CHECK(well_zone_compile(params, "right:500,800,1000,1000 "
+	    "middle:400,800,600,1000 vscroll:920,0,1000,800", &map) == 0,
+	    "%s: layout rejected", params->name);
+	zone_at(params, 990, 990, &x, &y);
+	CHECK(well_zone(&map, x, y) == WELL_ZONE_RIGHT,
+	    "%s: bottom right corner is zone %u", params->name,
+	    well_zone(&map, x, y));
+	zone_at(params, 550, 900, &x, &y);
+	CHECK(well_zone(&map, x, y) == WELL_ZONE_MIDDLE,
+	    "%s: bottom middle is zone %u", params->name,
+	    well_zone(&map, x, y));
+	zone_at(params, 990, 100, &x, &y);
+	CHECK(well_zone(&map, x, y) == WELL_ZONE_VSCROLL,
+	    "%s: right edge is zone %u", params->name,
+	    well_zone(&map, x, y));
+	zone_at(params, 100, 100, &x, &y);
+	CHECK(well_zone(&map, x, y) == WELL_ZONE_NONE,
+	    "%s: top left is zone %u", params->name, well_zone(&map, x, y));
+
+	/* Beyond the calibrated range, contacts are held to the edge. */
+	CHECK(well_zone(&map, params->x_calib.max + 1000,
+	    params->y_calib.min - 1000) == WELL_ZONE_RIGHT,
+	    "%s: past the bottom right corner is zone %u", params->name,
+	    well_zone(&map, params->x_calib.max + 1000,
+	    params->y_calib.min - 1000));
+	CHECK(well_zone(&map, params->x_calib.min - 1000,
+	    params->y_calib.max + 1000) == WELL_ZONE_NONE,
+	    "%s: past the top left corner is zone %u", params->name,
+	    well_zone(&map, params->x_calib.min - 1000,
+	    params->y_calib.max + 1000));
+}
+
+int
+main(void)
+{
+	int i;
+
+	for (i = 0; i < DEV_WELLSPRING_N; i++)
+		zone_check(&well_dev_params[i]);
+	return (well_test_done("zone"));
+}
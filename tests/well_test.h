@@ -0,0 +1,126 @@
+/* Copyright (c) 2011 Eric McCorkle.  All rights reserved. */
+#ifndef _WELL_TEST_H_
+#define _WELL_TEST_H_
+
+#include <sys/endian.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Minimal harness for the host tests of the core.  CHECK() counts a
+ * failure and reports the first few; a test returns well_test_done(),
+ * which makes the exit status non-zero if anything failed.
+ */
+#define WELL_TEST_REPORT 10
+
+static u_int well_test_fails;
+
+#define CHECK(cond, ...) do {                                          \
+	if (!(cond)) {                                                 \
+		if (well_test_fails++ < WELL_TEST_REPORT) {            \
+			fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+			fprintf(stderr, __VA_ARGS__);                  \
+			fprintf(stderr, "\n");                         \
+		}                                                      \
+	}                                                              \
+} while (0)
+
+static __inline int
+well_test_done(const char *name)
+{
+	if (well_test_fails != 0) {
+		fprintf(stderr, "%s: %u failures\n", name, well_test_fails);
+		return (1);
+	}
+	printf("%s: ok\n", name);
+	return (0);
+}
+
+/* Monotonic time in ns, for the timings the tests report. */
+static __inline uint64_t
+well_test_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/* A recorded frame, as received. */
+struct well_test_frame {
+	int     len;
+	uint8_t data[WELL_TYPE_2_OFFSET + WELL_FINGER_DATALEN];
+};
+
+/* Build frame "seq" of a synthetic stroke for "params", with "n"
+ * contacts spread over the pad, each moving a few sensor units per
+ * frame, like the frames of the kernel's hw.usb.well.bench.  Returns
+ * the frame length.
+ */
+static __inline int
+well_test_synth(const struct well_dev_params *params, u_int n, u_int seq,
+    struct well_test_frame *f)
+{
+	uint8_t *rec;
+	u_int i;
+
+	memset(f->data, 0, sizeof(f->data));
+	for (i = 0; i < n; i++) {
+		rec = f->data + params->finger_offset + i * WELL_FINGER_SIZE;
+		le16enc(rec + 2 * WELL_FINGER_ABS_X, params->x_calib.min +
+		    (seq * 7 + i * 311) %
+		    (params->x_calib.max - params->x_calib.min));
+		le16enc(rec + 2 * WELL_FINGER_ABS_Y, params->y_calib.min +
+		    (seq * 5 + i * 197) %
+		    (params->y_calib.max - params->y_calib.min));
+		le16enc(rec + 2 * WELL_FINGER_TOUCH_MAJOR, 400 + i);
+		le16enc(rec + 2 * WELL_FINGER_TOUCH_MINOR, 300 + i);
+	}
+	f->len = params->finger_offset + n * WELL_FINGER_SIZE;
+	return (f->len);
+}
+
+/* Load frames recorded as "len hexbytes" lines, the form that
+ * "welluser -w" writes.  Lines starting with '#' are comments.
+ * Returns the number of frames; exits on errors.
+ */
+static __inline u_int
+well_test_load(const char *path, struct well_test_frame **framesp)
+{
+	struct well_test_frame *frames = NULL, *f;
+	char line[2 * sizeof(f->data) + 32], *p;
+	u_int n = 0, cap = 0;
+	int i, line_no = 0;
+	FILE *fp;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		err(1, "%s", path);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		line_no++;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (n == cap) {
+			cap = MAX(2 * cap, 256);
+			if ((frames = realloc(frames,
+			    cap * sizeof(*frames))) == NULL)
+				err(1, "realloc");
+		}
+		f = &frames[n];
+		f->len = strtol(line, &p, 10);
+		if (f->len <= 0 || f->len > (int)sizeof(f->data) ||
+		    *p++ != ' ')
+			errx(1, "%s:%d: bad frame", path, line_no);
+		for (i = 0; i < f->len; i++, p += 2)
+			if (sscanf(p, "%2hhx", &f->data[i]) != 1)
+				errx(1, "%s:%d: bad frame", path, line_no);
+		n++;
+	}
+	fclose(fp);
+	*framesp = frames;
+	return (n);
+}
+
+#endif
@@ -9,11 +9,21 @@
 #include <sys/bus.h>
 #include <sys/conf.h>
 #include <sys/fcntl.h>
+#include <sys/ioccom.h>
 #include <sys/file.h>
 #include <sys/selinfo.h>
 #include <sys/poll.h>
+#include <sys/priority.h>
+#include <sys/queue.h>
 #include <sys/sysctl.h>
 #include <sys/uio.h>
+#include <sys/callout.h>
+#include <sys/endian.h>
+#include <sys/taskqueue.h>
+#include <sys/time.h>
+#include <sys/sdt.h>
+#include <sys/sbuf.h>
+#include <machine/atomic.h>
 
 #include <dev/usb/usb.h>
 #include <dev/usb/usbdi.h>
@@ -27,6 +37,8 @@
 #include <sys/mouse.h>
 
 #include "logging.h"
+#include "well_core.h"
+#include "well_ioctl.h"
 
 DEFINE_LOG_SYSTEM(well, LVL_DEBUG);
 
@@ -37,441 +49,371 @@ DEFINE_LOG_SYSTEM(well, LVL_DEBUG);
 #define WELL_DEBUG(args...) LOG_DEBUG_PREFIX(well, args)
 
 #define WELL_DRIVER_NAME "well"
-#define WELL_FIFO_BUF_SIZE  8 /* bytes */
-#define WELL_FIFO_QUEUE_MAXLEN 50 /* units */
-#define WELL_BUTTON_DATALEN 4
-#define WELL_TYPE_1_OFFSET 26
-#define WELL_TYPE_2_OFFSET 30
-#define WELL_FINGER_SIZE 28
-#define WELL_FINGER_DATALEN (WELL_FINGER_SIZE * 16)
-#define WELL_MODE_LENGTH 8
-
-/* define payload protocols */
-enum {
-	DEV_WELLSPRING,
-	DEV_WELLSPRING2,
-	DEV_WELLSPRING3,
-	DEV_WELLSPRING4,
-	DEV_WELLSPRING4a,
-	DEV_WELLSPRING5,
-	DEV_WELLSPRING5a,
-	DEV_WELLSPRING6,
-	DEV_WELLSPRING6a,
-	DEV_WELLSPRING_N
-};
+#define WELL_READ_BATCH 16 /* events copied out per lock hold */
+#define WELL_RATE_MAX 1000 /* highest paced output rate, Hz */
+#define WELL_FQ_LEN 8 /* raw frames queued for the frame task, power of 2 */
+#define WELL_FRING_LEN 64 /* decoded frames kept for readers, power of 2 */
+#define WELL_FRAMES_BATCH 4 /* frames copied out per lock hold */
+#define WELL_BUTTON_QUEUE_LEN 8
+#define WELL_BQ_LEN 8 /* button events queued for the frame task, power of 2 */
+#define WELL_MERGE_WINDOW 10 /* ms to hold a button event for a frame */
+#define WELL_LAT_BUCKETS 24 /* log2 histogram of click latency, us */
+
+#define WELL_CHAIN_SPEC_LEN 64
+#define WELL_ZONE_CLICKPAD "right:500,800,1000,1000" /* default zones */
+
+/* Per-stage cycle accounting, built with "options WELL_PROFILE".  Each
+ * stage of the trackpad path is bracketed with the cycle counter
+ * reads of well_core.h; without the option the brackets compile to
+ * nothing.
+ */
+#define WELL_PROF_END(sc, stage, t) \
+	WELL_PROF_ADD(&(sc)->sc_prof[(stage)], t)
 
-enum {
-        RES_PRESSURE = 256,
-	RES_WIDTH = 16,
-	RES_X = 1280,
-	RES_Y = 800,
-	NOISE_WIDTH = 1,
-	NOISE_PRESSURE = 6,
-	NOISE_X = 5,
-	NOISE_Y = 3
-};
+static SYSCTL_NODE(_hw_usb, OID_AUTO, well, CTLFLAG_RW, 0, "USB wellspring");
 
-enum {
-        INTEGRATED_BUTTON = 0x1
+#ifdef WELL_PROFILE
+/* Process frames in the USB callback before resubmitting the pipe, as
+ * the driver did before the frame task, so that the hold and resubmit
+ * counters of both paths can be compared on one build.
+ */
+static int well_prof_inline = 0;
+SYSCTL_INT(_hw_usb_well, OID_AUTO, profile_inline, CTLFLAG_RW,
+    &well_prof_inline, 0, "Process frames in the USB callback (profiling)");
+#endif
+
+static MALLOC_DEFINE(M_WELL, "well", "USB wellspring");
+
+/* Static tracepoints on the hot path, for timing problems where a
+ * WELL_DEBUG printf would distort what it measures.  They compile to
+ * nothing in kernels without KDTRACE_HOOKS, and cost a single
+ * untaken branch otherwise until dtrace(1) enables them, e.g.
+ *
+ *   dtrace -n 'well::frame:decoded { @[arg1] = count(); }'
+ *
+ * The list is WELL_TRACE_POINTS in well_core.h; frame:decoded and
+ * contacts:change fire in the core, with its state as arg0.
+ */
+SDT_PROVIDER_DEFINE(well);
+SDT_PROBE_DEFINE2(well, , xfer, done, "struct well_softc *", "int");
+SDT_PROBE_DEFINE3(well, , xfer, error, "struct well_softc *", "int",
+    "u_int");
+SDT_PROBE_DEFINE2(well, , frame, decoded, "struct well_dev_params *",
+    "struct well_frame *");
+SDT_PROBE_DEFINE3(well, , contacts, change, "struct well_track *",
+    "u_int", "u_int");
+SDT_PROBE_DEFINE3(well, , ring, put, "struct well_softc *", "u_int",
+    "struct well_event *");
+SDT_PROBE_DEFINE2(well, , ring, overrun, "struct well_softc *", "u_int");
+SDT_PROBE_DEFINE2(well, , mode, set, "struct well_softc *", "int");
+
+/* Error recovery tunables; see well_recover_setup() for the machine
+ * they drive.  After WELL_ERR_THRESHOLD consecutive errors, the
+ * trackpad pipe is stopped and we wait for a backoff delay (doubling
+ * with each attempt, starting at recover_base and capped at
+ * recover_max milliseconds), then re-send raw sensor mode and
+ * resubmit.  We give up after recover_budget attempts without a good
+ * frame.
+ */
+static struct well_recover_cfg well_recover_cfg = {
+	.budget = 8,
+	.base   = 10,   /* ms */
+	.max    = 2000  /* ms */
 };
 
+SYSCTL_UINT(_hw_usb_well, OID_AUTO, recover_budget, CTLFLAG_RW,
+    &well_recover_cfg.budget, 0, "Recovery attempts before giving up");
+SYSCTL_UINT(_hw_usb_well, OID_AUTO, recover_base, CTLFLAG_RW,
+    &well_recover_cfg.base, 0, "Initial recovery backoff (ms)");
+SYSCTL_UINT(_hw_usb_well, OID_AUTO, recover_max, CTLFLAG_RW,
+    &well_recover_cfg.max, 0, "Maximum recovery backoff (ms)");
+
+static u_int well_kinetic = 1;
+static u_int well_kinetic_decay = 243; /* Q8, about 0.95 per tick */
+
+SYSCTL_UINT(_hw_usb_well, OID_AUTO, kinetic, CTLFLAG_RW,
+    &well_kinetic, 0, "Enable momentum scrolling");
+
+/* The decay must stay below one, or momentum would never stop. */
+static int
+well_sysctl_kinetic_decay(SYSCTL_HANDLER_ARGS)
+{
+	u_int decay;
+	int err;
+
+	decay = well_kinetic_decay;
+	err = sysctl_handle_int(oidp, &decay, 0, req);
+	if (err != 0 || req->newptr == NULL)
+		return (err);
+	if (decay >= WELL_KINETIC_ONE)
+		return (EINVAL);
+	well_kinetic_decay = decay;
+	return (0);
+}
+
+SYSCTL_PROC(_hw_usb_well, OID_AUTO, kinetic_decay,
+    CTLTYPE_UINT | CTLFLAG_RW, NULL, 0, &well_sysctl_kinetic_decay, "IU",
+    "Momentum decay per tick (1/256ths, below 256)");
+
+/* How far ahead pointer motion is extrapolated, for the readers that
+ * did not turn prediction off with WELL_SETPREDICT.
+ */
+static u_int well_predict_horizon = 0; /* ms, 0 disables */
+
+SYSCTL_UINT(_hw_usb_well, OID_AUTO, predict_horizon, CTLFLAG_RW,
+    &well_predict_horizon, 0, "Pointer prediction horizon (ms, 0 is off)");
+
+/* Idle policy.  After suspend_timeout milliseconds without contacts,
+ * the device is left to the USB power save, which suspends it after
+ * hw.usb.power_timeout seconds without traffic.  A pad that can wake
+ * the host keeps its pipes pending, which does not keep such a device
+ * awake; its remote wakeup resumes it, raw mode is sent again, since a
+ * pad that went through a suspend may come back in HID mode, and the
+ * pending transfer takes the touch.  Nothing runs in the driver while
+ * it sleeps, and the first touch costs only the resume.
+ *
+ * Any other pad cannot report a touch while suspended, and a pending
+ * transfer keeps it awake.  Both its pipes are stopped, and every
+ * suspend_poll milliseconds it is woken for a single frame, raw mode
+ * first.  For it to suspend at all, suspend_poll must be longer than
+ * hw.usb.power_timeout, and it sleeps for the difference: a first
+ * touch may wait that long.
+ */
+static u_int well_suspend_timeout = 5000; /* ms, 0 disables */
+static u_int well_suspend_poll = 31000; /* ms, past hw.usb.power_timeout */
+
+SYSCTL_UINT(_hw_usb_well, OID_AUTO, suspend_timeout, CTLFLAG_RW,
+    &well_suspend_timeout, 0, "Idle time before suspending (ms, 0 is off)");
+SYSCTL_UINT(_hw_usb_well, OID_AUTO, suspend_poll, CTLFLAG_RW,
+    &well_suspend_poll, 0,
+    "Polling interval while idle, without remote wakeup (ms)");
+
+#ifdef USB_DEBUG
+/* Fails the next N completed trackpad frames, to exercise recovery. */
+static u_int well_inject_errs = 0;
+
+SYSCTL_UINT(_hw_usb_well, OID_AUTO, inject_errs, CTLFLAG_RW,
+    &well_inject_errs, 0, "Number of trackpad frames to fail");
+#endif
+
 enum {
 	WELL_RESET,
 	WELL_INTR_TRACKPAD,
-	//  	WELL_INTR_BUTTON,
+	WELL_INTR_BUTTON,
 	WELL_N_TRANSFER,
 };
 
 enum {
-        BUTTON_ENDPOINT = 0x84,
-	TRACKPAD_ENDPOINT = 0x81
+        WELL_ENABLED = 0x1,
+        WELL_GONE = 0x2,
+        WELL_SUSPENDED = 0x4, /* idle, see well_suspend_timeout */
+        WELL_MODE_BUSY = 0x8  /* well_sync_mode() switching modes */
+};
+
+/* Stages of the frame chain, in the order they run. */
+enum {
+	WELL_STAGE_FILTER,  /* skip repeated frames undecoded, see frames */
+	WELL_STAGE_DECODE,
+	WELL_STAGE_FRAMES,  /* publish to WELL_READFRAMES readers */
+	WELL_STAGE_BUTTONS, /* release queued button events */
+	WELL_STAGE_GESTURE, /* scrolling, zones, momentum */
+	WELL_STAGE_TRACK,   /* motion, clickpad buttons */
+	WELL_STAGE_N
 };
 
+#define WELL_STAGE_REQUIRED \
+	((1 << WELL_STAGE_DECODE) | (1 << WELL_STAGE_BUTTONS))
+#define WELL_STAGE_ALL ((1 << WELL_STAGE_N) - 1)
+
+#ifdef WELL_PROFILE
 enum {
-        WELL_ENABLED = 0x1
+	WELL_PROF_HOLD,     /* callback: a frame's whole callback */
+	WELL_PROF_RESUBMIT, /* callback: completion to resubmitted */
+	WELL_PROF_COPY,     /* callback: grab the frame */
+	WELL_PROF_SUBMIT,   /* callback: resubmit the pipe */
+	WELL_PROF_FILTER,   /* repeated frame detection */
+	WELL_PROF_DECODE,
+	WELL_PROF_BUTTONS,  /* queued button events; includes put */
+	WELL_PROF_GESTURE,  /* scrolling, zones, momentum */
+	WELL_PROF_TRACK,    /* motion; includes put */
+	WELL_PROF_PUT,      /* stores into the frame and event rings */
+	WELL_PROF_N
+};
+#endif
+
+/* A raw trackpad frame, as grabbed by the USB callback. */
+struct well_raw {
+	struct timeval time;
+	int            len;
+	uint8_t        data[WELL_TYPE_2_OFFSET + WELL_FINGER_DATALEN];
 };
 
-typedef enum interface_mode {
-	RAW_SENSOR_MODE = 0x01,
-	HID_MODE        = 0x08
-} interface_mode;
+struct well_softc;
+
+/* A stage of the frame chain.  Stages share the raw frame and the
+ * decoded one in the softc; returning non-zero ends the chain for
+ * this frame.
+ */
+typedef int well_stage_t(struct well_softc *, const struct well_raw *);
+
+/* A button endpoint event waiting to be merged with the frames. */
+struct well_button_event {
+	struct timeval time;
+	u_int          buttons;
+};
 
+/* The softc is split in two.  The hot section holds everything the
+ * interrupt path reads or writes on every frame, packed into the first
+ * few cache lines; the per-frame contact state follows on its own
+ * lines.  Configuration and slow-path state goes in the cold section,
+ * so that it never shares a line with the interrupt path.
+ *
+ * Two mutexes split it the other way.  sc_mutex is the USB transfer
+ * mutex: the callbacks run under it, and it covers the transfers,
+ * sc_state, recovery and the idle policy.  sc_pipe_mutex covers the
+ * frame pipeline and everything readers see: the chain and its state,
+ * the rings, the readers and the button queue.  The callbacks never
+ * take it; they hand frames and button events over through sc_fq and
+ * sc_bq.  sc_mutex comes first when both are held, and nothing takes
+ * sc_mutex with sc_pipe_mutex held.
+ */
 struct well_softc {
-	device_t               sc_dev;
-	struct usb_device     *sc_usb_device;
-	char                   sc_mode_bytes[WELL_MODE_LENGTH]; /* device mode */
-	struct mtx             sc_mutex; /* for synchronization */
+	/* Hot: interrupt path. */
+	struct mtx             sc_mutex; /* USB transfers, see above */
 	struct usb_xfer       *sc_xfer[WELL_N_TRANSFER];
-	struct usb_fifo_sc     sc_fifo;
-
 	const struct well_dev_params *sc_params;
-
+	struct mtx             sc_pipe_mutex __aligned(CACHE_LINE_SIZE);
+	struct well_ring       sc_ring; /* producer side of sc_events */
+	well_stage_t          *sc_chain[WELL_STAGE_N + 1]; /* NULL ends */
+	u_int                  sc_fring_head; /* sequence of the next frame */
+	u_int                  sc_state;
+	struct well_recover    sc_recover;
+	u_int                  sc_button_head;
+	u_int                  sc_button_count;
+	mousestatus_t          sc_status;
+	struct well_norm       sc_norm[WELL_AXIS_N];
+	int                    sc_geom_sx; /* physical units per sensor unit, Q8 */
+	int                    sc_geom_sy;
+	struct well_zone_map  *sc_zones;
+
+	/* What the gesture stage made of the frame, for the track stage:
+	 * whether its motion scrolls, and the button of a clickpad click
+	 * starting now.
+	 */
+	u_int                  sc_zone_track; /* zone of a lone finger */
+	u_int                  sc_gesture_fingers;
+	int                    sc_gesture_scroll;
+	u_int                  sc_gesture_click;
+
+	/* Tracking state of the primary finger, in output units. */
+	struct well_track      sc_track;
+
+	/* Two-finger scroll and momentum state. */
+	struct well_scroll     sc_scroll;
+
+	struct well_pred       sc_pred;
+
+	/* Per-frame contact state, in fixed-size arrays. */
+	struct well_frame      sc_frame __aligned(CACHE_LINE_SIZE);
+
+	int                    sc_touch_ticks; /* last frame with contacts */
+	u_int                  sc_touch_fingers; /* of the last decode */
+	int                    sc_touch;      /* first contact after none */
+
+	/* What the decoder saw of the last frame, to skip repeats. */
+	struct well_filter     sc_filter;
+
+	/* Events shared by all readers, indexed by sequence number. */
+	struct well_event      sc_events[WELL_RING_LEN]
+	    __aligned(CACHE_LINE_SIZE);
+
+	/* Frames from the USB callback to the frame task.  Single
+	 * producer and single consumer, each index on its own line.
+	 */
+	u_int                  sc_fq_tail __aligned(CACHE_LINE_SIZE);
+	u_int                  sc_fq_drops;
+	u_int                  sc_fq_head __aligned(CACHE_LINE_SIZE);
+	struct well_raw        sc_fq[WELL_FQ_LEN] __aligned(CACHE_LINE_SIZE);
+
+	/* Button endpoint events, handed over the same way. */
+	u_int                  sc_bq_tail __aligned(CACHE_LINE_SIZE);
+	u_int                  sc_bq_head __aligned(CACHE_LINE_SIZE);
+	struct well_button_event sc_bq[WELL_BQ_LEN];
+
+	/* Decoded frames for WELL_READFRAMES, indexed like sc_ring. */
+	struct well_frame_rec  sc_fring[WELL_FRING_LEN]
+	    __aligned(CACHE_LINE_SIZE);
+
+	/* Cold: configuration and slow paths. */
+	device_t               sc_dev __aligned(CACHE_LINE_SIZE);
+	struct usb_device     *sc_usb_device;
+	char                   sc_mode_bytes[WELL_MODE_LENGTH]; /* device mode */
 	mousehw_t              sc_hw;
-	mousemode_t            sc_mode;
+	mousemode_t            sc_mode; /* initial mode of new readers */
 	u_int                  sc_pollrate;
-	mousestatus_t          sc_status;
-	u_int                  sc_state;
-        u_int sc_errs;
-};
 
-struct well_calib {
-        int res;
-        int noise;
-        int min;
-        int max;
-};
+	struct cdev           *sc_cdev;
+	struct selinfo         sc_rsel;
+	u_int                  sc_readers;
+	interface_mode         sc_mode_set; /* last sent, 0 for none */
+	u_int                  sc_overruns; /* events lost, all readers */
+	LIST_HEAD(, well_reader) sc_paced; /* readers with an output rate */
 
-const struct well_dev_params {
-        int flags;
-        char* name;
-        int button_endpoint;
-        int trackpad_endpoint;
-        u_int button_datalen;
-        u_int trackpad_datalen;
-        struct well_calib press_calib;
-        struct well_calib width_calib;
-        struct well_calib x_calib;
-        struct well_calib y_calib;
-} well_dev_params[DEV_WELLSPRING_N] = {
-        [DEV_WELLSPRING] = {
-	        .flags = 0,
-		.name = "Wellspring",
-		.button_datalen = WELL_BUTTON_DATALEN,
-		.trackpad_datalen = WELL_TYPE_1_OFFSET +
-		        WELL_FINGER_DATALEN,
-		.press_calib = {
-  	                .res = RES_PRESSURE,
-			.noise = NOISE_PRESSURE,
-			.min = 0,
-			.max = 256
-	        },
-		.width_calib = {
-  	                .res = RES_WIDTH,
-			.noise = NOISE_WIDTH,
-			.min = 0,
-			.max = 2048
-	        },
-		.x_calib = {
-  	                .res = RES_X,
-			.noise = NOISE_X,
-			.min = -4824,
-			.max = 5324
-	        },
-		.y_calib = {
- 	                .res = RES_Y,
-			.noise = NOISE_X,
-			.min = -172,
-			.max = 5820
-	        }
-	},
-	[DEV_WELLSPRING2] = {
-	        .flags = 0,
-		.name = "Wellspring 2",
-		.button_datalen = WELL_BUTTON_DATALEN,
-		.trackpad_datalen = WELL_TYPE_1_OFFSET +
-		        WELL_FINGER_DATALEN,
-		.press_calib = {
-  	                .res = RES_PRESSURE,
-			.noise = NOISE_PRESSURE,
-			.min = 0,
-			.max = 256
-	        },
-		.width_calib = {
-  	                .res = RES_WIDTH,
-			.noise = NOISE_WIDTH,
-			.min = 0,
-			.max = 2048
-	        },
-		.x_calib = {
-  	                .res = RES_X,
-			.noise = NOISE_X,
-			.min = -4824,
-			.max = 4824
-	        },
-		.y_calib = {
- 	                .res = RES_Y,
-			.noise = NOISE_X,
-			.min = -172,
-			.max = 4290
-	        }
-	},
-	[DEV_WELLSPRING3] = {
- 	        .flags = INTEGRATED_BUTTON,
-		.name = "Wellspring 3",
-		.button_datalen = WELL_BUTTON_DATALEN,
-		.trackpad_datalen = WELL_TYPE_2_OFFSET +
-		        WELL_FINGER_DATALEN,
-		.press_calib = {
-  	                .res = RES_PRESSURE,
-			.noise = NOISE_PRESSURE,
-			.min = 0,
-			.max = 300
-	        },
-		.width_calib = {
-  	                .res = RES_WIDTH,
-			.noise = NOISE_WIDTH,
-			.min = 0,
-			.max = 2048
-	        },
-		.x_calib = {
-  	                .res = RES_X,
-			.noise = NOISE_X,
-			.min = -4460,
-			.max = 5166
-	        },
-		.y_calib = {
- 	                .res = RES_Y,
-			.noise = NOISE_X,
-			.min = -75,
-			.max = 6700
-	        }
-	},
-	[DEV_WELLSPRING4] = {
- 	        .flags = INTEGRATED_BUTTON,
-		.name = "Wellspring 4",
-		.button_datalen = WELL_BUTTON_DATALEN,
-		.trackpad_datalen = WELL_TYPE_2_OFFSET +
-		        WELL_FINGER_DATALEN,
-		.press_calib = {
-  	                .res = RES_PRESSURE,
-			.noise = NOISE_PRESSURE,
-			.min = 0,
-			.max = 300
-	        },
-		.width_calib = {
-  	                .res = RES_WIDTH,
-			.noise = NOISE_WIDTH,
-			.min = 0,
-			.max = 2048
-	        },
-		.x_calib = {
-  	                .res = RES_X,
-			.noise = NOISE_X,
-			.min = -4620,
-			.max = 5140
-	        },
-		.y_calib = {
- 	                .res = RES_Y,
-			.noise = NOISE_X,
-			.min = -150,
-			.max = 6600
-	        }
-	},
-	[DEV_WELLSPRING4a] = {
- 	        .flags = INTEGRATED_BUTTON,
-		.name = "Wellspring 4a",
-		.button_datalen = WELL_BUTTON_DATALEN,
-		.trackpad_datalen = WELL_TYPE_2_OFFSET +
-		        WELL_FINGER_DATALEN,
-		.press_calib = {
-  	                .res = RES_PRESSURE,
-			.noise = NOISE_PRESSURE,
-			.min = 0,
-			.max = 300
-	        },
-		.width_calib = {
-  	                .res = RES_WIDTH,
-			.noise = NOISE_WIDTH,
-			.min = 0,
-			.max = 2048
-	        },
-		.x_calib = {
-  	                .res = RES_X,
-			.noise = NOISE_X,
-			.min = -4616,
-			.max = 5112
-	        },
-		.y_calib = {
- 	                .res = RES_Y,
-			.noise = NOISE_X,
-			.min = -142,
-			.max = 5234
-	        }
-	},
-	[DEV_WELLSPRING5] = {
- 	        .flags = INTEGRATED_BUTTON,
-		.name = "Wellspring 5",
-		.button_datalen = WELL_BUTTON_DATALEN,
-		.trackpad_datalen = WELL_TYPE_2_OFFSET +
-		        WELL_FINGER_DATALEN,
-		.press_calib = {
-  	                .res = RES_PRESSURE,
-			.noise = NOISE_PRESSURE,
-			.min = 0,
-			.max = 300
-	        },
-		.width_calib = {
-  	                .res = RES_WIDTH,
-			.noise = NOISE_WIDTH,
-			.min = 0,
-			.max = 2048
-	        },
-		.x_calib = {
-  	                .res = RES_X,
-			.noise = NOISE_X,
-			.min = -4415,
-			.max = 5050
-	        },
-		.y_calib = {
- 	                .res = RES_Y,
-			.noise = NOISE_X,
-			.min = -55,
-			.max = 6680
-	        }
-	},
-	[DEV_WELLSPRING5a] = {
- 	        .flags = INTEGRATED_BUTTON,
-		.name = "Wellspring 5a",
-		.button_datalen = WELL_BUTTON_DATALEN,
-		.trackpad_datalen = WELL_TYPE_2_OFFSET +
-		        WELL_FINGER_DATALEN,
-		.press_calib = {
-  	                .res = RES_PRESSURE,
-			.noise = NOISE_PRESSURE,
-			.min = 0,
-			.max = 300
-	        },
-		.width_calib = {
-  	                .res = RES_WIDTH,
-			.noise = NOISE_WIDTH,
-			.min = 0,
-			.max = 2048
-	        },
-		.x_calib = {
-  	                .res = RES_X,
-			.noise = NOISE_X,
-			.min = -4750,
-			.max = 5280
-	        },
-		.y_calib = {
- 	                .res = RES_Y,
-			.noise = NOISE_X,
-			.min = -150,
-			.max = 6730
-	        }
-	},
-	[DEV_WELLSPRING6] = {
- 	        .flags = INTEGRATED_BUTTON,
-		.name = "Wellspring 6",
-		.button_datalen = WELL_BUTTON_DATALEN,
-		.trackpad_datalen = WELL_TYPE_2_OFFSET +
-		        WELL_FINGER_DATALEN,
-		.press_calib = {
-  	                .res = RES_PRESSURE,
-			.noise = NOISE_PRESSURE,
-			.min = 0,
-			.max = 300
-	        },
-		.width_calib = {
-  	                .res = RES_WIDTH,
-			.noise = NOISE_WIDTH,
-			.min = 0,
-			.max = 2048
-	        },
-		.x_calib = {
-  	                .res = RES_X,
-			.noise = NOISE_X,
-			.min = -4620,
-			.max = 5140
-	        },
-		.y_calib = {
- 	                .res = RES_Y,
-			.noise = NOISE_X,
-			.min = -150,
-			.max = 6600
-	        }
-	},
-	[DEV_WELLSPRING6a] = {
- 	        .flags = INTEGRATED_BUTTON,
-		.name = "Wellspring 6a",
-		.button_datalen = WELL_BUTTON_DATALEN,
-		.trackpad_datalen = WELL_TYPE_2_OFFSET +
-		        WELL_FINGER_DATALEN,
-		.press_calib = {
-  	                .res = RES_PRESSURE,
-			.noise = NOISE_PRESSURE,
-			.min = 0,
-			.max = 300
-	        },
-		.width_calib = {
-  	                .res = RES_WIDTH,
-			.noise = NOISE_WIDTH,
-			.min = 0,
-			.max = 2048
-	        },
-		.x_calib = {
-  	                .res = RES_X,
-			.noise = NOISE_X,
-			.min = -4620,
-			.max = 5140
-	        },
-		.y_calib = {
- 	                .res = RES_Y,
-			.noise = NOISE_X,
-			.min = -150,
-			.max = 6600
-	        }
-	}
+	struct callout         sc_recover_callout;
+
+	struct callout         sc_kinetic_callout;
+
+	struct callout         sc_suspend_callout;
+	int                    sc_remote_wakeup; /* pad can wake the host */
+	u_int                  sc_suspends; /* idle periods since attach */
+	u_int                  sc_suspend_polls; /* wakeups while idle */
+	struct timeval         sc_suspend_poll_time; /* of the last one */
+	u_int                  sc_resume_us; /* wakeup to touch frame, worst */
+
+	/* Button events pending a merge with the next trackpad frame. */
+	struct callout         sc_merge_callout;
+	struct well_button_event sc_button_queue[WELL_BUTTON_QUEUE_LEN];
+
+	u_int                  sc_size_um[2]; /* pad size, 0 if unknown */
+	u_int                  sc_click_lat[WELL_LAT_BUCKETS];
+	char                   sc_zone_spec[WELL_ZONE_SPEC_LEN];
+	u_int                  sc_chain_mask; /* 1 << WELL_STAGE_* */
+
+	struct taskqueue      *sc_tq;
+	struct task            sc_frame_task;
+
+	/* Attach work deferred out of the probe/attach path. */
+	struct task            sc_attach_task;
+	u_int                  sc_attach_usec;   /* synchronous part */
+	u_int                  sc_deferred_usec; /* deferred part */
+	struct timeval         sc_attach_start;
+
+#ifdef WELL_PROFILE
+	struct well_prof       sc_prof[WELL_PROF_N];
+#endif
 };
 
-static const STRUCT_USB_HOST_ID well_devs[] = {
-	/* MacBook Air 1.1 */
-	{ USB_VPI(USB_VENDOR_APPLE, 0x0223, DEV_WELLSPRING) },
-	{ USB_VPI(USB_VENDOR_APPLE, 0x0224, DEV_WELLSPRING) },
-	{ USB_VPI(USB_VENDOR_APPLE, 0x0225, DEV_WELLSPRING) },
-
-	/* MacBook Pro Penryn */
-	{ USB_VPI(USB_VENDOR_APPLE, 0x0230, DEV_WELLSPRING2) },
-	{ USB_VPI(USB_VENDOR_APPLE, 0x0231, DEV_WELLSPRING2) },
-	{ USB_VPI(USB_VENDOR_APPLE, 0x0232, DEV_WELLSPRING2) },
-
-	/* MacBook 5,1 */
-	{ USB_VPI(USB_VENDOR_APPLE, 0x0236, DEV_WELLSPRING3) },
-	{ USB_VPI(USB_VENDOR_APPLE, 0x0237, DEV_WELLSPRING3) },
-	{ USB_VPI(USB_VENDOR_APPLE, 0x0238, DEV_WELLSPRING3) },
-
-	/* MacBook Air 3.2 */
-	{ USB_VPI(USB_VENDOR_APPLE, 0x023f, DEV_WELLSPRING4) },
-	{ USB_VPI(USB_VENDOR_APPLE, 0x0240, DEV_WELLSPRING4) },
-	{ USB_VPI(USB_VENDOR_APPLE, 0x0241, DEV_WELLSPRING4) },
-
-	/* MacBook Air 3.1 */
-	{ USB_VPI(USB_VENDOR_APPLE, 0x0242, DEV_WELLSPRING4a) },
-	{ USB_VPI(USB_VENDOR_APPLE, 0x0243, DEV_WELLSPRING4a) },
-	{ USB_VPI(USB_VENDOR_APPLE, 0x0244, DEV_WELLSPRING4a) },
-
-	/* MacBook Pro 8,2 */
-	{ USB_VPI(USB_VENDOR_APPLE, 0x0252, DEV_WELLSPRING5a) },
-	{ USB_VPI(USB_VENDOR_APPLE, 0x0253, DEV_WELLSPRING5a) },
-	{ USB_VPI(USB_VENDOR_APPLE, 0x0254, DEV_WELLSPRING5a) },
-
-	/* MacBook Pro 8,1 */
-	{ USB_VPI(USB_VENDOR_APPLE, 0x0245, DEV_WELLSPRING5) },
-	{ USB_VPI(USB_VENDOR_APPLE, 0x0246, DEV_WELLSPRING5) },
-	{ USB_VPI(USB_VENDOR_APPLE, 0x0247, DEV_WELLSPRING5) },
-
-	/* MacBook Air 4.2 */
-	{ USB_VPI(USB_VENDOR_APPLE, 0x024c, DEV_WELLSPRING6a) },
-	{ USB_VPI(USB_VENDOR_APPLE, 0x024d, DEV_WELLSPRING6a) },
-	{ USB_VPI(USB_VENDOR_APPLE, 0x024e, DEV_WELLSPRING6a) },
-
-	/* MacBook Air 4.1 */
-	{ USB_VPI(USB_VENDOR_APPLE, 0x0249, DEV_WELLSPRING6) },
-	{ USB_VPI(USB_VENDOR_APPLE, 0x024a, DEV_WELLSPRING6) },
-	{ USB_VPI(USB_VENDOR_APPLE, 0x024b, DEV_WELLSPRING6) },
+#define WELL_HOST_ID(product, model) \
+	{ USB_VPI(USB_VENDOR_APPLE, (product), (model)) },
 
+static const STRUCT_USB_HOST_ID well_devs[] = {
+	WELL_PRODUCTS(WELL_HOST_ID)
 };
 
 /* Device methods. */
 static device_probe_t well_probe;
 static device_attach_t well_attach;
 static device_detach_t well_detach;
+static device_resume_t well_device_resume;
 static usb_callback_t well_trackpad_intr;
 static usb_callback_t well_button_intr;
 static usb_callback_t well_reset_callback;
+static void well_recover_expire(void *arg);
+static void well_merge_timeout(void *arg);
+static void well_kinetic_tick(void *arg);
+static void well_resume(struct well_softc *sc);
 
 static const struct usb_config well_config[WELL_N_TRANSFER] = {
-  /*
 	[WELL_INTR_BUTTON] = {
 		.type      = UE_INTERRUPT,
 		.endpoint  = BUTTON_ENDPOINT,
@@ -479,11 +421,12 @@ static const struct usb_config well_config[WELL_N_TRANSFER] = {
 		.flags = {
 			.pipe_bof = 1,
 			.short_xfer_ok = 1,
+			/* unused on integrated button models */
+			.no_pipe_ok = 1,
 		},
 		.bufsize   = 0,
 		.callback  = &well_button_intr,
 	},
-  */
 	[WELL_INTR_TRACKPAD] = {
 		.type      = UE_INTERRUPT,
 		.endpoint  = TRACKPAD_ENDPOINT,
@@ -506,19 +449,45 @@ static const struct usb_config well_config[WELL_N_TRANSFER] = {
 	},
 };
 
-static usb_fifo_cmd_t   well_start_read;
-static usb_fifo_cmd_t   well_stop_read;
-static usb_fifo_open_t  well_open;
-static usb_fifo_close_t well_close;
-static usb_fifo_ioctl_t well_ioctl;
-
-static struct usb_fifo_methods well_fifo_methods = {
-	.f_open       = &well_open,
-	.f_close      = &well_close,
-	.f_ioctl      = &well_ioctl,
-	.f_start_read = &well_start_read,
-	.f_stop_read  = &well_stop_read,
-	.basename[0]  = WELL_DRIVER_NAME,
+static d_open_t  well_open;
+static d_read_t  well_read;
+static d_poll_t  well_poll;
+static d_ioctl_t well_ioctl;
+
+static struct cdevsw well_cdevsw = {
+	.d_version = D_VERSION,
+	.d_open    = &well_open,
+	.d_read    = &well_read,
+	.d_poll    = &well_poll,
+	.d_ioctl   = &well_ioctl,
+	.d_name    = WELL_DRIVER_NAME,
+};
+
+/* Per-open reader state.  Each open file has its own cursor into the
+ * shared event ring and its own output format, so any number of
+ * readers can consume the same events at their own pace.
+ */
+struct well_reader {
+	struct well_softc *rd_sc;
+	int                rd_fflags;
+	u_int              rd_cursor;   /* sequence of the next event */
+	u_int              rd_overruns; /* events lost to wraparound */
+	int                rd_predict;  /* apply pointer prediction */
+	u_int              rd_fcursor;  /* sequence of the next frame */
+	u_int              rd_flost;    /* frames lost since last read */
+	mousemode_t        rd_mode;
+
+	/* Output pacing (WELL_SETRATE).  The callout publishes the ring
+	 * up to rd_limit once per period, and read() coalesces what it
+	 * finds there.
+	 */
+	int                rd_rate;     /* Hz, 0 for every event */
+	int                rd_period;   /* ticks */
+	int                rd_epoch;    /* ticks, start of the schedule */
+	u_int              rd_limit;    /* sequence published to read() */
+	struct callout     rd_callout;
+	struct selinfo     rd_rsel;
+	LIST_ENTRY(well_reader) rd_link; /* on sc_paced */
 };
 
 static int
@@ -534,9 +503,57 @@ well_disable(struct well_softc *sc)
         sc->sc_state &= ~WELL_ENABLED;
 }
 
+/* Forget any recovery in progress.  Called with the USB mutex held. */
+static void
+well_recover_cancel(struct well_softc *sc)
+{
+	callout_stop(&sc->sc_recover_callout);
+	well_recover_clear(&sc->sc_recover);
+}
+
+/* Carry out a recovery action that leaves the trackpad pipe idle:
+ * arm the backoff callout for "delay" ms, or give up.  Returns non-zero
+ * for WELL_RECOVER_GO, when the caller resubmits the pipe instead.
+ * Called with the USB mutex held.
+ */
+static int
+well_recover_act(struct well_softc *sc, int action, u_int delay)
+{
+	mtx_assert(&sc->sc_mutex, MA_OWNED);
+
+	switch (action) {
+	case WELL_RECOVER_WAIT:
+		WELL_WARN("too many errors, retrying in %u ms "
+			  "(attempt %u of %u)\n", delay,
+			  sc->sc_recover.tries + 1, well_recover_cfg.budget);
+		callout_reset(&sc->sc_recover_callout,
+		    MAX(1, (delay * hz) / 1000), &well_recover_expire, sc);
+		break;
+	case WELL_RECOVER_GIVEUP:
+		WELL_ERROR("giving up after %u recovery attempts\n",
+			   sc->sc_recover.tries);
+		break;
+	}
+	return (action == WELL_RECOVER_GO);
+}
+
+/* Backoff expired: re-send raw sensor mode.  The reset callback
+ * restarts the trackpad pipe once the mode is set.
+ */
+static void
+well_recover_expire(void *arg)
+{
+	struct well_softc *sc = arg;
+
+	mtx_assert(&sc->sc_mutex, MA_OWNED);
+
+	if (well_recover_timeout(&sc->sc_recover))
+		usbd_transfer_start(sc->sc_xfer[WELL_RESET]);
+}
+
 
 usb_error_t
-well_req_get_report(struct usb_device *udev, void *data)
+well_req_get_report(struct usb_device *udev, struct mtx *mtx, void *data)
 {
 	struct usb_device_request req;
 
@@ -546,7 +563,7 @@ well_req_get_report(struct usb_device *udev, void *data)
 	USETW(req.wIndex, 0);
 	USETW(req.wLength, WELL_MODE_LENGTH);
 
-	return (usbd_do_request(udev, NULL /* mutex */, &req, data));
+	return (usbd_do_request(udev, mtx, &req, data));
 }
 
 static int
@@ -564,7 +581,9 @@ well_set_device_mode(struct well_softc *sc, interface_mode mode)
 	USETW(req.wValue, 0x300);
 	USETW(req.wIndex, 0);
 	USETW(req.wLength, WELL_MODE_LENGTH);
-	err = usbd_do_request(sc->sc_usb_device, NULL, &req, sc->sc_mode_bytes);
+	WELL_TRACE(mode, set, sc, mode, 0);
+	err = usbd_do_request(sc->sc_usb_device, &sc->sc_mutex, &req,
+	    sc->sc_mode_bytes);
 	if (err != USB_ERR_NORMAL_COMPLETION)
 		return (ENXIO);
 
@@ -572,7 +591,8 @@ well_set_device_mode(struct well_softc *sc, interface_mode mode)
 }
 
 /* Taken from the atp driver: set the mode to RAW_SENSOR to get
- * complete info.
+ * complete info.  Called with the USB mutex held; it is dropped while the
+ * requests are in flight.
  */
 static int
 well_set_mode(struct well_softc *sc, interface_mode mode)
@@ -582,7 +602,8 @@ well_set_mode(struct well_softc *sc, interface_mode mode)
 	memset(sc->sc_mode_bytes, 0, WELL_MODE_LENGTH);
 
 	WELL_DEBUG("reading sensor mode\n");
-	err = well_req_get_report(sc->sc_usb_device, sc->sc_mode_bytes);
+	err = well_req_get_report(sc->sc_usb_device, &sc->sc_mutex,
+	    sc->sc_mode_bytes);
 	if (err != USB_ERR_NORMAL_COMPLETION) {
 		WELL_ERROR("failed to read device mode (%d)\n", err);
 		return (ENXIO);
@@ -599,51 +620,59 @@ well_set_mode(struct well_softc *sc, interface_mode mode)
 	return 0;
 }
 
-static int
-well_open(struct usb_fifo *fifo, int fflags)
-{
-        WELL_DEBUG("open message\n");
-	int out = 0;
-
-        if(fflags & FREAD) {
-		struct well_softc *sc = usb_fifo_softc(fifo);
-		int err;
-
-		if(sc->sc_state & WELL_ENABLED)
-		        return EBUSY;
-
-		if ((err = usb_fifo_alloc_buffer(fifo,
-		        WELL_FIFO_BUF_SIZE, WELL_FIFO_QUEUE_MAXLEN))) {
-		        WELL_ERROR("failed to allocate fifo buffer (%d)\n", err);
-			return (ENOMEM);
-		}
-
-		out = well_enable(sc);
-        }
-        return 0;
-}
-
+/* Bring the pad's mode in line with sc_readers: raw with readers, HID
+ * without, then start the pipes if there are readers.  well_set_mode()
+ * drops the mutex, and an open or close may change the count meanwhile;
+ * it then finds a switch in flight and leaves the mode to it, which
+ * checks the count again when done and switches back if needed.
+ * Called with the USB mutex held.
+ */
 static void
-well_close(struct usb_fifo *fifo, int fflags)
+well_sync_mode(struct well_softc *sc)
 {
-        WELL_DEBUG("close message\n");
-	if (fflags & FREAD) {
-		struct well_softc *sc = usb_fifo_softc(fifo);
+	interface_mode mode;
+
+	mtx_assert(&sc->sc_mutex, MA_OWNED);
+
+	if (sc->sc_state & WELL_MODE_BUSY)
+		return;
+	sc->sc_state |= WELL_MODE_BUSY;
+	for (;;) {
+		if (sc->sc_state & WELL_GONE)
+			goto out;
+		mode = sc->sc_readers != 0 ? RAW_SENSOR_MODE : HID_MODE;
+		if (mode == sc->sc_mode_set)
+			break;
+		/* A failure is logged; the count decides, not the pad. */
+		well_set_mode(sc, mode);
+		sc->sc_mode_set = mode;
+	}
 
-		well_disable(sc);
-		usb_fifo_free_buffer(fifo);
+	if (sc->sc_readers != 0) {
+		usbd_transfer_start(sc->sc_xfer[WELL_INTR_TRACKPAD]);
+		/* Integrated button models report the button in the frame
+		 * header.
+		 */
+		if (!(sc->sc_params->flags & INTEGRATED_BUTTON))
+			usbd_transfer_start(sc->sc_xfer[WELL_INTR_BUTTON]);
+		WELL_DEBUG("starting transfer\n");
 	}
+out:
+	sc->sc_state &= ~WELL_MODE_BUSY;
 }
 
+/* Start streaming for the first reader.  Called with the USB mutex
+ * held.
+ */
 static void
-well_start_read(struct usb_fifo *fifo)
+well_start_read(struct well_softc *sc)
 {
-  WELL_DEBUG("start read message\n");
-	struct well_softc *sc = usb_fifo_softc(fifo);
 	int rate;
 
+	WELL_DEBUG("start read message\n");
+
 	/* Check if we should override the default polling interval */
-	rate = sc->sc_pollrate;
+	rate = atomic_readandclear_int(&sc->sc_pollrate);
 	/* Range check rate */
 	if (rate > 1000)
 		rate = 1000;
@@ -654,186 +683,2235 @@ well_start_read(struct usb_fifo *fifo)
 		/* Set new interval */
 		usbd_xfer_set_interval(sc->sc_xfer[WELL_INTR_TRACKPAD], 1000 / rate);
 		/* Only set pollrate once */
-		sc->sc_pollrate = 0;
 		WELL_DEBUG("set tranfer rate to %d\n", rate);
 	}
 
-	well_set_mode(sc, RAW_SENSOR_MODE);
-	usbd_transfer_start(sc->sc_xfer[WELL_INTR_TRACKPAD]);
-	WELL_DEBUG("starting transfer\n");
+	well_recover_cancel(sc);
+	mtx_lock(&sc->sc_pipe_mutex);
+	sc->sc_track.fingers = 0;
+	sc->sc_touch_fingers = 0;
+	sc->sc_filter.len = 0;
+	mtx_unlock(&sc->sc_pipe_mutex);
+	sc->sc_touch_ticks = ticks;
+	well_resume(sc);
+	well_enable(sc);
+	well_sync_mode(sc);
 }
 
+/* Stop streaming after the last reader.  Called with the USB mutex
+ * held.
+ */
 static void
-well_stop_read(struct usb_fifo *fifo)
+well_stop_read(struct well_softc *sc)
 {
-  WELL_DEBUG("stop read message\n");
-	struct well_softc *sc = usb_fifo_softc(fifo);
-
-	well_set_mode(sc, HID_MODE);
+	WELL_DEBUG("stop read message\n");
+
+	well_disable(sc);
+	well_recover_cancel(sc);
+	mtx_lock(&sc->sc_pipe_mutex);
+	callout_stop(&sc->sc_merge_callout);
+	callout_stop(&sc->sc_kinetic_callout);
+	sc->sc_scroll.kv = 0;
+	sc->sc_button_count = 0;
+	sc->sc_bq_head = sc->sc_bq_tail;
+	mtx_unlock(&sc->sc_pipe_mutex);
+	well_resume(sc);
+	usbd_transfer_stop(sc->sc_xfer[WELL_INTR_BUTTON]);
+	usbd_transfer_stop(sc->sc_xfer[WELL_RESET]);
 	usbd_transfer_stop(sc->sc_xfer[WELL_INTR_TRACKPAD]);
+	well_sync_mode(sc);
 }
 
-int
-well_ioctl(struct usb_fifo *fifo, u_long cmd, void *addr, int fflags)
+/* Set the output format of a reader: level 0 is MSC, level 1 is
+ * sysmouse.
+ */
+static void
+well_reader_set_level(struct well_reader *rd, int level)
 {
-        return 0;
+	rd->rd_mode.level = level;
+	if (level == 0) {
+		rd->rd_mode.protocol    = MOUSE_PROTO_MSC;
+		rd->rd_mode.packetsize  = MOUSE_MSC_PACKETSIZE;
+		rd->rd_mode.syncmask[0] = MOUSE_MSC_SYNCMASK;
+		rd->rd_mode.syncmask[1] = MOUSE_MSC_SYNC;
+	} else {
+		rd->rd_mode.protocol    = MOUSE_PROTO_SYSMOUSE;
+		rd->rd_mode.packetsize  = MOUSE_SYS_PACKETSIZE;
+		rd->rd_mode.syncmask[0] = MOUSE_SYS_SYNCMASK;
+		rd->rd_mode.syncmask[1] = MOUSE_SYS_SYNC;
+	}
 }
 
 static void
-well_button_intr(struct usb_xfer *xfer, usb_error_t error)
+well_reader_dtor(void *data)
 {
-        int len;
-	char data[WELL_BUTTON_DATALEN];
-	struct well_softc *sc = usbd_xfer_softc(xfer);
-	struct usb_page_cache *pc;
+	struct well_reader *rd = data;
+	struct well_softc *sc = rd->rd_sc;
 
-	usbd_xfer_status(xfer, &len, NULL, NULL, NULL);
+        WELL_DEBUG("close message\n");
+	if (rd->rd_fflags & FREAD) {
+		mtx_lock(&sc->sc_mutex);
+		mtx_lock(&sc->sc_pipe_mutex);
+		if (rd->rd_rate != 0)
+			LIST_REMOVE(rd, rd_link);
+		callout_stop(&rd->rd_callout);
+		mtx_unlock(&sc->sc_pipe_mutex);
+		if (--sc->sc_readers == 0)
+			well_stop_read(sc);
+		mtx_unlock(&sc->sc_mutex);
+	}
+	callout_drain(&rd->rd_callout);
+	seldrain(&rd->rd_rsel);
+	free(rd, M_WELL);
+}
 
-	switch (USB_GET_STATE(xfer)) {
-	case USB_ST_TRANSFERRED:
-                WELL_DEBUG("transferred interrupt\n");
+static int
+well_open(struct cdev *dev, int fflags, int devtype, struct thread *td)
+{
+	struct well_softc *sc = dev->si_drv1;
+	struct well_reader *rd;
+	int err;
 
-		if (len > sc->sc_params->button_datalen) {
-		        WELL_WARN(
-			    "truncating large packet from %u to %u bytes\n",
-			    len, sc->sc_params->button_datalen);
-			len = sc->sc_params->button_datalen;
-		}
+        WELL_DEBUG("open message\n");
+	rd = malloc(sizeof(*rd), M_WELL, M_WAITOK | M_ZERO);
+	rd->rd_sc = sc;
+	rd->rd_fflags = fflags;
+	rd->rd_predict = 1;
+	rd->rd_mode = sc->sc_mode;
+	callout_init_mtx(&rd->rd_callout, &sc->sc_pipe_mutex, 0);
+
+	if ((err = devfs_set_cdevpriv(rd, &well_reader_dtor)) != 0) {
+		free(rd, M_WELL);
+		return (err);
+	}
 
-		if (len < sc->sc_params->button_datalen) {
-		        WELL_WARN("received short packet, ignoring\n");
-			goto tr_setup;
-		}
+	if (fflags & FREAD) {
+		mtx_lock(&sc->sc_mutex);
+		mtx_lock(&sc->sc_pipe_mutex);
+		rd->rd_cursor = sc->sc_ring.head;
+		rd->rd_fcursor = sc->sc_fring_head;
+		mtx_unlock(&sc->sc_pipe_mutex);
+		if (sc->sc_readers++ == 0)
+			well_start_read(sc);
+		mtx_unlock(&sc->sc_mutex);
+	}
+        return (0);
+}
 
-		pc = usbd_xfer_get_frame(xfer, 0);
-		usbd_copy_out(pc, 0, data,
-		    sc->sc_params->button_datalen);
-		WELL_DEBUG("got data { %x, %x, %x, %x }\n",
-			   data[0], data[1], data[2], data[3]);
-		// FALLTHROUGH
-	case USB_ST_SETUP:
-                WELL_DEBUG("setting up transfer\n");
-	tr_setup:
-		/* check if we can put more data into the FIFO */
-		if (usb_fifo_put_bytes_max(
-			    sc->sc_fifo.fp[USB_FIFO_RX]) != 0) {
-			usbd_xfer_set_frame_len(xfer, 0,
-			    sc->sc_params->button_datalen);
-			usbd_transfer_submit(xfer);
-		}
-		break;
+/* Paced reader callout: publish what arrived during the period and
+ * wake the reader once for all of it.
+ */
+static void
+well_reader_tick(void *arg)
+{
+	struct well_reader *rd = arg;
+	struct well_softc *sc = rd->rd_sc;
 
-	default:                        /* Error */
-	  WELL_DEBUG("error interrupt (%d)\n", error);
-		if (error != USB_ERR_CANCELLED) {
-			/* try clear stall first */
-			usbd_xfer_set_stall(xfer);
-			goto tr_setup;
-		}
-		break;
-	}
+	if (rd->rd_limit == sc->sc_ring.head)
+		return;
 
+	rd->rd_limit = sc->sc_ring.head;
+	wakeup(&rd->rd_limit);
+	selwakeuppri(&rd->rd_rsel, PZERO);
 }
 
+/* Set the output rate of a reader, 0 to deliver every event as it
+ * comes.  The schedule starts now.  Called with the pipeline mutex
+ * held.
+ */
 static void
-well_trackpad_intr(struct usb_xfer *xfer, usb_error_t error)
+well_reader_set_rate(struct well_reader *rd, int rate)
 {
-	struct well_softc *sc = usbd_xfer_softc(xfer);
-	struct usb_page_cache *pc;
-	int len;
-	char data[WELL_TYPE_2_OFFSET + WELL_FINGER_DATALEN];
-
-	usbd_xfer_status(xfer, &len, NULL, NULL, NULL);
+	struct well_softc *sc = rd->rd_sc;
+
+	if (rd->rd_rate == 0 && rate != 0) {
+		LIST_INSERT_HEAD(&sc->sc_paced, rd, rd_link);
+		rd->rd_limit = rd->rd_cursor;
+	} else if (rd->rd_rate != 0 && rate == 0) {
+		LIST_REMOVE(rd, rd_link);
+		callout_stop(&rd->rd_callout);
+		/* Sleepers must move to the shared channel. */
+		wakeup(&rd->rd_limit);
+		selwakeuppri(&rd->rd_rsel, PZERO);
+	}
 
-	switch (USB_GET_STATE(xfer)) {
-	case USB_ST_TRANSFERRED:
-	        WELL_DEBUG("transfer complete\n");
+	rd->rd_rate = rate;
+	if (rate != 0) {
+		rd->rd_period = imax(hz / rate, 1);
+		rd->rd_epoch = ticks;
+	}
+}
 
-		if (len > sc->sc_params->trackpad_datalen) {
-		        WELL_WARN(
-			    "truncating large packet from %u to %u bytes\n",
-			    len, sc->sc_params->trackpad_datalen);
-			len = sc->sc_params->trackpad_datalen;
-		}
+/* Account for events the reader lost because the producer lapped it.
+ * Called with the pipeline mutex held.
+ */
+static void
+well_reader_catchup(struct well_reader *rd)
+{
+	struct well_softc *sc = rd->rd_sc;
+	u_int lost;
+
+	if (sc->sc_ring.head - rd->rd_cursor <= WELL_RING_LEN)
+		return;
+
+	lost = sc->sc_ring.head - rd->rd_cursor - WELL_RING_LEN;
+	rd->rd_overruns += lost;
+	sc->sc_overruns += lost;
+	rd->rd_cursor = sc->sc_ring.head - WELL_RING_LEN;
+	/* A lapped paced reader is late already; let it have it all. */
+	if (rd->rd_rate != 0)
+		rd->rd_limit = sc->sc_ring.head;
+	WELL_TRACE(ring, overrun, sc, lost, 0);
+	WELL_DEBUG("reader overrun, lost %u events\n", lost);
+}
 
-		if (len < sc->sc_params->trackpad_datalen) {
-		  sc->sc_errs++;
-		        WELL_WARN("received short packet, ignoring\n");
-			goto tr_setup;
-		}
+/* Sequence up to which the reader may consume events.  Called with
+ * the pipeline mutex held.
+ */
+static u_int
+well_reader_limit(const struct well_reader *rd)
+{
+	return (rd->rd_rate != 0 ? rd->rd_limit : rd->rd_sc->sc_ring.head);
+}
 
-		sc->sc_errs = 0;
-		pc = usbd_xfer_get_frame(xfer, 0);
-		usbd_copy_out(pc, 0, data,
-		    sc->sc_params->trackpad_datalen);
-		for(unsigned int i = 0; i < WELL_TYPE_2_OFFSET + WELL_FINGER_DATALEN; i++)
-		  WELL_DEBUG("data[%d] = %x\n", i, data[i]);
+/* Fold "ev" into the coalesced event "acc" of a paced reader.  Refuses
+ * button changes, so that no click is merged away, and sums that no
+ * longer fit in a packet, so that no motion is clamped away.
+ */
+static int
+well_event_merge(const struct well_reader *rd, struct well_event *acc,
+    const struct well_event *ev)
+{
+	int dx, dy, dz;
 
-	  // FALLTHROUGH
-	case USB_ST_SETUP:
-	tr_setup:
-                WELL_DEBUG("setting up transfer\n");
-		if (sc->sc_errs < 5) {
-		/* check if we can put more data into the FIFO */
-		if (usb_fifo_put_bytes_max(
-			    sc->sc_fifo.fp[USB_FIFO_RX]) != 0) {
-			usbd_xfer_set_frame_len(xfer, 0,
-			    sc->sc_params->trackpad_datalen);
-			usbd_transfer_submit(xfer);
-		}} else {
-		  WELL_ERROR("Too many errors, stopping\n");
-		}
-		break;
+	if (ev->buttons != acc->buttons)
+		return (0);
 
-	default:                        /* Error */
-	  WELL_DEBUG("error interrupt (%s)\n", usbd_errstr(error));
-	  sc->sc_errs++;
-		if (error != USB_ERR_CANCELLED) {
-			/* try clear stall first */
-			usbd_xfer_set_stall(xfer);
-			goto tr_setup;
-		}
-		break;
+	dx = acc->dx + ev->dx;
+	dy = acc->dy + ev->dy;
+	dz = acc->dz + ev->dz;
+	if (rd->rd_predict) {
+		dx += acc->pdx + ev->pdx;
+		dy += acc->pdy + ev->pdy;
 	}
+	if (!WELL_PACKET_FITS(dx) || !WELL_PACKET_FITS(dy) ||
+	    !WELL_PACKET_FITS(dz))
+		return (0);
+
+	acc->time = ev->time;
+	acc->dx += ev->dx;
+	acc->dy += ev->dy;
+	acc->dz += ev->dz;
+	acc->pdx += ev->pdx;
+	acc->pdy += ev->pdy;
+	return (1);
 }
 
-void
-well_reset_callback(struct usb_xfer *xfer, usb_error_t error)
+/* Account for a button change read "time" after it happened, once,
+ * by its first reader.  Event times come from getmicrouptime(), so
+ * short latencies read up to a tick long.  Called with the pipeline
+ * mutex held.
+ */
+static void
+well_click_latency(struct well_softc *sc, const struct timeval *time)
 {
+	struct timeval now;
+	int64_t us;
 
-	usb_device_request_t req;
-	struct usb_page_cache *pc;
-	struct well_softc *sc = usbd_xfer_softc(xfer);
+	microuptime(&now);
+	us = (now.tv_sec - time->tv_sec) * 1000000 +
+	    (now.tv_usec - time->tv_usec);
+	sc->sc_click_lat[MIN(flsll(MAX(us, 0)), WELL_LAT_BUCKETS - 1)]++;
+}
 
-	WELL_DEBUG("reset message received\n");
+static int
+well_read(struct cdev *dev, struct uio *uio, int ioflag)
+{
+	struct well_softc *sc = dev->si_drv1;
+	struct well_reader *rd;
+	struct well_event evs[WELL_READ_BATCH];
+	struct well_event *ev;
+	uint8_t buf[MOUSE_SYS_PACKETSIZE];
+	u_int i, n, max, limit;
+	int err, len;
+
+	if ((err = devfs_get_cdevpriv((void **)&rd)) != 0)
+		return (err);
+
+	mtx_lock(&sc->sc_pipe_mutex);
+	while (rd->rd_cursor == well_reader_limit(rd)) {
+		if (sc->sc_state & WELL_GONE) {
+			mtx_unlock(&sc->sc_pipe_mutex);
+			return (ENXIO);
+		}
+		if (ioflag & IO_NDELAY) {
+			mtx_unlock(&sc->sc_pipe_mutex);
+			return (EWOULDBLOCK);
+		}
+		err = msleep(rd->rd_rate != 0 ? (void *)&rd->rd_limit :
+		    (void *)&sc->sc_ring.head, &sc->sc_pipe_mutex,
+		    PZERO | PCATCH, "wellrd", 0);
+		if (err != 0) {
+			mtx_unlock(&sc->sc_pipe_mutex);
+			return (err);
+		}
+	}
 
-	switch (USB_GET_STATE(xfer)) {
-	case USB_ST_SETUP:
-		sc->sc_mode_bytes[0] = RAW_SENSOR_MODE;
-		req.bmRequestType = UT_WRITE_CLASS_INTERFACE;
-		req.bRequest = UR_SET_REPORT;
-		USETW2(req.wValue,
-		    (uint8_t)0x03 /* type */, (uint8_t)0x00 /* id */);
-		USETW(req.wIndex, 0);
-		USETW(req.wLength, WELL_MODE_LENGTH);
+	/* Copy events out in batches; uiomove() may fault, so it runs
+	 * without the mutex.  Paced readers get runs of motion merged
+	 * into one packet.
+	 */
+	while (uio->uio_resid >= rd->rd_mode.packetsize) {
+		well_reader_catchup(rd);
+		limit = well_reader_limit(rd);
+		max = min(WELL_READ_BATCH,
+		    uio->uio_resid / rd->rd_mode.packetsize);
+		for (n = 0; n < max && rd->rd_cursor != limit;
+		    rd->rd_cursor++) {
+			ev = &sc->sc_events[rd->rd_cursor &
+			    (WELL_RING_LEN - 1)];
+			if (ev->flags & WELL_EV_CLICK) {
+				well_click_latency(sc, &ev->time);
+				ev->flags &= ~WELL_EV_CLICK;
+			}
+			if (rd->rd_rate != 0 && n > 0 &&
+			    well_event_merge(rd, &evs[n - 1], ev))
+				continue;
+			evs[n++] = *ev;
+		}
+		if (n == 0)
+			break;
 
-		pc = usbd_xfer_get_frame(xfer, 0);
-		usbd_copy_in(pc, 0, &req, sizeof(req));
-		pc = usbd_xfer_get_frame(xfer, 1);
-		usbd_copy_in(pc, 0, sc->sc_mode_bytes, WELL_MODE_LENGTH);
+		mtx_unlock(&sc->sc_pipe_mutex);
 
-		usbd_xfer_set_frame_len(xfer, 0, sizeof(req));
-		usbd_xfer_set_frame_len(xfer, 1, WELL_MODE_LENGTH);
-		usbd_xfer_set_frames(xfer, 2);
-		usbd_transfer_submit(xfer);
-		break;
-	case USB_ST_TRANSFERRED:
-	default:
-		break;
+		for (i = 0; i < n; i++) {
+			len = well_encode(&rd->rd_mode, rd->rd_predict,
+			    &evs[i], buf);
+			if ((err = uiomove(buf, len, uio)) != 0)
+				return (err);
+		}
+		mtx_lock(&sc->sc_pipe_mutex);
 	}
+	mtx_unlock(&sc->sc_pipe_mutex);
 
+	return (0);
 }
 
+/* WELL_READFRAMES: copy out decoded frames in batches, like
+ * well_read() does for events.
+ */
+static int
+well_read_frames(struct well_reader *rd, struct well_read_frames *req,
+    int fflags)
+{
+	struct well_softc *sc = rd->rd_sc;
+	struct well_frame_rec recs[WELL_FRAMES_BATCH];
+	u_int i, n, lost;
+	int err;
+
+	if (req->version != WELL_FRAME_VERSION)
+		return (EINVAL);
+	if (!(rd->rd_fflags & FREAD))
+		return (EBADF);
+
+	req->count = 0;
+	mtx_lock(&sc->sc_pipe_mutex);
+	while (sc->sc_fring_head - rd->rd_fcursor <
+	    min(req->min, WELL_FRING_LEN)) {
+		if (sc->sc_state & WELL_GONE) {
+			mtx_unlock(&sc->sc_pipe_mutex);
+			return (ENXIO);
+		}
+		if (fflags & FNONBLOCK) {
+			mtx_unlock(&sc->sc_pipe_mutex);
+			return (EWOULDBLOCK);
+		}
+		err = msleep(&sc->sc_ring.head, &sc->sc_pipe_mutex,
+		    PZERO | PCATCH, "wellfr", 0);
+		if (err != 0) {
+			mtx_unlock(&sc->sc_pipe_mutex);
+			return (err);
+		}
+	}
+
+	while (req->count < req->max) {
+		if (sc->sc_fring_head - rd->rd_fcursor > WELL_FRING_LEN) {
+			lost = sc->sc_fring_head - rd->rd_fcursor -
+			    WELL_FRING_LEN;
+			rd->rd_flost += lost;
+			rd->rd_fcursor = sc->sc_fring_head - WELL_FRING_LEN;
+		}
+		n = sc->sc_fring_head - rd->rd_fcursor;
+		n = min(n, WELL_FRAMES_BATCH);
+		n = min(n, req->max - req->count);
+		if (n == 0)
+			break;
+
+		for (i = 0; i < n; i++)
+			recs[i] = sc->sc_fring[(rd->rd_fcursor + i) &
+			    (WELL_FRING_LEN - 1)];
+		rd->rd_fcursor += n;
+		mtx_unlock(&sc->sc_pipe_mutex);
+
+		err = copyout(recs, req->frames + req->count,
+		    n * sizeof(recs[0]));
+		if (err != 0)
+			return (err);
+		req->count += n;
+		mtx_lock(&sc->sc_pipe_mutex);
+	}
+	req->lost = rd->rd_flost;
+	rd->rd_flost = 0;
+	mtx_unlock(&sc->sc_pipe_mutex);
+
+	return (0);
+}
+
+static int
+well_poll(struct cdev *dev, int events, struct thread *td)
+{
+	struct well_softc *sc = dev->si_drv1;
+	struct well_reader *rd;
+	int revents = 0;
+
+	if (devfs_get_cdevpriv((void **)&rd) != 0)
+		return (events & (POLLIN | POLLRDNORM));
+
+	if (events & (POLLIN | POLLRDNORM)) {
+		mtx_lock(&sc->sc_pipe_mutex);
+		if (rd->rd_cursor != well_reader_limit(rd) ||
+		    (sc->sc_state & WELL_GONE))
+			revents |= events & (POLLIN | POLLRDNORM);
+		else
+			selrecord(td, rd->rd_rate != 0 ? &rd->rd_rsel :
+			    &sc->sc_rsel);
+		mtx_unlock(&sc->sc_pipe_mutex);
+	}
+
+	return (revents);
+}
+
+/* Compute the acceleration table for "factor", once, when the curve
+ * is set.  Called with the mutex held.
+ */
+static void
+well_accel_build(struct well_softc *sc, int factor)
+{
+	well_accel_init(&sc->sc_track.accel, factor);
+	sc->sc_mode.accelfactor = factor;
+}
+
+static int
+well_sysctl_accel(SYSCTL_HANDLER_ARGS)
+{
+	struct well_softc *sc = arg1;
+	int err, factor;
+
+	factor = sc->sc_mode.accelfactor;
+	err = sysctl_handle_int(oidp, &factor, 0, req);
+	if (err != 0 || req->newptr == NULL)
+		return (err);
+	if (factor < 0 || factor > WELL_ACCEL_FACTOR_MAX)
+		return (EINVAL);
+
+	mtx_lock(&sc->sc_pipe_mutex);
+	well_accel_build(sc, factor);
+	mtx_unlock(&sc->sc_pipe_mutex);
+	return (0);
+}
+
+/* Set the pad width (arg2 0) or height (arg2 1) in micrometres, from
+ * which the contact ellipse is scaled to physical units.
+ */
+static int
+well_sysctl_size(SYSCTL_HANDLER_ARGS)
+{
+	struct well_softc *sc = arg1;
+	const struct well_calib *calib;
+	u_int size;
+	int err, scale;
+
+	size = sc->sc_size_um[arg2];
+	err = sysctl_handle_int(oidp, &size, 0, req);
+	if (err != 0 || req->newptr == NULL)
+		return (err);
+
+	calib = arg2 == 0 ? &sc->sc_params->x_calib : &sc->sc_params->y_calib;
+	scale = 1 << 8;
+	if (size != 0)
+		scale = ((uint64_t)size << 8) / (calib->max - calib->min);
+	if (scale <= 0 || scale > (1 << 16))
+		return (EINVAL);
+
+	mtx_lock(&sc->sc_pipe_mutex);
+	sc->sc_size_um[arg2] = size;
+	if (arg2 == 0)
+		sc->sc_geom_sx = scale;
+	else
+		sc->sc_geom_sy = scale;
+	mtx_unlock(&sc->sc_pipe_mutex);
+	return (0);
+}
+
+/* Report the click latency histogram as "log2:count" pairs, counting
+ * the button changes first read less than 2^log2 us after they
+ * happened, for the non-empty buckets.  Writing anything resets it.
+ */
+static int
+well_sysctl_click_latency(SYSCTL_HANDLER_ARGS)
+{
+	struct well_softc *sc = arg1;
+	u_int lat[WELL_LAT_BUCKETS];
+	struct sbuf *sb;
+	int err, i;
+
+	mtx_lock(&sc->sc_pipe_mutex);
+	if (req->newptr != NULL) {
+		memset(sc->sc_click_lat, 0, sizeof(sc->sc_click_lat));
+		mtx_unlock(&sc->sc_pipe_mutex);
+		return (0);
+	}
+	memcpy(lat, sc->sc_click_lat, sizeof(lat));
+	mtx_unlock(&sc->sc_pipe_mutex);
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 256, req);
+	for (i = 0; i < WELL_LAT_BUCKETS; i++)
+		if (lat[i] != 0)
+			sbuf_printf(sb, "%s%d:%u", sbuf_len(sb) > 0 ? " " : "",
+			    i, lat[i]);
+	err = sbuf_finish(sb);
+	sbuf_delete(sb);
+	return (err);
+}
+
+static int
+well_ioctl(struct cdev *dev, u_long cmd, caddr_t addr, int fflags,
+    struct thread *td)
+{
+	struct well_softc *sc = dev->si_drv1;
+	struct well_reader *rd;
+	mousemode_t mode;
+	mousestatus_t *status;
+	int err;
+
+	if ((err = devfs_get_cdevpriv((void **)&rd)) != 0)
+		return (err);
+
+	/* Copies out to userspace, so it cannot run under a mutex. */
+	if (cmd == WELL_READFRAMES)
+		return (well_read_frames(rd, (struct well_read_frames *)addr,
+		    fflags));
+
+	mtx_lock(&sc->sc_pipe_mutex);
+	switch (cmd) {
+	case MOUSE_GETHWINFO:
+		*(mousehw_t *)addr = sc->sc_hw;
+		break;
+
+	case MOUSE_GETMODE:
+		rd->rd_mode.accelfactor = sc->sc_mode.accelfactor;
+		*(mousemode_t *)addr = rd->rd_mode;
+		break;
+
+	case MOUSE_SETMODE:
+		mode = *(mousemode_t *)addr;
+		if (mode.level != -1 && (mode.level < 0 || mode.level > 1)) {
+			err = EINVAL;
+			break;
+		}
+		if (mode.level != -1)
+			well_reader_set_level(rd, mode.level);
+		if (mode.rate > 0)
+			atomic_store_rel_int(&sc->sc_pollrate,
+			    imin(mode.rate, 1000));
+		if (mode.accelfactor >= 0)
+			well_accel_build(sc, imin(mode.accelfactor,
+			    WELL_ACCEL_FACTOR_MAX));
+		break;
+
+	case MOUSE_GETLEVEL:
+		*(int *)addr = rd->rd_mode.level;
+		break;
+
+	case MOUSE_SETLEVEL:
+		if (*(int *)addr < 0 || *(int *)addr > 1) {
+			err = EINVAL;
+			break;
+		}
+		well_reader_set_level(rd, *(int *)addr);
+		break;
+
+	case WELL_GETPREDICT:
+		*(int *)addr = rd->rd_predict;
+		break;
+
+	case WELL_SETPREDICT:
+		rd->rd_predict = *(int *)addr != 0;
+		break;
+
+	case WELL_GETRATE:
+		*(int *)addr = rd->rd_rate;
+		break;
+
+	case WELL_SETRATE:
+		if (!(rd->rd_fflags & FREAD)) {
+			err = EBADF;
+			break;
+		}
+		if (*(int *)addr < 0 || *(int *)addr > WELL_RATE_MAX) {
+			err = EINVAL;
+			break;
+		}
+		well_reader_set_rate(rd, *(int *)addr);
+		break;
+
+	case MOUSE_GETSTATUS:
+		status = (mousestatus_t *)addr;
+		*status = sc->sc_status;
+		sc->sc_status.obutton = sc->sc_status.button;
+		sc->sc_status.flags = 0;
+		sc->sc_status.dx = 0;
+		sc->sc_status.dy = 0;
+		sc->sc_status.dz = 0;
+		break;
+
+	default:
+		err = ENOTTY;
+		break;
+	}
+	mtx_unlock(&sc->sc_pipe_mutex);
+
+	return (err);
+}
+
+#ifdef WELL_PROFILE
+static const char *well_prof_names[WELL_PROF_N] = {
+	[WELL_PROF_HOLD]     = "hold",
+	[WELL_PROF_RESUBMIT] = "resubmit",
+	[WELL_PROF_COPY]     = "copy",
+	[WELL_PROF_SUBMIT]   = "submit",
+	[WELL_PROF_FILTER]   = "filter",
+	[WELL_PROF_DECODE]   = "decode",
+	[WELL_PROF_BUTTONS]  = "buttons",
+	[WELL_PROF_GESTURE]  = "gesture",
+	[WELL_PROF_TRACK]    = "track",
+	[WELL_PROF_PUT]      = "put",
+};
+
+/* Report the cycle accounting as a table, one stage per line:
+ *
+ *   stage count min avg max [log2:count ...]
+ *
+ * where "log2:count" gives the number of samples of fewer than
+ * 2^log2 cycles, for the non-empty buckets.  Writing anything resets
+ * the counters.
+ */
+static int
+well_sysctl_prof(SYSCTL_HANDLER_ARGS)
+{
+	struct well_softc *sc = arg1;
+	struct well_prof prof[WELL_PROF_N];
+	struct sbuf *sb;
+	int err, i, j;
+
+	/* The callbacks count under one mutex, the frame task under the
+	 * other.
+	 */
+	mtx_lock(&sc->sc_mutex);
+	mtx_lock(&sc->sc_pipe_mutex);
+	if (req->newptr != NULL)
+		memset(sc->sc_prof, 0, sizeof(sc->sc_prof));
+	else
+		memcpy(prof, sc->sc_prof, sizeof(prof));
+	mtx_unlock(&sc->sc_pipe_mutex);
+	mtx_unlock(&sc->sc_mutex);
+	if (req->newptr != NULL)
+		return (0);
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 1024, req);
+	for (i = 0; i < WELL_PROF_N; i++) {
+		sbuf_printf(sb, "%s %ju %ju %ju %ju", well_prof_names[i],
+		    (uintmax_t)prof[i].count, (uintmax_t)prof[i].min,
+		    (uintmax_t)(prof[i].count ?
+		    prof[i].total / prof[i].count : 0),
+		    (uintmax_t)prof[i].max);
+		for (j = 0; j < WELL_PROF_BUCKETS; j++)
+			if (prof[i].hist[j] != 0)
+				sbuf_printf(sb, " %d:%u", j, prof[i].hist[j]);
+		sbuf_printf(sb, "\n");
+	}
+	err = sbuf_finish(sb);
+	sbuf_delete(sb);
+	return (err);
+}
+#endif
+
+/* Store one event in the shared ring.  This is the only per-event
+ * work of the producer, whatever the number of readers.  Returns the
+ * event, with no prediction correction, or NULL if it was dropped.
+ */
+static struct well_event *
+well_ring_put(struct well_softc *sc, const struct timeval *time, int dx,
+    int dy, int dz, u_int buttons)
+{
+	struct well_event *ev;
+
+	if (!(sc->sc_state & WELL_ENABLED))
+		return (NULL);
+
+	ev = well_event_put(&sc->sc_ring, sc->sc_events, time, dx, dy, dz,
+	    buttons);
+	WELL_TRACE(ring, put, sc, sc->sc_ring.head - 1, ev);
+	return (ev);
+}
+
+/* Store a decoded frame for WELL_READFRAMES. */
+static void
+well_fring_put(struct well_softc *sc, const struct well_frame *frame)
+{
+	struct well_frame_rec *rec;
+	u_int i;
+
+	rec = &sc->sc_fring[sc->sc_fring_head & (WELL_FRING_LEN - 1)];
+	rec->version = WELL_FRAME_VERSION;
+	rec->size = sizeof(*rec);
+	rec->seq = sc->sc_fring_head;
+	rec->tv_sec = frame->time.tv_sec;
+	rec->tv_usec = frame->time.tv_usec;
+	rec->buttons = frame->buttons;
+	rec->ncontacts = frame->nfingers;
+	for (i = 0; i < frame->nfingers; i++) {
+		rec->contacts[i].x = frame->x[i];
+		rec->contacts[i].y = frame->y[i];
+		rec->contacts[i].touch_major = frame->touch_major[i];
+		rec->contacts[i].touch_minor = frame->touch_minor[i];
+		rec->contacts[i].orientation = frame->orientation[i];
+		well_ellipse(sc->sc_geom_sx, sc->sc_geom_sy,
+		    frame->touch_major[i], frame->touch_minor[i],
+		    frame->orientation[i], &rec->contacts[i]);
+	}
+	sc->sc_fring_head++;
+	sc->sc_ring.pending = 1;
+}
+
+/* Store a frame the filter skipped as a copy of the last record, with
+ * its own sequence number and time, so that readers still see every
+ * frame the device sent.  The filter forgets its frame whenever the
+ * chain changes, so the last record is always the frame repeated.
+ */
+static void
+well_fring_repeat(struct well_softc *sc, const struct timeval *time)
+{
+	struct well_frame_rec *rec;
+
+	if (sc->sc_fring_head == 0)
+		return;
+	rec = &sc->sc_fring[sc->sc_fring_head & (WELL_FRING_LEN - 1)];
+	*rec = sc->sc_fring[(sc->sc_fring_head - 1) & (WELL_FRING_LEN - 1)];
+	rec->seq = sc->sc_fring_head;
+	rec->tv_sec = time->tv_sec;
+	rec->tv_usec = time->tv_usec;
+	sc->sc_fring_head++;
+	sc->sc_ring.pending = 1;
+}
+
+/* Wake the readers once for a whole batch of events.  Paced readers
+ * are woken by their callout instead, at the next tick of their own
+ * schedule; it only runs while events arrive.  A button change or a
+ * touch skips the schedule: paced readers get everything up to it at
+ * once, so it still comes after the motion before it.  A touch with no
+ * event, as without the track stage, wakes no one.
+ */
+static void
+well_ring_wakeup(struct well_softc *sc)
+{
+	struct well_reader *rd;
+	int delay, urgent;
+
+	if (!sc->sc_ring.pending) {
+		sc->sc_ring.urgent = 0;
+		return;
+	}
+
+	urgent = sc->sc_ring.urgent;
+	sc->sc_ring.pending = 0;
+	sc->sc_ring.urgent = 0;
+	wakeup(&sc->sc_ring.head);
+	selwakeuppri(&sc->sc_rsel, PZERO);
+
+	LIST_FOREACH(rd, &sc->sc_paced, rd_link) {
+		if (urgent) {
+			well_reader_tick(rd);
+			continue;
+		}
+		if (callout_pending(&rd->rd_callout))
+			continue;
+		delay = rd->rd_period -
+		    (u_int)(ticks - rd->rd_epoch) % rd->rd_period;
+		callout_reset(&rd->rd_callout, delay, well_reader_tick, rd);
+	}
+}
+
+/* Report a new button state, with no motion. */
+static void
+well_emit_buttons(struct well_softc *sc, const struct timeval *time,
+    u_int buttons)
+{
+	if (buttons == sc->sc_status.button)
+		return;
+
+	sc->sc_status.obutton = sc->sc_status.button;
+	sc->sc_status.button = buttons;
+	sc->sc_status.flags |= MOUSE_STDBUTTONSCHANGED;
+	well_ring_put(sc, time, 0, 0, 0, buttons);
+}
+
+/* Compile a zone specification into a new map; see
+ * well_zone_compile().
+ */
+static int
+well_zone_build(const struct well_dev_params *params, const char *spec,
+    struct well_zone_map **mapp)
+{
+	struct well_zone_map *map;
+	int err;
+
+	map = malloc(sizeof(*map), M_WELL, M_WAITOK);
+	if ((err = well_zone_compile(params, spec, map)) != 0) {
+		free(map, M_WELL);
+		return (err);
+	}
+	*mapp = map;
+	return (0);
+}
+
+/* A clickpad was pressed: report the right or middle button if a
+ * contact rests in their zone, else the left one.
+ */
+static u_int
+well_zone_click(const struct well_softc *sc, const struct well_frame *frame)
+{
+	u_int buttons = MOUSE_BUTTON1DOWN;
+	u_int i;
+
+	for (i = 0; i < frame->nfingers; i++)
+		switch (well_zone(sc->sc_zones, frame->x[i], frame->y[i])) {
+		case WELL_ZONE_RIGHT:
+			return (MOUSE_BUTTON3DOWN);
+		case WELL_ZONE_MIDDLE:
+			buttons = MOUSE_BUTTON2DOWN;
+			break;
+		}
+	return (buttons);
+}
+
+/* Replace the zone map.  The new map is built first and swapped in
+ * under the pipeline mutex, so frames see either map whole.
+ */
+static int
+well_sysctl_zones(SYSCTL_HANDLER_ARGS)
+{
+	struct well_softc *sc = arg1;
+	struct well_zone_map *map;
+	char spec[WELL_ZONE_SPEC_LEN];
+	int err;
+
+	mtx_lock(&sc->sc_pipe_mutex);
+	strlcpy(spec, sc->sc_zone_spec, sizeof(spec));
+	mtx_unlock(&sc->sc_pipe_mutex);
+	err = sysctl_handle_string(oidp, spec, sizeof(spec), req);
+	if (err != 0 || req->newptr == NULL)
+		return (err);
+	if ((err = well_zone_build(sc->sc_params, spec, &map)) != 0)
+		return (err);
+
+	mtx_lock(&sc->sc_pipe_mutex);
+	strlcpy(sc->sc_zone_spec, spec, sizeof(sc->sc_zone_spec));
+	swap(map, sc->sc_zones);
+	mtx_unlock(&sc->sc_pipe_mutex);
+	free(map, M_WELL);
+	return (0);
+}
+
+/* Fingers lifted off a scroll: start the momentum callout if the
+ * scroll was fast enough.
+ */
+static void
+well_kinetic_start(struct well_softc *sc)
+{
+	if (!well_kinetic || !well_scroll_fling(&sc->sc_scroll))
+		return;
+
+	callout_reset(&sc->sc_kinetic_callout,
+	    MAX(1, (WELL_KINETIC_TICK * hz) / 1000), &well_kinetic_tick, sc);
+}
+
+/* A new touch stops the momentum at once. */
+static void
+well_kinetic_stop(struct well_softc *sc)
+{
+	callout_stop(&sc->sc_kinetic_callout);
+	sc->sc_scroll.kv = 0;
+}
+
+/* Emit one decaying scroll step.  The callout is not rescheduled once
+ * the velocity dies out, so momentum costs nothing while idle.
+ */
+static void
+well_kinetic_tick(void *arg)
+{
+	struct well_softc *sc = arg;
+	struct timeval now;
+	int dz;
+
+	mtx_assert(&sc->sc_pipe_mutex, MA_OWNED);
+
+	if (!well_scroll_coast(&sc->sc_scroll, well_kinetic_decay, &dz))
+		return;
+	if (dz != 0) {
+		getmicrouptime(&now);
+		sc->sc_status.dz += dz;
+		well_ring_put(sc, &now, 0, 0, dz, sc->sc_status.button);
+		well_ring_wakeup(sc);
+	}
+
+	callout_reset(&sc->sc_kinetic_callout,
+	    MAX(1, (WELL_KINETIC_TICK * hz) / 1000), &well_kinetic_tick, sc);
+}
+
+/* Make out the gesture of a decoded frame before it is tracked:
+ * WELL_SCROLL_FINGERS fingers, or a lone finger that landed in a
+ * vscroll zone, scroll, and a clickpad click picks its button from the
+ * zones as it starts.  A change of finger count picks the zone anew,
+ * restarts scrolling, and flings or stops the momentum.  Without this
+ * stage, every frame points and clicks report the left button.
+ */
+static void
+well_gesture_frame(struct well_softc *sc, const struct well_frame *frame)
+{
+	u_int fingers = sc->sc_gesture_fingers;
+
+	/* A finger landing cancels momentum. */
+	if (sc->sc_scroll.kv != 0 && frame->nfingers > fingers)
+		well_kinetic_stop(sc);
+
+	if (frame->nfingers != fingers) {
+		sc->sc_gesture_fingers = frame->nfingers;
+		sc->sc_zone_track = WELL_ZONE_NONE;
+		if (frame->nfingers == 1)
+			sc->sc_zone_track = well_zone(sc->sc_zones,
+			    frame->x[0], frame->y[0]);
+		if (frame->nfingers == WELL_SCROLL_FINGERS ||
+		    sc->sc_zone_track == WELL_ZONE_VSCROLL)
+			well_scroll_reset(&sc->sc_scroll, &frame->time);
+		if (fingers == WELL_SCROLL_FINGERS &&
+		    frame->nfingers < WELL_SCROLL_FINGERS)
+			well_kinetic_start(sc);
+	}
+	sc->sc_gesture_scroll = frame->nfingers == WELL_SCROLL_FINGERS ||
+	    sc->sc_zone_track == WELL_ZONE_VSCROLL;
+
+	if ((sc->sc_params->flags & INTEGRATED_BUTTON) &&
+	    frame->buttons != 0 && sc->sc_status.button == 0)
+		sc->sc_gesture_click = well_zone_click(sc, frame);
+}
+
+/* Turn a decoded frame into relative motion of the primary finger, or
+ * into scrolling if the gesture stage says so.  The motion itself
+ * comes from well_track(), which the userspace driver shares.  A
+ * change of finger count, lift-off included, takes back the predicted
+ * offset in the same event.  The first contact after none, as the
+ * decode stage found it, always makes an event, marked urgent so that
+ * paced readers see the touch at once, like a click.
+ */
+static void
+well_emit_frame(struct well_softc *sc, const struct well_frame *frame)
+{
+	struct well_event *ev;
+	u_int buttons;
+	int scroll, dx, dy, dz, pdx, pdy;
+	WELL_PROF_DECL(t);
+
+	dz = pdx = pdy = 0;
+	scroll = sc->sc_gesture_scroll;
+	switch (well_track(&sc->sc_track, sc->sc_norm, frame, scroll, &dx,
+	    &dy)) {
+	case WELL_TRACK_MOVE:
+		if (scroll) {
+			dz = well_scroll(&sc->sc_scroll, &frame->time, dy);
+			dx = dy = 0;
+		} else if (well_predict_horizon != 0)
+			well_predict(&sc->sc_pred, &frame->time,
+			    well_predict_horizon, dx, dy, &pdx, &pdy);
+		break;
+	case WELL_TRACK_CHANGE:
+		well_predict_reset(&sc->sc_pred, &frame->time, &pdx, &pdy);
+		break;
+	}
+
+	/* Clickpads pick the button when the click starts. */
+	if (sc->sc_params->flags & INTEGRATED_BUTTON) {
+		buttons = 0;
+		if (frame->buttons != 0)
+			buttons = sc->sc_status.button != 0 ?
+			    sc->sc_status.button : sc->sc_gesture_click;
+	} else
+		buttons = sc->sc_status.button;
+
+	if (dx == 0 && dy == 0 && dz == 0 && pdx == 0 && pdy == 0 &&
+	    buttons == sc->sc_status.button && !sc->sc_touch)
+		return;
+
+	if (buttons != sc->sc_status.button) {
+		sc->sc_status.obutton = sc->sc_status.button;
+		sc->sc_status.button = buttons;
+		sc->sc_status.flags |= MOUSE_STDBUTTONSCHANGED;
+	}
+	if (dx != 0 || dy != 0 || dz != 0)
+		sc->sc_status.flags |= MOUSE_POSCHANGED;
+	sc->sc_status.dx += dx;
+	sc->sc_status.dy += dy;
+	sc->sc_status.dz += dz;
+	WELL_PROF_START(t);
+	ev = well_ring_put(sc, &frame->time, dx, dy, dz, buttons);
+	WELL_PROF_END(sc, WELL_PROF_PUT, t);
+	if (ev != NULL) {
+		ev->pdx = pdx;
+		ev->pdy = pdy;
+		if (sc->sc_touch)
+			ev->flags |= WELL_EV_URGENT;
+	}
+}
+
+/* Emit the queued button events that happened no later than "limit",
+ * or all of them if "limit" is NULL, oldest first.
+ */
+static void
+well_merge_buttons(struct well_softc *sc, const struct timeval *limit)
+{
+	struct well_button_event *ev;
+
+	if (sc->sc_button_count == 0)
+		return;
+
+	while (sc->sc_button_count > 0) {
+		ev = &sc->sc_button_queue[sc->sc_button_head];
+		if (limit != NULL && timevalcmp(&ev->time, limit, >))
+			break;
+		well_emit_buttons(sc, &ev->time, ev->buttons);
+		sc->sc_button_head =
+		    (sc->sc_button_head + 1) % WELL_BUTTON_QUEUE_LEN;
+		sc->sc_button_count--;
+	}
+
+	if (sc->sc_button_count == 0)
+		callout_stop(&sc->sc_merge_callout);
+}
+
+/* Queue a button endpoint event of "time".  It is held until the
+ * next trackpad frame so that it is delivered in order with the
+ * surrounding motion, or until the merge window expires if the pad is
+ * idle.  When no frame or button event is waiting, everything before
+ * it is in the ring already, and it goes out at once.  Called from the
+ * frame task with the pipeline mutex held.
+ */
+static void
+well_queue_buttons(struct well_softc *sc, const struct timeval *time,
+    u_int buttons)
+{
+	struct well_button_event *ev;
+
+	if (sc->sc_button_count == 0 &&
+	    sc->sc_fq_head == atomic_load_acq_int(&sc->sc_fq_tail)) {
+		well_emit_buttons(sc, time, buttons);
+		return;
+	}
+
+	if (sc->sc_button_count == WELL_BUTTON_QUEUE_LEN)
+		well_merge_buttons(sc, NULL);
+
+	ev = &sc->sc_button_queue[(sc->sc_button_head + sc->sc_button_count) %
+	    WELL_BUTTON_QUEUE_LEN];
+	ev->time = *time;
+	ev->buttons = buttons;
+	sc->sc_button_count++;
+
+	if (!callout_pending(&sc->sc_merge_callout))
+		callout_reset(&sc->sc_merge_callout,
+		    MAX(1, (WELL_MERGE_WINDOW * hz) / 1000),
+		    &well_merge_timeout, sc);
+}
+
+/* Take the button events the USB callback queued in sc_bq.  Called
+ * with the pipeline mutex held.
+ */
+static void
+well_button_drain(struct well_softc *sc)
+{
+	struct well_button_event *ev;
+	u_int head;
+
+	head = sc->sc_bq_head;
+	while (head != atomic_load_acq_int(&sc->sc_bq_tail)) {
+		ev = &sc->sc_bq[head & (WELL_BQ_LEN - 1)];
+		well_queue_buttons(sc, &ev->time, ev->buttons);
+		atomic_store_rel_int(&sc->sc_bq_head, ++head);
+	}
+}
+
+/* No frame arrived within the merge window: flush the buttons alone. */
+static void
+well_merge_timeout(void *arg)
+{
+	struct well_softc *sc = arg;
+
+	mtx_assert(&sc->sc_pipe_mutex, MA_OWNED);
+	well_merge_buttons(sc, NULL);
+	well_ring_wakeup(sc);
+}
+
+/* Tell whether a frame repeats the previous one; see well_filter().
+ * Frames that count WELL_SCROLL_FINGERS contacts in their header are
+ * never skipped, whatever the scroll state.
+ */
+static int
+well_frame_idle(struct well_softc *sc, const uint8_t *data, int len)
+{
+	return (well_filter(&sc->sc_filter, sc->sc_params, data, len));
+}
+
+static void
+well_button_intr(struct usb_xfer *xfer, usb_error_t error)
+{
+        int len, queued = 0;
+	uint8_t data[WELL_BUTTON_DATALEN];
+	struct well_softc *sc = usbd_xfer_softc(xfer);
+	struct usb_page_cache *pc;
+	struct well_button_event *ev;
+	u_int tail;
+
+	usbd_xfer_status(xfer, &len, NULL, NULL, NULL);
+
+	switch (USB_GET_STATE(xfer)) {
+	case USB_ST_TRANSFERRED:
+                WELL_DEBUG("transferred interrupt\n");
+
+		if (len > sc->sc_params->button_datalen) {
+		        WELL_WARN(
+			    "truncating large packet from %u to %u bytes\n",
+			    len, sc->sc_params->button_datalen);
+			len = sc->sc_params->button_datalen;
+		}
+
+		if (len < sc->sc_params->button_datalen) {
+		        WELL_WARN("received short packet, ignoring\n");
+			goto tr_setup;
+		}
+
+		pc = usbd_xfer_get_frame(xfer, 0);
+		usbd_copy_out(pc, 0, data,
+		    sc->sc_params->button_datalen);
+		WELL_DEBUG("got data { %x, %x, %x, %x }\n",
+			   data[0], data[1], data[2], data[3]);
+
+		/* The frame task merges it with the frames. */
+		tail = sc->sc_bq_tail;
+		if (tail - atomic_load_acq_int(&sc->sc_bq_head) ==
+		    WELL_BQ_LEN) {
+			sc->sc_fq_drops++;
+			goto tr_setup;
+		}
+		ev = &sc->sc_bq[tail & (WELL_BQ_LEN - 1)];
+		getmicrouptime(&ev->time);
+		ev->buttons = data[1] ? MOUSE_BUTTON1DOWN : 0;
+		atomic_store_rel_int(&sc->sc_bq_tail, tail + 1);
+		queued = 1;
+		// FALLTHROUGH
+	case USB_ST_SETUP:
+                WELL_DEBUG("setting up transfer\n");
+	tr_setup:
+		usbd_xfer_set_frame_len(xfer, 0,
+		    sc->sc_params->button_datalen);
+		usbd_transfer_submit(xfer);
+		break;
+
+	default:                        /* Error */
+	  WELL_DEBUG("error interrupt (%d)\n", error);
+		if (error != USB_ERR_CANCELLED) {
+			/* try clear stall first */
+			usbd_xfer_set_stall(xfer);
+			goto tr_setup;
+		}
+		break;
+	}
+
+	if (queued)
+		taskqueue_enqueue(sc->sc_tq, &sc->sc_frame_task);
+}
+
+/* Whether the pipes are stopped while idle, and the pad polled.
+ * Called with the USB mutex held.
+ */
+static __inline int
+well_polled(const struct well_softc *sc)
+{
+	return ((sc->sc_state & WELL_SUSPENDED) && !sc->sc_remote_wakeup);
+}
+
+/* The idle pad is awake, by a poll or by itself: send raw mode again;
+ * well_reset_callback() then fetches one frame.  Called with the USB
+ * mutex held.
+ */
+static void
+well_suspend_wake(struct well_softc *sc)
+{
+	sc->sc_suspend_polls++;
+	getmicrouptime(&sc->sc_suspend_poll_time);
+	usbd_set_power_mode(sc->sc_usb_device, USB_POWER_MODE_ON);
+	usbd_transfer_start(sc->sc_xfer[WELL_RESET]);
+}
+
+/* Idle poll interval expired: wake a pad that cannot wake itself. */
+static void
+well_suspend_timeout_cb(void *arg)
+{
+	struct well_softc *sc = arg;
+
+	mtx_assert(&sc->sc_mutex, MA_OWNED);
+
+	if (!well_polled(sc))
+		return;
+	well_suspend_wake(sc);
+	callout_reset(&sc->sc_suspend_callout,
+	    MAX(1, (well_suspend_poll * hz) / 1000),
+	    &well_suspend_timeout_cb, sc);
+}
+
+/* Leave the idle state, with the pad awake.  Called with the mutex
+ * held.
+ */
+static void
+well_resume(struct well_softc *sc)
+{
+	sc->sc_state &= ~WELL_SUSPENDED;
+	callout_stop(&sc->sc_suspend_callout);
+	usbd_set_power_mode(sc->sc_usb_device, USB_POWER_MODE_ON);
+}
+
+/* Apply the idle policy after a frame of "time", "touched" or not.
+ * While a pad is polled, the USB callback does not resubmit after a
+ * frame: a touch restarts the pipes, and a frame without one lets the
+ * pad sleep until the next poll.  Called from the frame task without
+ * either mutex; streaming on, it decides so without the USB mutex,
+ * which it only takes to change state.
+ */
+static void
+well_autosuspend(struct well_softc *sc, int touched,
+    const struct timeval *time)
+{
+	struct timeval now;
+	u_int us;
+
+	if (touched)
+		sc->sc_touch_ticks = ticks;
+	if (!(sc->sc_state & WELL_SUSPENDED) && (touched ||
+	    well_suspend_timeout == 0 || ticks - sc->sc_touch_ticks <
+	    (int)((well_suspend_timeout * hz) / 1000)))
+		return;
+
+	mtx_lock(&sc->sc_mutex);
+	/* The last reader may have gone since the frame came. */
+	if ((sc->sc_state & (WELL_ENABLED | WELL_GONE)) != WELL_ENABLED)
+		goto out;
+
+	if (touched) {
+		if (sc->sc_state & WELL_SUSPENDED) {
+			WELL_DEBUG("touched, resuming streaming\n");
+			/* Touched before it ever slept: no wakeup to time. */
+			if (timerisset(&sc->sc_suspend_poll_time)) {
+				now = *time;
+				timevalsub(&now, &sc->sc_suspend_poll_time);
+				us = now.tv_sec * 1000000 + now.tv_usec;
+				sc->sc_resume_us = MAX(sc->sc_resume_us, us);
+			}
+			well_resume(sc);
+			usbd_transfer_start(sc->sc_xfer[WELL_INTR_TRACKPAD]);
+			if (!(sc->sc_params->flags & INTEGRATED_BUTTON))
+				usbd_transfer_start(
+				    sc->sc_xfer[WELL_INTR_BUTTON]);
+		}
+		goto out;
+	}
+
+	if (sc->sc_state & WELL_SUSPENDED) {
+		usbd_set_power_mode(sc->sc_usb_device, USB_POWER_MODE_SAVE);
+		goto out;
+	}
+
+	sc->sc_state |= WELL_SUSPENDED;
+	sc->sc_suspends++;
+	timerclear(&sc->sc_suspend_poll_time);
+	usbd_set_power_mode(sc->sc_usb_device, USB_POWER_MODE_SAVE);
+	if (sc->sc_remote_wakeup) {
+		WELL_DEBUG("idle, waiting for remote wakeup\n");
+		goto out;
+	}
+	WELL_DEBUG("idle, polling every %u ms\n", well_suspend_poll);
+	usbd_transfer_stop(sc->sc_xfer[WELL_INTR_TRACKPAD]);
+	usbd_transfer_stop(sc->sc_xfer[WELL_INTR_BUTTON]);
+	callout_reset(&sc->sc_suspend_callout,
+	    MAX(1, (well_suspend_poll * hz) / 1000),
+	    &well_suspend_timeout_cb, sc);
+out:
+	mtx_unlock(&sc->sc_mutex);
+}
+
+/* A resting finger has stopped: take back the predicted offset, which
+ * the frames the filter skips would otherwise have decayed.
+ */
+static void
+well_predict_rest(struct well_softc *sc, const struct timeval *time)
+{
+	struct well_event *ev;
+	int pdx, pdy;
+
+	if (sc->sc_pred.ox == 0 && sc->sc_pred.oy == 0)
+		return;
+
+	well_predict_reset(&sc->sc_pred, time, &pdx, &pdy);
+	ev = well_ring_put(sc, time, 0, 0, 0, sc->sc_status.button);
+	if (ev != NULL) {
+		ev->pdx = pdx;
+		ev->pdy = pdy;
+	}
+}
+
+/* A repeated frame carries no motion; only deliver the clicks that
+ * it would have released, retract any prediction and, if the frames
+ * stage runs, record it again for WELL_READFRAMES readers.
+ */
+static int
+well_stage_filter(struct well_softc *sc, const struct well_raw *raw)
+{
+	int idle;
+	WELL_PROF_DECL(t);
+
+	WELL_PROF_START(t);
+	idle = well_frame_idle(sc, raw->data, raw->len);
+	WELL_PROF_END(sc, WELL_PROF_FILTER, t);
+	if (idle) {
+		if (sc->sc_chain_mask & (1 << WELL_STAGE_FRAMES)) {
+			WELL_PROF_START(t);
+			well_fring_repeat(sc, &sc->sc_frame.time);
+			WELL_PROF_END(sc, WELL_PROF_PUT, t);
+		}
+		well_merge_buttons(sc, &sc->sc_frame.time);
+		well_predict_rest(sc, &sc->sc_frame.time);
+	}
+	return (idle);
+}
+
+/* Decode, and find touch-down here rather than in a later stage, so
+ * that paced readers are woken at once for it whatever stages run.
+ */
+static int
+well_stage_decode(struct well_softc *sc, const struct well_raw *raw)
+{
+	WELL_PROF_DECL(t);
+
+	WELL_PROF_START(t);
+	well_decode_frame(sc->sc_params, raw->data, raw->len, &sc->sc_frame);
+	WELL_PROF_END(sc, WELL_PROF_DECODE, t);
+	sc->sc_touch = sc->sc_touch_fingers == 0 &&
+	    sc->sc_frame.nfingers > 0;
+	sc->sc_touch_fingers = sc->sc_frame.nfingers;
+	if (sc->sc_touch)
+		sc->sc_ring.urgent = 1;
+	WELL_DEBUG("frame with %u fingers, buttons %x\n",
+		   sc->sc_frame.nfingers, sc->sc_frame.buttons);
+	return (0);
+}
+
+static int
+well_stage_frames(struct well_softc *sc, const struct well_raw *raw)
+{
+	WELL_PROF_DECL(t);
+
+	WELL_PROF_START(t);
+	well_fring_put(sc, &sc->sc_frame);
+	WELL_PROF_END(sc, WELL_PROF_PUT, t);
+	return (0);
+}
+
+/* Deliver the clicks pending before this frame, ahead of its motion. */
+static int
+well_stage_buttons(struct well_softc *sc, const struct well_raw *raw)
+{
+	WELL_PROF_DECL(t);
+
+	WELL_PROF_START(t);
+	well_merge_buttons(sc, &sc->sc_frame.time);
+	WELL_PROF_END(sc, WELL_PROF_BUTTONS, t);
+	return (0);
+}
+
+static int
+well_stage_gesture(struct well_softc *sc, const struct well_raw *raw)
+{
+	WELL_PROF_DECL(t);
+
+	WELL_PROF_START(t);
+	well_gesture_frame(sc, &sc->sc_frame);
+	WELL_PROF_END(sc, WELL_PROF_GESTURE, t);
+	return (0);
+}
+
+static int
+well_stage_track(struct well_softc *sc, const struct well_raw *raw)
+{
+	WELL_PROF_DECL(t);
+
+	WELL_PROF_START(t);
+	well_emit_frame(sc, &sc->sc_frame);
+	WELL_PROF_END(sc, WELL_PROF_TRACK, t);
+	return (0);
+}
+
+static const struct well_stage {
+	const char   *name;
+	well_stage_t *fn;
+} well_stages[WELL_STAGE_N] = {
+	[WELL_STAGE_FILTER]  = { "filter",  &well_stage_filter },
+	[WELL_STAGE_DECODE]  = { "decode",  &well_stage_decode },
+	[WELL_STAGE_FRAMES]  = { "frames",  &well_stage_frames },
+	[WELL_STAGE_BUTTONS] = { "buttons", &well_stage_buttons },
+	[WELL_STAGE_GESTURE] = { "gesture", &well_stage_gesture },
+	[WELL_STAGE_TRACK]   = { "track",   &well_stage_track },
+};
+
+/* Resolve the stages in "mask" into the chain run on every frame.
+ * Stages left out are not in the chain at all, so they cost nothing.
+ * Called with the pipeline mutex held, or before the device starts.
+ */
+static void
+well_chain_build(struct well_softc *sc, u_int mask)
+{
+	u_int i, n;
+
+	mask = (mask & WELL_STAGE_ALL) | WELL_STAGE_REQUIRED;
+	for (i = n = 0; i < WELL_STAGE_N; i++)
+		if (mask & (1 << i))
+			sc->sc_chain[n++] = well_stages[i].fn;
+	sc->sc_chain[n] = NULL;
+	sc->sc_chain_mask = mask;
+
+	/* The filter compares against the last frame it saw. */
+	sc->sc_filter.len = 0;
+
+	/* Gestures start over, or stay at pointing without the stage. */
+	sc->sc_zone_track = WELL_ZONE_NONE;
+	sc->sc_gesture_fingers = 0;
+	sc->sc_gesture_scroll = 0;
+	sc->sc_gesture_click = MOUSE_BUTTON1DOWN;
+}
+
+/* Run the chain over one frame. */
+static __inline void
+well_chain_run(struct well_softc *sc, const struct well_raw *raw)
+{
+	well_stage_t * const *stage;
+
+	sc->sc_frame.time = raw->time;
+	for (stage = sc->sc_chain; *stage != NULL; stage++)
+		if ((*stage)(sc, raw) != 0)
+			break;
+}
+
+/* Process one frame grabbed by the USB callback, after the button
+ * events that came before it, then apply the idle policy.  Takes the
+ * pipeline mutex; the USB mutex only to change the idle state.
+ */
+static void
+well_process_frame(struct well_softc *sc, const struct well_raw *raw)
+{
+	int touched;
+
+	mtx_lock(&sc->sc_pipe_mutex);
+	well_button_drain(sc);
+	if ((sc->sc_state & (WELL_ENABLED | WELL_GONE)) != WELL_ENABLED) {
+		mtx_unlock(&sc->sc_pipe_mutex);
+		return;
+	}
+	well_chain_run(sc, raw);
+	well_ring_wakeup(sc);
+	touched = sc->sc_frame.nfingers > 0 || sc->sc_frame.buttons != 0;
+	mtx_unlock(&sc->sc_pipe_mutex);
+
+	well_autosuspend(sc, touched, &raw->time);
+}
+
+/* Set the frame chain from a list of stage names separated by spaces.
+ * The stages always run in the order of well_stages[], and decode and
+ * buttons are always in.  Without frames, WELL_READFRAMES readers see
+ * nothing; without gesture, there is no scrolling and no clickpad
+ * zone; without track, only the button endpoint reports.
+ */
+static int
+well_sysctl_chain(SYSCTL_HANDLER_ARGS)
+{
+	struct well_softc *sc = arg1;
+	char spec[WELL_CHAIN_SPEC_LEN], *p, *name;
+	u_int mask;
+	int err, i;
+
+	mtx_lock(&sc->sc_pipe_mutex);
+	mask = sc->sc_chain_mask;
+	mtx_unlock(&sc->sc_pipe_mutex);
+	spec[0] = '\0';
+	for (i = 0; i < WELL_STAGE_N; i++)
+		if (mask & (1 << i)) {
+			if (spec[0] != '\0')
+				strlcat(spec, " ", sizeof(spec));
+			strlcat(spec, well_stages[i].name, sizeof(spec));
+		}
+	err = sysctl_handle_string(oidp, spec, sizeof(spec), req);
+	if (err != 0 || req->newptr == NULL)
+		return (err);
+
+	p = spec;
+	mask = 0;
+	while ((name = strsep(&p, " \t\n")) != NULL) {
+		if (*name == '\0')
+			continue;
+		for (i = 0; i < WELL_STAGE_N; i++)
+			if (strcmp(name, well_stages[i].name) == 0)
+				break;
+		if (i == WELL_STAGE_N)
+			return (EINVAL);
+		mask |= 1 << i;
+	}
+
+	mtx_lock(&sc->sc_pipe_mutex);
+	well_chain_build(sc, mask);
+	mtx_unlock(&sc->sc_pipe_mutex);
+	return (0);
+}
+
+/* Drain the frames and button events queued by the USB callbacks.
+ * The pipeline has its own mutex, so the callbacks never wait for it;
+ * readers wait for at most one frame.
+ */
+static void
+well_frame_task(void *arg, int pending)
+{
+	struct well_softc *sc = arg;
+	u_int head;
+
+	head = sc->sc_fq_head;
+	while (head != atomic_load_acq_int(&sc->sc_fq_tail)) {
+		well_process_frame(sc, &sc->sc_fq[head & (WELL_FQ_LEN - 1)]);
+		atomic_store_rel_int(&sc->sc_fq_head, ++head);
+	}
+
+	/* Button events with no frame after them. */
+	mtx_lock(&sc->sc_pipe_mutex);
+	well_button_drain(sc);
+	well_ring_wakeup(sc);
+	mtx_unlock(&sc->sc_pipe_mutex);
+}
+
+static void
+well_trackpad_intr(struct usb_xfer *xfer, usb_error_t error)
+{
+	struct well_softc *sc = usbd_xfer_softc(xfer);
+	struct usb_page_cache *pc;
+	struct well_raw *raw;
+	u_int delay, tail, tries;
+	int action, len, queued = 0;
+	WELL_PROF_DECL(t);
+#ifdef WELL_PROFILE
+	uint64_t t0 = well_cycles(); /* the transfer completed */
+	int xferred = USB_GET_STATE(xfer) == USB_ST_TRANSFERRED;
+#endif
+
+	usbd_xfer_status(xfer, &len, NULL, NULL, NULL);
+
+	switch (USB_GET_STATE(xfer)) {
+	case USB_ST_TRANSFERRED:
+	        WELL_DEBUG("transfer complete\n");
+		WELL_TRACE(xfer, done, sc, len, 0);
+
+		if (len > sc->sc_params->trackpad_datalen) {
+		        WELL_WARN(
+			    "truncating large packet from %u to %u bytes\n",
+			    len, sc->sc_params->trackpad_datalen);
+		}
+		if ((len = well_frame_len(sc->sc_params, len)) < 0) {
+			sc->sc_recover.errs++;
+		        WELL_WARN("received short packet, ignoring\n");
+			goto tr_setup;
+		}
+
+#ifdef USB_DEBUG
+		if (well_inject_errs > 0) {
+			well_inject_errs--;
+			sc->sc_recover.errs++;
+			usbd_xfer_set_stall(xfer);
+			goto tr_setup;
+		}
+#endif
+
+		if ((tries = well_recover_good(&sc->sc_recover)) != 0)
+			WELL_INFO("recovered after %u attempts\n", tries);
+
+		/* Only grab the frame here; the frame task does the
+		 * rest once the pipe has been resubmitted.
+		 */
+		tail = sc->sc_fq_tail;
+		if (tail - atomic_load_acq_int(&sc->sc_fq_head) ==
+		    WELL_FQ_LEN) {
+			sc->sc_fq_drops++;
+			goto tr_setup;
+		}
+		WELL_PROF_START(t);
+		raw = &sc->sc_fq[tail & (WELL_FQ_LEN - 1)];
+		getmicrouptime(&raw->time);
+		raw->len = len;
+		pc = usbd_xfer_get_frame(xfer, 0);
+		usbd_copy_out(pc, 0, raw->data, len);
+		WELL_PROF_END(sc, WELL_PROF_COPY, t);
+#ifdef WELL_PROFILE
+		if (well_prof_inline) {
+			/* The slot is not handed over, so it is reused.
+			 * This waits for the pipeline mutex, as the
+			 * callback did before the frame task.
+			 */
+			well_process_frame(sc, raw);
+			if (well_polled(sc))
+				break;
+			goto tr_setup;
+		}
+#endif
+		atomic_store_rel_int(&sc->sc_fq_tail, tail + 1);
+		queued = 1;
+
+	  // FALLTHROUGH
+	case USB_ST_SETUP:
+	tr_setup:
+                WELL_DEBUG("setting up transfer\n");
+		/* After too many errors, leave the pipe idle; recovery
+		 * restarts it.
+		 */
+		action = well_recover_setup(&sc->sc_recover,
+		    &well_recover_cfg, &delay);
+		if (!well_recover_act(sc, action, delay))
+			break;
+		/* While polled, the frame task decides when to poll. */
+		if (queued && well_polled(sc))
+			break;
+		WELL_PROF_START(t);
+		usbd_xfer_set_frame_len(xfer, 0,
+		    sc->sc_params->trackpad_datalen);
+		usbd_transfer_submit(xfer);
+		WELL_PROF_END(sc, WELL_PROF_SUBMIT, t);
+#ifdef WELL_PROFILE
+		if (xferred)
+			WELL_PROF_END(sc, WELL_PROF_RESUBMIT, t0);
+#endif
+		break;
+
+	default:                        /* Error */
+	  WELL_DEBUG("error interrupt (%s)\n", usbd_errstr(error));
+		if (error != USB_ERR_CANCELLED) {
+			sc->sc_recover.errs++;
+			WELL_TRACE(xfer, error, sc, error,
+			    sc->sc_recover.errs);
+			/* try clear stall first */
+			usbd_xfer_set_stall(xfer);
+			goto tr_setup;
+		}
+		break;
+	}
+
+	if (queued)
+		taskqueue_enqueue(sc->sc_tq, &sc->sc_frame_task);
+#ifdef WELL_PROFILE
+	if (xferred)
+		WELL_PROF_END(sc, WELL_PROF_HOLD, t0);
+#endif
+}
+
+void
+well_reset_callback(struct usb_xfer *xfer, usb_error_t error)
+{
+
+	usb_device_request_t req;
+	struct usb_page_cache *pc;
+	struct well_softc *sc = usbd_xfer_softc(xfer);
+	u_int delay;
+	int action;
+
+	WELL_DEBUG("reset message received\n");
+
+	switch (USB_GET_STATE(xfer)) {
+	case USB_ST_SETUP:
+		sc->sc_mode_bytes[0] = RAW_SENSOR_MODE;
+		req.bmRequestType = UT_WRITE_CLASS_INTERFACE;
+		req.bRequest = UR_SET_REPORT;
+		USETW2(req.wValue,
+		    (uint8_t)0x03 /* type */, (uint8_t)0x00 /* id */);
+		USETW(req.wIndex, 0);
+		USETW(req.wLength, WELL_MODE_LENGTH);
+
+		pc = usbd_xfer_get_frame(xfer, 0);
+		usbd_copy_in(pc, 0, &req, sizeof(req));
+		pc = usbd_xfer_get_frame(xfer, 1);
+		usbd_copy_in(pc, 0, sc->sc_mode_bytes, WELL_MODE_LENGTH);
+
+		usbd_xfer_set_frame_len(xfer, 0, sizeof(req));
+		usbd_xfer_set_frame_len(xfer, 1, WELL_MODE_LENGTH);
+		usbd_xfer_set_frames(xfer, 2);
+		usbd_transfer_submit(xfer);
+		break;
+	case USB_ST_TRANSFERRED:
+		if (well_recover_reset(&sc->sc_recover, 1, &well_recover_cfg,
+		    &delay) == WELL_RECOVER_GO) {
+			/* Mode is back, resubmit the trackpad pipe. */
+			usbd_transfer_start(sc->sc_xfer[WELL_INTR_TRACKPAD]);
+		} else if (well_polled(sc)) {
+			/* Idle poll: fetch one frame. */
+			usbd_transfer_start(sc->sc_xfer[WELL_INTR_TRACKPAD]);
+		}
+		break;
+	default:
+		WELL_DEBUG("reset failed (%s)\n", usbd_errstr(error));
+		if (error != USB_ERR_CANCELLED) {
+			action = well_recover_reset(&sc->sc_recover, 0,
+			    &well_recover_cfg, &delay);
+			well_recover_act(sc, action, delay);
+		}
+		break;
+	}
+
+}
+
+#ifdef WELL_BENCH
+/* In-kernel microbenchmark of the per-frame path, built with
+ * "options WELL_BENCH".  Reading hw.usb.well.bench runs each stage on
+ * synthetic frames for every model and finger count on a scratch
+ * softc, and reports one line per model, finger count and stage:
+ *
+ *   model fingers stage p50_ns p99_ns
+ *
+ * Each sample is the mean over WELL_BENCH_BATCH calls, so the timer
+ * overhead stays out of the numbers.  None of the stages allocate.
+ */
+#define WELL_BENCH_SAMPLES 64
+#define WELL_BENCH_BATCH 32
+
+enum {
+	WELL_BENCH_FILTER,
+	WELL_BENCH_DECODE,
+	WELL_BENCH_GESTURE,
+	WELL_BENCH_TRACK,
+	WELL_BENCH_PUT,
+	WELL_BENCH_ENCODE,
+	WELL_BENCH_ZONE,
+	WELL_BENCH_CHAIN,  /* the whole frame chain, as configured */
+	WELL_BENCH_N
+};
+
+static const char *well_bench_names[WELL_BENCH_N] = {
+	[WELL_BENCH_FILTER]  = "filter",
+	[WELL_BENCH_DECODE]  = "decode",
+	[WELL_BENCH_GESTURE] = "gesture",
+	[WELL_BENCH_TRACK]   = "track",
+	[WELL_BENCH_PUT]     = "put",
+	[WELL_BENCH_ENCODE]  = "encode",
+	[WELL_BENCH_ZONE]    = "zone",
+	[WELL_BENCH_CHAIN]   = "chain",
+};
+
+/* A layout with as many zones as a specification can hold. */
+static const char well_bench_zones[] =
+    "right:500,800,1000,1000 middle:400,800,600,1000 vscroll:920,0,1000,800 "
+    "right:0,0,100,100 middle:100,0,200,100 vscroll:200,0,300,100 "
+    "right:300,0,400,100 middle:400,0,500,100 vscroll:500,0,600,100 "
+    "right:600,0,700,100 middle:700,0,800,100 vscroll:800,0,900,100 "
+    "right:0,300,150,450 middle:150,300,300,450 vscroll:300,300,450,450 "
+    "right:450,300,600,450";
+
+/* Build frame number "seq" with "n" fingers spread over the sensor. */
+static int
+well_bench_frame(const struct well_dev_params *params, u_int n, u_int seq,
+    uint8_t *data)
+{
+	uint8_t *rec;
+	u_int i;
+
+	memset(data, 0, params->finger_offset + n * WELL_FINGER_SIZE);
+	for (i = 0; i < n; i++) {
+		rec = data + params->finger_offset + i * WELL_FINGER_SIZE;
+		le16enc(rec + 2 * WELL_FINGER_ABS_X, params->x_calib.min +
+		    (seq * 7 + i * 311) %
+		    (params->x_calib.max - params->x_calib.min));
+		le16enc(rec + 2 * WELL_FINGER_ABS_Y, params->y_calib.min +
+		    (seq * 5 + i * 197) %
+		    (params->y_calib.max - params->y_calib.min));
+		le16enc(rec + 2 * WELL_FINGER_TOUCH_MAJOR, 400 + i);
+		le16enc(rec + 2 * WELL_FINGER_TOUCH_MINOR, 300 + i);
+	}
+	return (params->finger_offset + n * WELL_FINGER_SIZE);
+}
+
+/* Time one stage, leaving sorted per-call samples in "ns".  The
+ * filter and the chain alternate between two frames "raw", so that
+ * no frame is a repeat and the whole chain runs.
+ */
+static void
+well_bench_stage(struct well_softc *sc, int stage, u_int n,
+    struct well_raw *raw, u_int *ns)
+{
+	struct well_reader rd;
+	struct timespec t0, t1;
+	uint8_t buf[MOUSE_SYS_PACKETSIZE];
+	u_int i, j, k, seq, tmp;
+	u_int f;
+
+	memset(&rd, 0, sizeof(rd));
+	rd.rd_sc = sc;
+	well_reader_set_level(&rd, 1);
+	for (i = 0; i < 2; i++)
+		raw[i].len = well_bench_frame(sc->sc_params, n, i,
+		    raw[i].data);
+	well_decode_frame(sc->sc_params, raw[0].data, raw[0].len,
+	    &sc->sc_frame);
+
+	for (seq = 0, i = 0; i < WELL_BENCH_SAMPLES; i++) {
+		nanouptime(&t0);
+		for (j = 0; j < WELL_BENCH_BATCH; j++, seq++) {
+			switch (stage) {
+			case WELL_BENCH_FILTER:
+				well_frame_idle(sc, raw[seq & 1].data,
+				    raw[seq & 1].len);
+				break;
+			case WELL_BENCH_DECODE:
+				well_decode_frame(sc->sc_params, raw[0].data,
+				    raw[0].len, &sc->sc_frame);
+				break;
+			case WELL_BENCH_GESTURE:
+				well_gesture_frame(sc, &sc->sc_frame);
+				break;
+			case WELL_BENCH_TRACK:
+				sc->sc_frame.x[0] += (seq & 1) ? 3 : -3;
+				well_emit_frame(sc, &sc->sc_frame);
+				break;
+			case WELL_BENCH_PUT:
+				well_ring_put(sc, &sc->sc_frame.time, 1, -1,
+				    0, 0);
+				break;
+			case WELL_BENCH_ENCODE:
+				well_encode(&rd.rd_mode, rd.rd_predict,
+				    &sc->sc_events[seq & (WELL_RING_LEN - 1)],
+				    buf);
+				break;
+			case WELL_BENCH_ZONE:
+				for (f = 0; f < sc->sc_frame.nfingers; f++)
+					sc->sc_zone_track += well_zone(
+					    sc->sc_zones, sc->sc_frame.x[f],
+					    sc->sc_frame.y[f]);
+				break;
+			case WELL_BENCH_CHAIN:
+				well_chain_run(sc, &raw[seq & 1]);
+				break;
+			}
+		}
+		nanouptime(&t1);
+		ns[i] = ((t1.tv_sec - t0.tv_sec) * 1000000000 +
+		    (t1.tv_nsec - t0.tv_nsec)) / WELL_BENCH_BATCH;
+	}
+
+	for (i = 1; i < WELL_BENCH_SAMPLES; i++)
+		for (k = i; k > 0 && ns[k - 1] > ns[k]; k--) {
+			tmp = ns[k];
+			ns[k] = ns[k - 1];
+			ns[k - 1] = tmp;
+		}
+}
+
+static int
+well_sysctl_bench(SYSCTL_HANDLER_ARGS)
+{
+	struct well_softc *sc;
+	struct sbuf *sb;
+	struct well_raw *raw;
+	u_int ns[WELL_BENCH_SAMPLES];
+	u_int model, n;
+	int err, stage;
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 4096, req);
+	sc = malloc(sizeof(*sc), M_WELL, M_WAITOK | M_ZERO);
+	raw = malloc(2 * sizeof(*raw), M_WELL, M_WAITOK | M_ZERO);
+	mtx_init(&sc->sc_pipe_mutex, "wellbench", NULL, MTX_DEF);
+	callout_init_mtx(&sc->sc_kinetic_callout, &sc->sc_pipe_mutex, 0);
+	callout_init_mtx(&sc->sc_merge_callout, &sc->sc_pipe_mutex, 0);
+	well_chain_build(sc, WELL_STAGE_ALL);
+
+	for (model = 0; model < DEV_WELLSPRING_N; model++) {
+		sc->sc_params = &well_dev_params[model];
+		well_norm_init(&sc->sc_norm[WELL_AXIS_X],
+		    &sc->sc_params->x_calib);
+		well_norm_init(&sc->sc_norm[WELL_AXIS_Y],
+		    &sc->sc_params->y_calib);
+		free(sc->sc_zones, M_WELL);
+		well_zone_build(sc->sc_params, well_bench_zones,
+		    &sc->sc_zones);
+		for (n = 0; n <= WELL_MAX_FINGERS; n++)
+			for (stage = 0; stage < WELL_BENCH_N; stage++) {
+				mtx_lock(&sc->sc_pipe_mutex);
+				sc->sc_state = WELL_ENABLED;
+				well_accel_build(sc, 4);
+				well_bench_stage(sc, stage, n, raw, ns);
+				well_kinetic_stop(sc);
+				mtx_unlock(&sc->sc_pipe_mutex);
+				sbuf_printf(sb, "%s %u %s %u %u\n",
+				    sc->sc_params->name, n,
+				    well_bench_names[stage],
+				    ns[WELL_BENCH_SAMPLES / 2],
+				    ns[WELL_BENCH_SAMPLES * 99 / 100]);
+			}
+	}
+
+	callout_drain(&sc->sc_kinetic_callout);
+	callout_drain(&sc->sc_merge_callout);
+	mtx_destroy(&sc->sc_pipe_mutex);
+	free(sc->sc_zones, M_WELL);
+	free(raw, M_WELL);
+	free(sc, M_WELL);
+	err = sbuf_finish(sb);
+	sbuf_delete(sb);
+	return (err);
+}
+
+SYSCTL_PROC(_hw_usb_well, OID_AUTO, bench, CTLTYPE_STRING | CTLFLAG_RD,
+    NULL, 0, &well_sysctl_bench, "A", "Run the per-frame microbenchmark");
+
+/* Prediction replay.  A synthetic stroke with smooth reversals, one
+ * position every WELL_REPLAY_DT ms, goes through the predictor for a
+ * range of horizons.  Reading hw.usb.well.predict_replay reports, per
+ * horizon, the mean distance from the position reached "horizon" ms
+ * later of the plain position (the lag) and of the predicted one:
+ *
+ *   horizon_ms lag err
+ *
+ * both in hundredths of output units.
+ */
+#define WELL_REPLAY_FRAMES 512
+#define WELL_REPLAY_DT 8 /* ms */
+
+static const u_int well_replay_horizons[] = { 0, 8, 16, 24, 32, 48, 64 };
+
+/* Parabolic wave, changing direction every half period. */
+static int
+well_replay_pos(int n, int period, int amp)
+{
+	int half = period / 2;
+	int u = n % period;
+
+	if (u >= half)
+		return (-4 * amp * (u - half) * (period - u) / (half * half));
+	return (4 * amp * u * (half - u) / (half * half));
+}
+
+static int
+well_sysctl_predict_replay(SYSCTL_HANDLER_ARGS)
+{
+	struct well_pred pred;
+	struct timeval time;
+	struct sbuf *sb;
+	uint64_t lag, err;
+	u_int i, k, count;
+	int n, x, y, px, py, pdx, pdy, ret;
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 512, req);
+	memset(&pred, 0, sizeof(pred));
+
+	for (i = 0; i < nitems(well_replay_horizons); i++) {
+		k = well_replay_horizons[i] / WELL_REPLAY_DT;
+		lag = err = count = 0;
+		px = py = 0;
+		time.tv_sec = 0;
+		time.tv_usec = 0;
+		well_predict_reset(&pred, &time, &pdx, &pdy);
+		for (n = 1; n + k < WELL_REPLAY_FRAMES; n++) {
+			time.tv_sec = n * WELL_REPLAY_DT / 1000;
+			time.tv_usec = n * WELL_REPLAY_DT % 1000 * 1000;
+			x = well_replay_pos(n, 96, 400);
+			y = well_replay_pos(n, 160, 250);
+			well_predict(&pred, &time, well_replay_horizons[i],
+			    x - px, y - py, &pdx, &pdy);
+			px = x;
+			py = y;
+
+			/* Let the frame interval settle first. */
+			if (n < 8)
+				continue;
+			lag += abs(x - well_replay_pos(n + k, 96, 400)) +
+			    abs(y - well_replay_pos(n + k, 160, 250));
+			err += abs(x + pred.ox -
+			    well_replay_pos(n + k, 96, 400)) +
+			    abs(y + pred.oy -
+			    well_replay_pos(n + k, 160, 250));
+			count++;
+		}
+		sbuf_printf(sb, "%u %ju %ju\n", well_replay_horizons[i],
+		    (uintmax_t)(lag * 100 / count),
+		    (uintmax_t)(err * 100 / count));
+	}
+
+	ret = sbuf_finish(sb);
+	sbuf_delete(sb);
+	return (ret);
+}
+
+SYSCTL_PROC(_hw_usb_well, OID_AUTO, predict_replay,
+    CTLTYPE_STRING | CTLFLAG_RD, NULL, 0, &well_sysctl_predict_replay, "A",
+    "Report pointer prediction error against horizon");
+
+/* Worst-case search over the frame path.  Reading hw.usb.well.fuzz
+ * feeds each model fuzz_iters frames, random or mutated from the
+ * slowest found so far, through the length checks of the USB callback
+ * and well_process_frame(), on a scratch softc.  Each frame is timed
+ * alone, and the search follows time rather than coverage: the
+ * WELL_FUZZ_KEEP slowest inputs are kept as the corpus to mutate.
+ * One line per model,
+ *
+ *   model max_ns over_budget
+ *
+ * then the corpus, slowest first, as "ns len hexbytes".  Frames that
+ * take longer than fuzz_budget ns count as over budget.  A run is
+ * reproducible from fuzz_seed.
+ */
+#define WELL_FUZZ_KEEP 4
+#define WELL_FUZZ_DATALEN \
+	(WELL_TYPE_2_OFFSET + WELL_FINGER_DATALEN + WELL_FINGER_SIZE)
+
+static u_int well_fuzz_iters = 4096;
+static u_int well_fuzz_budget = 50000; /* ns */
+static u_int well_fuzz_seed = 1;
+SYSCTL_UINT(_hw_usb_well, OID_AUTO, fuzz_iters, CTLFLAG_RW,
+    &well_fuzz_iters, 0, "Frames tried per model by the fuzzer");
+SYSCTL_UINT(_hw_usb_well, OID_AUTO, fuzz_budget, CTLFLAG_RW,
+    &well_fuzz_budget, 0, "Frame processing time budget (ns)");
+SYSCTL_UINT(_hw_usb_well, OID_AUTO, fuzz_seed, CTLFLAG_RW,
+    &well_fuzz_seed, 0, "Seed of the fuzzer");
+
+struct well_fuzz_input {
+	u_int   ns;
+	int     len;
+	uint8_t data[WELL_FUZZ_DATALEN];
+};
+
+struct well_fuzz {
+	struct well_fuzz_input keep[WELL_FUZZ_KEEP]; /* slowest first */
+	u_int                  nkeep;
+	struct well_fuzz_input cand;
+	struct well_raw        raw;
+	uint32_t               rand;
+};
+
+static uint32_t
+well_fuzz_rand(struct well_fuzz *fz)
+{
+	fz->rand ^= fz->rand << 13;
+	fz->rand ^= fz->rand >> 17;
+	fz->rand ^= fz->rand << 5;
+	return (fz->rand);
+}
+
+/* A length: mostly whole finger records, up to one too many, and
+ * sometimes anything up to oversize.
+ */
+static int
+well_fuzz_len(const struct well_dev_params *params, struct well_fuzz *fz)
+{
+	if (well_fuzz_rand(fz) % 4 == 0)
+		return (well_fuzz_rand(fz) % (WELL_FUZZ_DATALEN + 1));
+	return (imin(params->finger_offset + well_fuzz_rand(fz) %
+	    (WELL_MAX_FINGERS + 2) * WELL_FINGER_SIZE, WELL_FUZZ_DATALEN));
+}
+
+/* Build the next candidate: random bytes a quarter of the time, else
+ * a few mutations of a corpus entry.
+ */
+static void
+well_fuzz_next(const struct well_dev_params *params, struct well_fuzz *fz)
+{
+	static const uint8_t special[] = { 0x00, 0x01, 0x7f, 0x80, 0xff };
+	struct well_fuzz_input *in = &fz->cand;
+	u_int i, n, a, b;
+
+	if (fz->nkeep == 0 || well_fuzz_rand(fz) % 4 == 0) {
+		in->len = well_fuzz_len(params, fz);
+		for (i = 0; i < WELL_FUZZ_DATALEN; i++)
+			in->data[i] = well_fuzz_rand(fz);
+		return;
+	}
+
+	*in = fz->keep[well_fuzz_rand(fz) % fz->nkeep];
+	n = 1 + well_fuzz_rand(fz) % 8;
+	for (i = 0; i < n; i++) {
+		a = well_fuzz_rand(fz) % WELL_FUZZ_DATALEN;
+		switch (well_fuzz_rand(fz) % 4) {
+		case 0:
+			in->data[a] ^= 1 << (well_fuzz_rand(fz) % 8);
+			break;
+		case 1:
+			in->data[a] = special[well_fuzz_rand(fz) %
+			    nitems(special)];
+			break;
+		case 2:
+			in->len = well_fuzz_len(params, fz);
+			break;
+		case 3:
+			/* Copy a finger record over another. */
+			a = well_fuzz_rand(fz) % WELL_MAX_FINGERS;
+			b = well_fuzz_rand(fz) % WELL_MAX_FINGERS;
+			memcpy(in->data + params->finger_offset +
+			    a * WELL_FINGER_SIZE, in->data +
+			    params->finger_offset + b * WELL_FINGER_SIZE,
+			    WELL_FINGER_SIZE);
+			break;
+		}
+	}
+}
+
+/* Run the candidate the way the callback and the frame task would,
+ * and return the time it took.
+ */
+static u_int
+well_fuzz_run(struct well_softc *sc, struct well_fuzz *fz)
+{
+	struct timespec t0, t1;
+	int len;
+
+	/* Keep the pad from going idle, which would restart the pipe. */
+	sc->sc_touch_ticks = ticks;
+	nanouptime(&t0);
+	len = well_frame_len(sc->sc_params, fz->cand.len);
+	if (len >= 0) {
+		getmicrouptime(&fz->raw.time);
+		fz->raw.len = len;
+		memcpy(fz->raw.data, fz->cand.data, len);
+		well_process_frame(sc, &fz->raw);
+	}
+	nanouptime(&t1);
+	return ((t1.tv_sec - t0.tv_sec) * 1000000000 +
+	    (t1.tv_nsec - t0.tv_nsec));
+}
+
+/* Keep the candidate if it is among the slowest. */
+static void
+well_fuzz_keep(struct well_fuzz *fz, u_int ns)
+{
+	u_int i;
+
+	if (fz->nkeep == WELL_FUZZ_KEEP && ns <= fz->keep[fz->nkeep - 1].ns)
+		return;
+	if (fz->nkeep < WELL_FUZZ_KEEP)
+		fz->nkeep++;
+	for (i = fz->nkeep - 1; i > 0 && fz->keep[i - 1].ns < ns; i--)
+		fz->keep[i] = fz->keep[i - 1];
+	fz->keep[i] = fz->cand;
+	fz->keep[i].ns = ns;
+}
+
+static int
+well_sysctl_fuzz(SYSCTL_HANDLER_ARGS)
+{
+	struct well_softc *sc;
+	struct well_fuzz *fz;
+	struct sbuf *sb;
+	u_int model, iter, i, ns, max_ns, over;
+	int err, k;
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 4096, req);
+	fz = malloc(sizeof(*fz), M_WELL, M_WAITOK | M_ZERO);
+	fz->rand = well_fuzz_seed != 0 ? well_fuzz_seed : 1;
+
+	for (model = 0; model < DEV_WELLSPRING_N; model++) {
+		sc = malloc(sizeof(*sc), M_WELL, M_WAITOK | M_ZERO);
+		mtx_init(&sc->sc_mutex, "wellfuzz", NULL,
+		    MTX_DEF | MTX_RECURSE);
+		mtx_init(&sc->sc_pipe_mutex, "wellfuzzpipe", NULL, MTX_DEF);
+		callout_init_mtx(&sc->sc_merge_callout, &sc->sc_pipe_mutex,
+		    0);
+		callout_init_mtx(&sc->sc_kinetic_callout, &sc->sc_pipe_mutex,
+		    0);
+		callout_init_mtx(&sc->sc_suspend_callout, &sc->sc_mutex, 0);
+		sc->sc_params = &well_dev_params[model];
+		well_norm_init(&sc->sc_norm[WELL_AXIS_X],
+		    &sc->sc_params->x_calib);
+		well_norm_init(&sc->sc_norm[WELL_AXIS_Y],
+		    &sc->sc_params->y_calib);
+		well_zone_build(sc->sc_params, well_bench_zones,
+		    &sc->sc_zones);
+		sc->sc_geom_sx = 1 << 8;
+		sc->sc_geom_sy = 1 << 8;
+		sc->sc_state = WELL_ENABLED;
+		mtx_lock(&sc->sc_pipe_mutex);
+		well_accel_build(sc, 4);
+		well_chain_build(sc, WELL_STAGE_ALL);
+		mtx_unlock(&sc->sc_pipe_mutex);
+
+		fz->nkeep = 0;
+		max_ns = over = 0;
+		for (iter = 0; iter < well_fuzz_iters; iter++) {
+			well_fuzz_next(sc->sc_params, fz);
+			ns = well_fuzz_run(sc, fz);
+			max_ns = MAX(max_ns, ns);
+			if (ns > well_fuzz_budget)
+				over++;
+			well_fuzz_keep(fz, ns);
+		}
+
+		sbuf_printf(sb, "%s %u %u\n", sc->sc_params->name, max_ns,
+		    over);
+		for (i = 0; i < fz->nkeep; i++) {
+			sbuf_printf(sb, "  %u %d ", fz->keep[i].ns,
+			    fz->keep[i].len);
+			for (k = 0; k < fz->keep[i].len; k++)
+				sbuf_printf(sb, "%02x", fz->keep[i].data[k]);
+			sbuf_printf(sb, "\n");
+		}
+
+		mtx_lock(&sc->sc_mutex);
+		callout_stop(&sc->sc_suspend_callout);
+		mtx_lock(&sc->sc_pipe_mutex);
+		well_kinetic_stop(sc);
+		callout_stop(&sc->sc_merge_callout);
+		mtx_unlock(&sc->sc_pipe_mutex);
+		mtx_unlock(&sc->sc_mutex);
+		callout_drain(&sc->sc_merge_callout);
+		callout_drain(&sc->sc_kinetic_callout);
+		callout_drain(&sc->sc_suspend_callout);
+		mtx_destroy(&sc->sc_pipe_mutex);
+		mtx_destroy(&sc->sc_mutex);
+		free(sc->sc_zones, M_WELL);
+		free(sc, M_WELL);
+	}
+
+	free(fz, M_WELL);
+	err = sbuf_finish(sb);
+	sbuf_delete(sb);
+	return (err);
+}
+
+SYSCTL_PROC(_hw_usb_well, OID_AUTO, fuzz, CTLTYPE_STRING | CTLFLAG_RD,
+    NULL, 0, &well_sysctl_fuzz, "A",
+    "Search for the slowest frames to process");
+#endif /* WELL_BENCH */
+
 
 static int
 well_probe(device_t self)
@@ -864,48 +2942,104 @@ well_probe(device_t self)
 #include <sys/condvar.h>
 #include <dev/usb/usb_device.h>
 
+/* Microseconds elapsed since "start". */
+static u_int
+well_elapsed_usec(const struct timeval *start)
+{
+	struct timeval now;
+
+	microuptime(&now);
+	timevalsub(&now, start);
+	return (now.tv_sec * 1000000 + now.tv_usec);
+}
+
+/* The slow, purely informational part of attach: dump the endpoint
+ * descriptors and query the initial device mode.  This runs from the
+ * driver's taskqueue so that it does not hold up boot or hot-plug.
+ */
+static void
+well_attach_task(void *arg, int pending)
+{
+	struct well_softc *sc = arg;
+	struct usb_endpoint *ep;
+	uint8_t mode[WELL_MODE_LENGTH];
+	usb_error_t err;
+
+	WELL_DEBUG("%d endpoints:\n", sc->sc_usb_device->endpoints_max);
+	for(unsigned int i = 0; i < sc->sc_usb_device->endpoints_max; i++) {
+	        ep = sc->sc_usb_device->endpoints + i;
+		if (ep->edesc == NULL)
+			continue;
+
+		WELL_DEBUG("endpoint %u: address %x, attributes %x, "
+			   "max packet %u, interval %u, interface %u\n", i,
+			   ep->edesc->bEndpointAddress,
+			   ep->edesc->bmAttributes,
+			   UGETW(ep->edesc->wMaxPacketSize),
+			   ep->edesc->bInterval, ep->iface_index);
+	}
+
+	/* This request must not interleave with a reader's mode switch,
+	 * and once a reader has switched, the initial mode is moot.  An
+	 * open or close during the request leaves the mode to it, as to
+	 * any switch in flight, so bring the mode in line after.
+	 */
+	mtx_lock(&sc->sc_mutex);
+	if (sc->sc_state & (WELL_MODE_BUSY | WELL_GONE)) {
+		mtx_unlock(&sc->sc_mutex);
+		WELL_INFO("initial device mode set by a reader\n");
+		goto done;
+	}
+	sc->sc_state |= WELL_MODE_BUSY;
+	err = well_req_get_report(sc->sc_usb_device, &sc->sc_mutex, mode);
+	sc->sc_state &= ~WELL_MODE_BUSY;
+	well_sync_mode(sc);
+	mtx_unlock(&sc->sc_mutex);
+	if (err != USB_ERR_NORMAL_COMPLETION) {
+		WELL_WARN("failed to read initial device mode (%s)\n",
+			  usbd_errstr(err));
+	} else {
+		WELL_INFO("initial device mode is %x\n", mode[0]);
+	}
+
+done:
+	sc->sc_deferred_usec = well_elapsed_usec(&sc->sc_attach_start);
+	WELL_INFO("deferred attach done after %u us\n",
+		  sc->sc_deferred_usec);
+}
+
 static int
 well_attach(device_t dev)
 {
 	struct well_softc      *sc = device_get_softc(dev);
 	struct usb_attach_arg *uaa = device_get_ivars(dev);
+	struct usb_config_descriptor *cd;
 	usb_error_t            err;
 
+	microuptime(&sc->sc_attach_start);
 	WELL_INFO("attaching...\n");
 	sc->sc_dev        = dev;
 	sc->sc_usb_device = uaa->device;
+	cd = usbd_get_config_descriptor(uaa->device);
+	sc->sc_remote_wakeup = cd != NULL &&
+	    (cd->bmAttributes & UC_REMOTE_WAKEUP) != 0;
 
 	mtx_init(&sc->sc_mutex, "wellmtx", NULL, MTX_DEF | MTX_RECURSE);
-
-	WELL_DEBUG("%d endpoints:\n", sc->sc_usb_device->endpoints_max);
-	for(unsigned int i = 0; i < sc->sc_usb_device->endpoints_max; i++) {
-	        struct usb_endpoint *ep = sc->sc_usb_device->endpoints + i;
-
-		WELL_DEBUG("endpoint %d bLength: %u\n", i, ep->edesc->bLength);
-		WELL_DEBUG("endpoint %d bDescriptorType: %u\n", i, ep->edesc->bDescriptorType);
-		WELL_DEBUG("endpoint %d bEndpointAddress: %x\n", i, ep->edesc->bEndpointAddress);
-		WELL_DEBUG("endpoint %d bmAttributes: %x\n", i, ep->edesc->bmAttributes);
-		WELL_DEBUG("endpoint %d wMaxPacketSize: %u\n", i, ep->edesc->wMaxPacketSize);
-		WELL_DEBUG("endpoint %d bInterval: %u\n", i, ep->edesc->bInterval);
-		WELL_DEBUG("endpoint %d unused: %x\n", i, ep->unused);
-		WELL_DEBUG("endpoint %d methods: %x\n", i, ep->methods);
-		WELL_DEBUG("endpoint %d iface_index: %x\n", i, ep->iface_index);
-		WELL_DEBUG("endpoint %d usb_smask: %x\n", i, ep->usb_smask);
-		WELL_DEBUG("endpoint %d usb_cmask: %x\n", i, ep->usb_cmask);
-		WELL_DEBUG("endpoint %d usb_uframe: %x\n", i, ep->usb_uframe);
-
-	}
-
-	//	WELL_DEBUG("usbd_get_endpoint(WELL_BUTTON_INTR) = %p\n",
-	//	   usbd_get_endpoint(sc->sc_usb_device, ));
-
-	if(err != 0) {
-	        WELL_ERROR("mode reset failed (%d)\n", err);
-		return err;
-	}
+	mtx_init(&sc->sc_pipe_mutex, "wellpipe", NULL, MTX_DEF);
+	callout_init_mtx(&sc->sc_recover_callout, &sc->sc_mutex, 0);
+	callout_init_mtx(&sc->sc_merge_callout, &sc->sc_pipe_mutex, 0);
+	callout_init_mtx(&sc->sc_kinetic_callout, &sc->sc_pipe_mutex, 0);
+	callout_init_mtx(&sc->sc_suspend_callout, &sc->sc_mutex, 0);
+	LIST_INIT(&sc->sc_paced);
+	well_chain_build(sc, WELL_STAGE_ALL);
+	TASK_INIT(&sc->sc_attach_task, 0, &well_attach_task, sc);
+	TASK_INIT(&sc->sc_frame_task, 0, &well_frame_task, sc);
+	sc->sc_tq = taskqueue_create("well_taskq", M_WAITOK,
+	    taskqueue_thread_enqueue, &sc->sc_tq);
+	taskqueue_start_threads(&sc->sc_tq, 1, PI_SOFT, "%s taskq",
+	    device_get_nameunit(dev));
 
 	/* Now setup the transfers */
-	WELL_DEBUG("initializing USB transfer\n");
 	err = usbd_transfer_setup(uaa->device,
 	    &uaa->info.bIfaceIndex, sc->sc_xfer, well_config,
 	    WELL_N_TRANSFER, sc, &sc->sc_mutex);
@@ -915,20 +3049,26 @@ well_attach(device_t dev)
 			   usbd_errstr(err));
 		goto detach;
 	}
-	WELL_INFO("initializing FIFO\n");
-
-	if (usb_fifo_attach(sc->sc_usb_device, sc, &sc->sc_mutex,
-		&well_fifo_methods, &sc->sc_fifo,
-		device_get_unit(dev), 0 - 1, uaa->info.bIfaceIndex,
-		UID_ROOT, GID_OPERATOR, 0644)) {
-		WELL_ERROR("cannot attach USB fifo: %s\n",
-			   usbd_errstr(err));
-		goto detach;
-	}
 
-	/* Now initialize the outbound interface */
+	/* Initialize the outbound interface before the device can be
+	 * opened.
+	 */
 	device_set_usb_desc(dev);
 	sc->sc_params = &well_dev_params[uaa->driver_info];
+	well_norm_init(&sc->sc_norm[WELL_AXIS_X], &sc->sc_params->x_calib);
+	well_norm_init(&sc->sc_norm[WELL_AXIS_Y], &sc->sc_params->y_calib);
+	well_norm_init(&sc->sc_norm[WELL_AXIS_PRESSURE],
+	    &sc->sc_params->press_calib);
+	well_norm_init(&sc->sc_norm[WELL_AXIS_WIDTH],
+	    &sc->sc_params->width_calib);
+	sc->sc_geom_sx = 1 << 8;
+	sc->sc_geom_sy = 1 << 8;
+	if (sc->sc_params->flags & INTEGRATED_BUTTON) {
+		strlcpy(sc->sc_zone_spec, WELL_ZONE_CLICKPAD,
+		    sizeof(sc->sc_zone_spec));
+		well_zone_build(sc->sc_params, sc->sc_zone_spec,
+		    &sc->sc_zones);
+	}
 	WELL_INFO("device version is %s\n", well_dev_params[uaa->driver_info].name);
 	sc->sc_hw.buttons       = 3;
 	sc->sc_hw.iftype        = MOUSE_IF_USB;
@@ -938,19 +3078,113 @@ well_attach(device_t dev)
 	sc->sc_mode.protocol    = MOUSE_PROTO_MSC;
 	sc->sc_mode.rate        = -1;
 	sc->sc_mode.resolution  = MOUSE_RES_UNKNOWN;
-	sc->sc_mode.accelfactor = 0;
+	well_accel_build(sc, 0);
 	sc->sc_mode.level       = 0;
 	sc->sc_mode.packetsize  = MOUSE_MSC_PACKETSIZE;
 	sc->sc_mode.syncmask[0] = MOUSE_MSC_SYNCMASK;
 	sc->sc_mode.syncmask[1] = MOUSE_MSC_SYNC;
 	sc->sc_state            = 0;
-	sc->sc_errs = 0;
-#if 0
-	sc->sc_left_margin  = atp_mickeys_scale_factor;
-	sc->sc_right_margin = (sc->sc_params->n_xsensors - 1) *
-		atp_mickeys_scale_factor;
-
+	memset(&sc->sc_recover, 0, sizeof(sc->sc_recover));
+	sc->sc_button_head      = 0;
+	sc->sc_button_count     = 0;
+	sc->sc_track.fingers    = 0;
+	sc->sc_touch_fingers    = 0;
+
+	sc->sc_cdev = make_dev(&well_cdevsw, device_get_unit(dev),
+	    UID_ROOT, GID_OPERATOR, 0644, "%s%d", WELL_DRIVER_NAME,
+	    device_get_unit(dev));
+	sc->sc_cdev->si_drv1 = sc;
+
+	SYSCTL_ADD_UINT(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "recover_state", CTLFLAG_RD, &sc->sc_recover.state, 0,
+	    "Error recovery state");
+	SYSCTL_ADD_UINT(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "recover_tries", CTLFLAG_RD, &sc->sc_recover.tries, 0,
+	    "Recovery attempts in the current episode");
+	SYSCTL_ADD_UINT(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "recover_total", CTLFLAG_RD, &sc->sc_recover.total, 0,
+	    "Recovery attempts since attach");
+	SYSCTL_ADD_UINT(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "attach_usec", CTLFLAG_RD, &sc->sc_attach_usec, 0,
+	    "Time spent in attach (us)");
+	SYSCTL_ADD_UINT(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "deferred_usec", CTLFLAG_RD, &sc->sc_deferred_usec, 0,
+	    "Time until deferred attach completed (us)");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "accel", CTLTYPE_INT | CTLFLAG_RW, sc, 0, &well_sysctl_accel,
+	    "I", "Pointer acceleration factor (0 disables)");
+	SYSCTL_ADD_UINT(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "readers", CTLFLAG_RD, &sc->sc_readers, 0,
+	    "Number of open readers");
+	SYSCTL_ADD_UINT(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "overruns", CTLFLAG_RD, &sc->sc_overruns, 0,
+	    "Events lost by slow readers");
+	SYSCTL_ADD_UINT(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "idle_skipped", CTLFLAG_RD, &sc->sc_filter.skipped, 0,
+	    "Repeated frames skipped without decoding");
+	SYSCTL_ADD_UINT(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "suspends", CTLFLAG_RD, &sc->sc_suspends, 0,
+	    "Idle periods spent suspended");
+	SYSCTL_ADD_INT(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "remote_wakeup", CTLFLAG_RD, &sc->sc_remote_wakeup, 0,
+	    "Pad wakes the host itself, and is not polled while idle");
+	SYSCTL_ADD_UINT(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "suspend_polls", CTLFLAG_RD, &sc->sc_suspend_polls, 0,
+	    "Wakeups of a suspended pad, polls or its own");
+	SYSCTL_ADD_UINT(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "resume_us", CTLFLAG_RD, &sc->sc_resume_us, 0,
+	    "Worst time from a wakeup to the touch that resumed (us)");
+	SYSCTL_ADD_UINT(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "frame_drops", CTLFLAG_RD, &sc->sc_fq_drops, 0,
+	    "Frames and button events dropped with the frame task behind");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "width_um", CTLTYPE_UINT | CTLFLAG_RW, sc, 0,
+	    &well_sysctl_size, "IU", "Pad width in micrometres, 0 if unknown");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "height_um", CTLTYPE_UINT | CTLFLAG_RW, sc, 1,
+	    &well_sysctl_size, "IU", "Pad height in micrometres, 0 if unknown");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "zones", CTLTYPE_STRING | CTLFLAG_RW, sc, 0,
+	    &well_sysctl_zones, "A",
+	    "Pad zones, as name:x0,y0,x1,y1 in thousandths from top left");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "chain", CTLTYPE_STRING | CTLFLAG_RW, sc, 0,
+	    &well_sysctl_chain, "A",
+	    "Frame stages: filter decode frames buttons gesture track");
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "click_latency", CTLTYPE_STRING | CTLFLAG_RW, sc, 0,
+	    &well_sysctl_click_latency, "A",
+	    "Button change to read latency, log2(us):count");
+#ifdef WELL_PROFILE
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+	    "profile", CTLTYPE_STRING | CTLFLAG_RW, sc, 0,
+	    &well_sysctl_prof, "A", "Cycles per stage; write to reset");
 #endif
+
+	taskqueue_enqueue(sc->sc_tq, &sc->sc_attach_task);
+
+	sc->sc_attach_usec = well_elapsed_usec(&sc->sc_attach_start);
+	WELL_INFO("attached in %u us\n", sc->sc_attach_usec);
 	return (0);
 
 detach:
@@ -958,22 +3192,60 @@ detach:
 	return (ENOMEM);
 }
 
+/* The USB stack resumed the device, after a remote wakeup or with the
+ * system.  An idle pad that woke itself may be back in HID mode: send
+ * raw mode again.  Polled pads get it from the poll.
+ */
+static int
+well_device_resume(device_t dev)
+{
+	struct well_softc *sc = device_get_softc(dev);
+
+	mtx_lock(&sc->sc_mutex);
+	if (sc->sc_remote_wakeup && (sc->sc_state &
+	    (WELL_ENABLED | WELL_SUSPENDED | WELL_GONE)) ==
+	    (WELL_ENABLED | WELL_SUSPENDED))
+		well_suspend_wake(sc);
+	mtx_unlock(&sc->sc_mutex);
+	return (0);
+}
 
 static int
 well_detach(device_t dev)
 {
 	struct well_softc *sc = device_get_softc(dev);
+	struct well_reader *rd;
 
 	WELL_INFO("detaching...\n");
 
-	if (sc->sc_state & WELL_ENABLED) {
-		mtx_lock(&sc->sc_mutex);
-		well_disable(sc);
-		mtx_unlock(&sc->sc_mutex);
+	/* Kick out sleeping readers; destroy_dev() then waits for them
+	 * and runs the destructors of any files still open.
+	 */
+	mtx_lock(&sc->sc_mutex);
+	sc->sc_state |= WELL_GONE;
+	mtx_lock(&sc->sc_pipe_mutex);
+	wakeup(&sc->sc_ring.head);
+	LIST_FOREACH(rd, &sc->sc_paced, rd_link) {
+		wakeup(&rd->rd_limit);
+		selwakeuppri(&rd->rd_rsel, PZERO);
 	}
-
-	usb_fifo_detach(&sc->sc_fifo);
+	mtx_unlock(&sc->sc_pipe_mutex);
+	mtx_unlock(&sc->sc_mutex);
+	if (sc->sc_cdev != NULL)
+		destroy_dev(sc->sc_cdev);
+	seldrain(&sc->sc_rsel);
+
+	if (sc->sc_tq != NULL)
+		taskqueue_drain(sc->sc_tq, &sc->sc_attach_task);
+	callout_drain(&sc->sc_recover_callout);
+	callout_drain(&sc->sc_merge_callout);
+	callout_drain(&sc->sc_kinetic_callout);
+	callout_drain(&sc->sc_suspend_callout);
 	usbd_transfer_unsetup(sc->sc_xfer, WELL_N_TRANSFER);
+	if (sc->sc_tq != NULL)
+		taskqueue_free(sc->sc_tq);
+	free(sc->sc_zones, M_WELL);
+	mtx_destroy(&sc->sc_pipe_mutex);
 	mtx_destroy(&sc->sc_mutex);
 	WELL_INFO("detached...\n");
 
@@ -985,6 +3257,7 @@ static device_method_t well_methods[] = {
 	DEVMETHOD(device_probe,  well_probe),
 	DEVMETHOD(device_attach, well_attach),
 	DEVMETHOD(device_detach, well_detach),
+	DEVMETHOD(device_resume, well_device_resume),
 	{ 0, 0 }
 };
 
@@ -0,0 +1,1252 @@
+/* Copyright (c) 2011 Eric McCorkle.  All rights reserved. */
+#include <sys/param.h>
+#ifdef _KERNEL
+#include <sys/systm.h>
+#else
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#endif
+#include <sys/endian.h>
+#include <sys/mouse.h>
+
+/* The kernel cannot touch the vector unit here without
+ * fpu_kern_enter(), so it always builds the scalar decoder.
+ */
+#if defined(__SSE2__) && !defined(_KERNEL)
+#include <emmintrin.h>
+#define WELL_HAVE_SSE2
+#endif
+
+#include "well_core.h"
+
+const struct well_dev_params well_dev_params[DEV_WELLSPRING_N] = {
+        [DEV_WELLSPRING] = {
+	        .flags = 0,
+		.name = "Wellspring",
+		.button_datalen = WELL_BUTTON_DATALEN,
+		.trackpad_datalen = WELL_TYPE_1_OFFSET +
+		        WELL_FINGER_DATALEN,
+		.finger_offset = WELL_TYPE_1_OFFSET,
+		.press_calib = {
+  	                .res = RES_PRESSURE,
+			.noise = NOISE_PRESSURE,
+			.min = 0,
+			.max = 256
+	        },
+		.width_calib = {
+  	                .res = RES_WIDTH,
+			.noise = NOISE_WIDTH,
+			.min = 0,
+			.max = 2048
+	        },
+		.x_calib = {
+  	                .res = RES_X,
+			.noise = NOISE_X,
+			.min = -4824,
+			.max = 5324
+	        },
+		.y_calib = {
+ 	                .res = RES_Y,
+			.noise = NOISE_X,
+			.min = -172,
+			.max = 5820
+	        }
+	},
+	[DEV_WELLSPRING2] = {
+	        .flags = 0,
+		.name = "Wellspring 2",
+		.button_datalen = WELL_BUTTON_DATALEN,
+		.trackpad_datalen = WELL_TYPE_1_OFFSET +
+		        WELL_FINGER_DATALEN,
+		.finger_offset = WELL_TYPE_1_OFFSET,
+		.press_calib = {
+  	                .res = RES_PRESSURE,
+			.noise = NOISE_PRESSURE,
+			.min = 0,
+			.max = 256
+	        },
+		.width_calib = {
+  	                .res = RES_WIDTH,
+			.noise = NOISE_WIDTH,
+			.min = 0,
+			.max = 2048
+	        },
+		.x_calib = {
+  	                .res = RES_X,
+			.noise = NOISE_X,
+			.min = -4824,
+			.max = 4824
+	        },
+		.y_calib = {
+ 	                .res = RES_Y,
+			.noise = NOISE_X,
+			.min = -172,
+			.max = 4290
+	        }
+	},
+	[DEV_WELLSPRING3] = {
+ 	        .flags = INTEGRATED_BUTTON,
+		.name = "Wellspring 3",
+		.button_datalen = WELL_BUTTON_DATALEN,
+		.trackpad_datalen = WELL_TYPE_2_OFFSET +
+		        WELL_FINGER_DATALEN,
+		.finger_offset = WELL_TYPE_2_OFFSET,
+		.press_calib = {
+  	                .res = RES_PRESSURE,
+			.noise = NOISE_PRESSURE,
+			.min = 0,
+			.max = 300
+	        },
+		.width_calib = {
+  	                .res = RES_WIDTH,
+			.noise = NOISE_WIDTH,
+			.min = 0,
+			.max = 2048
+	        },
+		.x_calib = {
+  	                .res = RES_X,
+			.noise = NOISE_X,
+			.min = -4460,
+			.max = 5166
+	        },
+		.y_calib = {
+ 	                .res = RES_Y,
+			.noise = NOISE_X,
+			.min = -75,
+			.max = 6700
+	        }
+	},
+	[DEV_WELLSPRING4] = {
+ 	        .flags = INTEGRATED_BUTTON,
+		.name = "Wellspring 4",
+		.button_datalen = WELL_BUTTON_DATALEN,
+		.trackpad_datalen = WELL_TYPE_2_OFFSET +
+		        WELL_FINGER_DATALEN,
+		.finger_offset = WELL_TYPE_2_OFFSET,
+		.press_calib = {
+  	                .res = RES_PRESSURE,
+			.noise = NOISE_PRESSURE,
+			.min = 0,
+			.max = 300
+	        },
+		.width_calib = {
+  	                .res = RES_WIDTH,
+			.noise = NOISE_WIDTH,
+			.min = 0,
+			.max = 2048
+	        },
+		.x_calib = {
+  	                .res = RES_X,
+			.noise = NOISE_X,
+			.min = -4620,
+			.max = 5140
+	        },
+		.y_calib = {
+ 	                .res = RES_Y,
+			.noise = NOISE_X,
+			.min = -150,
+			.max = 6600
+	        }
+	},
+	[DEV_WELLSPRING4a] = {
+ 	        .flags = INTEGRATED_BUTTON,
+		.name = "Wellspring 4a",
+		.button_datalen = WELL_BUTTON_DATALEN,
+		.trackpad_datalen = WELL_TYPE_2_OFFSET +
+		        WELL_FINGER_DATALEN,
+		.finger_offset = WELL_TYPE_2_OFFSET,
+		.press_calib = {
+  	                .res = RES_PRESSURE,
+			.noise = NOISE_PRESSURE,
+			.min = 0,
+			.max = 300
+	        },
+		.width_calib = {
+  	                .res = RES_WIDTH,
+			.noise = NOISE_WIDTH,
+			.min = 0,
+			.max = 2048
+	        },
+		.x_calib = {
+  	                .res = RES_X,
+			.noise = NOISE_X,
+			.min = -4616,
+			.max = 5112
+	        },
+		.y_calib = {
+ 	                .res = RES_Y,
+			.noise = NOISE_X,
+			.min = -142,
+			.max = 5234
+	        }
+	},
+	[DEV_WELLSPRING5] = {
+ 	        .flags = INTEGRATED_BUTTON,
+		.name = "Wellspring 5",
+		.button_datalen = WELL_BUTTON_DATALEN,
+		.trackpad_datalen = WELL_TYPE_2_OFFSET +
+		        WELL_FINGER_DATALEN,
+		.finger_offset = WELL_TYPE_2_OFFSET,
+		.press_calib = {
+  	                .res = RES_PRESSURE,
+			.noise = NOISE_PRESSURE,
+			.min = 0,
+			.max = 300
+	        },
+		.width_calib = {
+  	                .res = RES_WIDTH,
+			.noise = NOISE_WIDTH,
+			.min = 0,
+			.max = 2048
+	        },
+		.x_calib = {
+  	                .res = RES_X,
+			.noise = NOISE_X,
+			.min = -4415,
+			.max = 5050
+	        },
+		.y_calib = {
+ 	                .res = RES_Y,
+			.noise = NOISE_X,
+			.min = -55,
+			.max = 6680
+	        }
+	},
+	[DEV_WELLSPRING5a] = {
+ 	        .flags = INTEGRATED_BUTTON,
+		.name = "Wellspring 5a",
+		.button_datalen = WELL_BUTTON_DATALEN,
+		.trackpad_datalen = WELL_TYPE_2_OFFSET +
+		        WELL_FINGER_DATALEN,
+		.finger_offset = WELL_TYPE_2_OFFSET,
+		.press_calib = {
+  	                .res = RES_PRESSURE,
+			.noise = NOISE_PRESSURE,
+			.min = 0,
+			.max = 300
+	        },
+		.width_calib = {
+  	                .res = RES_WIDTH,
+			.noise = NOISE_WIDTH,
+			.min = 0,
+			.max = 2048
+	        },
+		.x_calib = {
+  	                .res = RES_X,
+			.noise = NOISE_X,
+			.min = -4750,
+			.max = 5280
+	        },
+		.y_calib = {
+ 	                .res = RES_Y,
+			.noise = NOISE_X,
+			.min = -150,
+			.max = 6730
+	        }
+	},
+	[DEV_WELLSPRING6] = {
+ 	        .flags = INTEGRATED_BUTTON,
+		.name = "Wellspring 6",
+		.button_datalen = WELL_BUTTON_DATALEN,
+		.trackpad_datalen = WELL_TYPE_2_OFFSET +
+		        WELL_FINGER_DATALEN,
+		.finger_offset = WELL_TYPE_2_OFFSET,
+		.press_calib = {
+  	                .res = RES_PRESSURE,
+			.noise = NOISE_PRESSURE,
+			.min = 0,
+			.max = 300
+	        },
+		.width_calib = {
+  	                .res = RES_WIDTH,
+			.noise = NOISE_WIDTH,
+			.min = 0,
+			.max = 2048
+	        },
+		.x_calib = {
+  	                .res = RES_X,
+			.noise = NOISE_X,
+			.min = -4620,
+			.max = 5140
+	        },
+		.y_calib = {
+ 	                .res = RES_Y,
+			.noise = NOISE_X,
+			.min = -150,
+			.max = 6600
+	        }
+	},
+	[DEV_WELLSPRING6a] = {
+ 	        .flags = INTEGRATED_BUTTON,
+		.name = "Wellspring 6a",
+		.button_datalen = WELL_BUTTON_DATALEN,
+		.trackpad_datalen = WELL_TYPE_2_OFFSET +
+		        WELL_FINGER_DATALEN,
+		.finger_offset = WELL_TYPE_2_OFFSET,
+		.press_calib = {
+  	                .res = RES_PRESSURE,
+			.noise = NOISE_PRESSURE,
+			.min = 0,
+			.max = 300
+	        },
+		.width_calib = {
+  	                .res = RES_WIDTH,
+			.noise = NOISE_WIDTH,
+			.min = 0,
+			.max = 2048
+	        },
+		.x_calib = {
+  	                .res = RES_X,
+			.noise = NOISE_X,
+			.min = -4620,
+			.max = 5140
+	        },
+		.y_calib = {
+ 	                .res = RES_Y,
+			.noise = NOISE_X,
+			.min = -150,
+			.max = 6600
+	        }
+	}
+};
+
+
+/* Model of a product, or -1 if it is not a supported pad. */
+int
+well_model(uint16_t vendor, uint16_t product)
+{
+#define WELL_MODEL(id, model) \
+	if (product == (id))  \
+		return (model);
+
+	if (vendor != WELL_VENDOR_APPLE)
+		return (-1);
+	WELL_PRODUCTS(WELL_MODEL)
+#undef WELL_MODEL
+	return (-1);
+}
+
+/* Check the length of a frame as received.  Oversize frames are
+ * truncated; frames carry a header plus one record per finger, and
+ * anything else is refused.  Returns the length to decode, or -1.
+ */
+int
+well_frame_len(const struct well_dev_params *params, int len)
+{
+	len = MIN(len, (int)params->trackpad_datalen);
+	if (len < (int)params->finger_offset ||
+	    (len - params->finger_offset) % WELL_FINGER_SIZE)
+		return (-1);
+	return (len);
+}
+
+#define WELL_FIELD(rec, field) \
+	((int16_t)le16dec((rec) + 2 * WELL_FINGER_ ## field))
+
+typedef void well_decode_fn(const uint8_t *rec, u_int n,
+    struct well_frame *frame);
+
+/* Copy finger record "rec" into entry "i" of the frame's arrays. */
+static __inline void
+well_decode_record(const uint8_t *rec, u_int i, struct well_frame *frame)
+{
+	frame->x[i]           = WELL_FIELD(rec, ABS_X);
+	frame->y[i]           = WELL_FIELD(rec, ABS_Y);
+	frame->touch_major[i] = WELL_FIELD(rec, TOUCH_MAJOR);
+	frame->touch_minor[i] = WELL_FIELD(rec, TOUCH_MINOR);
+	frame->tool_major[i]  = WELL_FIELD(rec, TOOL_MAJOR);
+	frame->tool_minor[i]  = WELL_FIELD(rec, TOOL_MINOR);
+	frame->orientation[i] = WELL_FIELD(rec, ORIENTATION);
+}
+
+/* Transpose "n" fixed-stride finger records into the frame's arrays,
+ * one record at a time.
+ */
+static void
+well_decode_scalar(const uint8_t *rec, u_int n, struct well_frame *frame)
+{
+	u_int i;
+
+	for (i = 0; i < n; i++, rec += WELL_FINGER_SIZE)
+		well_decode_record(rec, i, frame);
+}
+
+#ifdef WELL_HAVE_SSE2
+/* The same, four records at a time.  Fields 0-7 of four records are
+ * transposed in two rounds of unpacks into four vectors holding two
+ * fields of all four each; a second load at field 6 brings in the
+ * touch axes the same way.  Every load stays within its record, and
+ * the last n % 4 records go through the scalar path.  x86 is little
+ * endian, so the fields need no swapping.  Below WELL_SSE2_MIN
+ * records the unpacks cost more than they save, and the scalar path
+ * does it all.
+ */
+#define WELL_SSE2_MIN 8
+#define WELL_LOAD(rec, k, off)                       \
+	_mm_loadu_si128((const __m128i *)((rec) +    \
+	    (k) * WELL_FINGER_SIZE + (off)))
+#define WELL_STORE_LO(dst, v) _mm_storel_epi64((__m128i *)(dst), (v))
+#define WELL_STORE_HI(dst, v) WELL_STORE_LO(dst, _mm_srli_si128((v), 8))
+
+static void
+well_decode_sse2(const uint8_t *rec, u_int n, struct well_frame *frame)
+{
+	__m128i a, b, c, d, lo, hi, f01, f23, f45, f67, f89;
+	u_int i;
+
+	if (n < WELL_SSE2_MIN) {
+		well_decode_scalar(rec, n, frame);
+		return;
+	}
+
+	for (i = 0; i + 4 <= n; i += 4, rec += 4 * WELL_FINGER_SIZE) {
+		a = WELL_LOAD(rec, 0, 0);
+		b = WELL_LOAD(rec, 1, 0);
+		c = WELL_LOAD(rec, 2, 0);
+		d = WELL_LOAD(rec, 3, 0);
+		lo = _mm_unpacklo_epi16(a, b);
+		hi = _mm_unpackhi_epi16(a, b);
+		a = _mm_unpacklo_epi16(c, d);
+		b = _mm_unpackhi_epi16(c, d);
+		f01 = _mm_unpacklo_epi32(lo, a);
+		f23 = _mm_unpackhi_epi32(lo, a);
+		f45 = _mm_unpacklo_epi32(hi, b);
+		f67 = _mm_unpackhi_epi32(hi, b);
+
+		a = WELL_LOAD(rec, 0, 2 * WELL_FINGER_TOOL_MINOR);
+		b = WELL_LOAD(rec, 1, 2 * WELL_FINGER_TOOL_MINOR);
+		c = WELL_LOAD(rec, 2, 2 * WELL_FINGER_TOOL_MINOR);
+		d = WELL_LOAD(rec, 3, 2 * WELL_FINGER_TOOL_MINOR);
+		f89 = _mm_unpackhi_epi32(_mm_unpacklo_epi16(a, b),
+		    _mm_unpacklo_epi16(c, d));
+
+		WELL_STORE_HI(&frame->x[i], f01);
+		WELL_STORE_LO(&frame->y[i], f23);
+		WELL_STORE_HI(&frame->tool_major[i], f45);
+		WELL_STORE_LO(&frame->tool_minor[i], f67);
+		WELL_STORE_HI(&frame->orientation[i], f67);
+		WELL_STORE_LO(&frame->touch_major[i], f89);
+		WELL_STORE_HI(&frame->touch_minor[i], f89);
+	}
+	for (; i < n; i++, rec += WELL_FINGER_SIZE)
+		well_decode_record(rec, i, frame);
+}
+
+#undef WELL_LOAD
+#undef WELL_STORE_LO
+#undef WELL_STORE_HI
+
+static well_decode_fn *well_decode_fingers = &well_decode_sse2;
+#else
+#define well_decode_fingers well_decode_scalar
+#endif
+
+/* Pick the back end of the transpose, one of WELL_DECODE_*, for the
+ * host build to compare them.  Returns 0, or -1 if this build or CPU
+ * does not have it.  The best one is the default.
+ */
+int
+well_decode_select(int backend)
+{
+	switch (backend) {
+	case WELL_DECODE_SCALAR:
+#ifdef WELL_HAVE_SSE2
+		well_decode_fingers = &well_decode_scalar;
+#endif
+		return (0);
+#ifdef WELL_HAVE_SSE2
+	case WELL_DECODE_SSE2:
+		if (!__builtin_cpu_supports("sse2"))
+			return (-1);
+		well_decode_fingers = &well_decode_sse2;
+		return (0);
+#endif
+	}
+	return (-1);
+}
+
+/* Parse the header of a frame of "len" bytes, already checked to hold
+ * whole finger records.  Both families send one record per contact,
+ * so the count follows from the length; type 2 frames also carry the
+ * integrated button.  Returns the number of contacts.
+ */
+u_int
+well_decode_header(const struct well_dev_params *params,
+    const uint8_t *data, int len, uint8_t *button)
+{
+	*button = 0;
+	if (params->flags & INTEGRATED_BUTTON)
+		*button = data[WELL_TYPE_2_BUTTON];
+
+	return (MIN((len - params->finger_offset) / WELL_FINGER_SIZE,
+	    WELL_MAX_FINGERS));
+}
+
+/* Decode a trackpad frame of "len" bytes.  Only the active records
+ * are read, so an empty frame costs the header alone.  Fires
+ * frame:decoded.
+ */
+void
+well_decode_frame(const struct well_dev_params *params,
+    const uint8_t *data, int len, struct well_frame *frame)
+{
+	uint8_t button;
+
+	frame->nfingers = well_decode_header(params, data, len,
+	    &button);
+	frame->buttons = button ? MOUSE_BUTTON1DOWN : 0;
+	if (frame->nfingers > 0)
+		well_decode_fingers(data + params->finger_offset,
+		    frame->nfingers, frame);
+	WELL_TRACE(frame, decoded, params, frame, 0);
+}
+
+/* Precompute the normalization of one axis.  With d = max - min and
+ * n = (raw - min) * res < 2^N, choosing shift = N + ceil(log2(d)) and
+ * mul = res * ceil(2^shift / d) makes the multiply and shift equal to
+ * floor(n / d) for every raw value in range.
+ */
+void
+well_norm_init(struct well_norm *norm, const struct well_calib *calib)
+{
+	uint64_t m;
+	int d;
+
+	d = calib->max - calib->min;
+	norm->min = calib->min;
+	norm->max = calib->max;
+	norm->shift = fls(calib->res * d) + fls(d - 1);
+	m = ((1ULL << norm->shift) + d - 1) / d;
+	norm->mul = m * calib->res;
+}
+
+/* Contact geometry.  The device reports each contact as an ellipse
+ * whose axes are in sensor units and whose orientation is in
+ * 1/WELL_ORIENT_MAX of a quarter turn.  Sensor units are not square,
+ * so exporting the ellipse in physical units means scaling both axis
+ * vectors and diagonalizing again.  That takes a square root and an
+ * arctangent per contact, done here with fixed tables: the square
+ * root of a mantissa in [64, 256) (Q4) refined by one Newton step,
+ * and the arctangent and sine over a quarter turn, 256 steps each,
+ * interpolated linearly (angles in 1/100 degree, sines Q14).
+ */
+#define WELL_ORIENT_MAX 16384
+#define WELL_SIN_SHIFT 14
+#define WELL_GEOM_SHIFT (8 + WELL_SIN_SHIFT - 4) /* Q8 scale, Q14 sine to Q4 */
+
+static const uint8_t well_sqrt_lut[192] = {
+	128, 129, 130, 131, 132, 133, 134, 135, 136, 137, 138, 139,
+	139, 140, 141, 142, 143, 144, 145, 146, 147, 148, 148, 149,
+	150, 151, 152, 153, 153, 154, 155, 156, 157, 158, 158, 159,
+	160, 161, 162, 162, 163, 164, 165, 166, 166, 167, 168, 169,
+	169, 170, 171, 172, 172, 173, 174, 175, 175, 176, 177, 177,
+	178, 179, 180, 180, 181, 182, 182, 183, 184, 185, 185, 186,
+	187, 187, 188, 189, 189, 190, 191, 191, 192, 193, 193, 194,
+	195, 195, 196, 197, 197, 198, 199, 199, 200, 200, 201, 202,
+	202, 203, 204, 204, 205, 206, 206, 207, 207, 208, 209, 209,
+	210, 210, 211, 212, 212, 213, 213, 214, 215, 215, 216, 216,
+	217, 218, 218, 219, 219, 220, 221, 221, 222, 222, 223, 223,
+	224, 225, 225, 226, 226, 227, 227, 228, 229, 229, 230, 230,
+	231, 231, 232, 232, 233, 234, 234, 235, 235, 236, 236, 237,
+	237, 238, 238, 239, 239, 240, 241, 241, 242, 242, 243, 243,
+	244, 244, 245, 245, 246, 246, 247, 247, 248, 248, 249, 249,
+	250, 250, 251, 251, 252, 252, 253, 253, 254, 254, 255, 255,
+};
+
+static const uint16_t well_atan_lut[257] = {
+	0, 22, 45, 67, 90, 112, 134, 157, 179, 201,
+	224, 246, 268, 291, 313, 335, 358, 380, 402, 424,
+	447, 469, 491, 513, 536, 558, 580, 602, 624, 646,
+	668, 690, 713, 735, 757, 779, 800, 822, 844, 866,
+	888, 910, 932, 953, 975, 997, 1019, 1040, 1062, 1084,
+	1105, 1127, 1148, 1170, 1191, 1213, 1234, 1255, 1277, 1298,
+	1319, 1340, 1361, 1383, 1404, 1425, 1446, 1467, 1488, 1508,
+	1529, 1550, 1571, 1592, 1612, 1633, 1653, 1674, 1695, 1715,
+	1735, 1756, 1776, 1796, 1817, 1837, 1857, 1877, 1897, 1917,
+	1937, 1957, 1977, 1997, 2016, 2036, 2056, 2075, 2095, 2114,
+	2134, 2153, 2172, 2192, 2211, 2230, 2249, 2268, 2287, 2306,
+	2325, 2344, 2363, 2382, 2400, 2419, 2438, 2456, 2475, 2493,
+	2511, 2530, 2548, 2566, 2584, 2603, 2621, 2639, 2657, 2674,
+	2692, 2710, 2728, 2745, 2763, 2780, 2798, 2815, 2833, 2850,
+	2867, 2885, 2902, 2919, 2936, 2953, 2970, 2987, 3003, 3020,
+	3037, 3053, 3070, 3086, 3103, 3119, 3136, 3152, 3168, 3184,
+	3201, 3217, 3233, 3249, 3264, 3280, 3296, 3312, 3327, 3343,
+	3359, 3374, 3390, 3405, 3420, 3436, 3451, 3466, 3481, 3496,
+	3511, 3526, 3541, 3556, 3571, 3585, 3600, 3615, 3629, 3644,
+	3658, 3673, 3687, 3701, 3716, 3730, 3744, 3758, 3772, 3786,
+	3800, 3814, 3828, 3841, 3855, 3869, 3882, 3896, 3909, 3923,
+	3936, 3950, 3963, 3976, 3989, 4003, 4016, 4029, 4042, 4055,
+	4067, 4080, 4093, 4106, 4119, 4131, 4144, 4156, 4169, 4181,
+	4194, 4206, 4218, 4231, 4243, 4255, 4267, 4279, 4291, 4303,
+	4315, 4327, 4339, 4351, 4363, 4374, 4386, 4397, 4409, 4421,
+	4432, 4443, 4455, 4466, 4478, 4489, 4500,
+};
+
+static const uint16_t well_sin_lut[257] = {
+	0, 101, 201, 302, 402, 503, 603, 704, 804, 904,
+	1005, 1105, 1205, 1306, 1406, 1506, 1606, 1706, 1806, 1906,
+	2006, 2105, 2205, 2305, 2404, 2503, 2603, 2702, 2801, 2900,
+	2999, 3098, 3196, 3295, 3393, 3492, 3590, 3688, 3786, 3883,
+	3981, 4078, 4176, 4273, 4370, 4467, 4563, 4660, 4756, 4852,
+	4948, 5044, 5139, 5235, 5330, 5425, 5520, 5614, 5708, 5803,
+	5897, 5990, 6084, 6177, 6270, 6363, 6455, 6547, 6639, 6731,
+	6823, 6914, 7005, 7096, 7186, 7276, 7366, 7456, 7545, 7635,
+	7723, 7812, 7900, 7988, 8076, 8163, 8250, 8337, 8423, 8509,
+	8595, 8680, 8765, 8850, 8935, 9019, 9102, 9186, 9269, 9352,
+	9434, 9516, 9598, 9679, 9760, 9841, 9921, 10001, 10080, 10159,
+	10238, 10316, 10394, 10471, 10549, 10625, 10702, 10778, 10853, 10928,
+	11003, 11077, 11151, 11224, 11297, 11370, 11442, 11514, 11585, 11656,
+	11727, 11797, 11866, 11935, 12004, 12072, 12140, 12207, 12274, 12340,
+	12406, 12472, 12537, 12601, 12665, 12729, 12792, 12854, 12916, 12978,
+	13039, 13100, 13160, 13219, 13279, 13337, 13395, 13453, 13510, 13567,
+	13623, 13678, 13733, 13788, 13842, 13896, 13949, 14001, 14053, 14104,
+	14155, 14206, 14256, 14305, 14354, 14402, 14449, 14497, 14543, 14589,
+	14635, 14680, 14724, 14768, 14811, 14854, 14896, 14937, 14978, 15019,
+	15059, 15098, 15137, 15175, 15213, 15250, 15286, 15322, 15357, 15392,
+	15426, 15460, 15493, 15525, 15557, 15588, 15619, 15649, 15679, 15707,
+	15736, 15763, 15791, 15817, 15843, 15868, 15893, 15917, 15941, 15964,
+	15986, 16008, 16029, 16049, 16069, 16088, 16107, 16125, 16143, 16160,
+	16176, 16192, 16207, 16221, 16235, 16248, 16261, 16273, 16284, 16295,
+	16305, 16315, 16324, 16332, 16340, 16347, 16353, 16359, 16364, 16369,
+	16373, 16376, 16379, 16381, 16383, 16384, 16384,
+};
+
+static uint64_t
+well_isqrt(uint64_t x)
+{
+	uint64_t r;
+	int e, s;
+
+	if (x == 0)
+		return (0);
+
+	/* x = m * 4^(e/2), with m in [64, 256). */
+	e = (flsll(x) - 7) & ~1;
+	r = well_sqrt_lut[(e >= 0 ? x >> e : x << -e) - 64];
+	s = e / 2 - 4;
+	r = s >= 0 ? r << s : r >> -s;
+	return ((r + x / r) / 2);
+}
+
+/* Angle of (x, y) in 1/100 degree, in [-18000, 18000].  The ratio is
+ * taken in Q16, so both sides are first shifted down to 47 bits.
+ */
+static int
+well_atan2(int64_t y, int64_t x)
+{
+	uint64_t ax, ay, t;
+	int a, k;
+
+	ax = x < 0 ? -(uint64_t)x : (uint64_t)x;
+	ay = y < 0 ? -(uint64_t)y : (uint64_t)y;
+	if (ax == 0 && ay == 0)
+		return (0);
+
+	k = MAX(flsll(MAX(ax, ay)) - 47, 0);
+	ax >>= k;
+	ay >>= k;
+
+	t = ay <= ax ? (ay << 16) / ax : (ax << 16) / ay;
+	a = well_atan_lut[t >> 8];
+	if (t < (1 << 16))
+		a += (well_atan_lut[(t >> 8) + 1] - a) * (int)(t & 255) >> 8;
+	if (ay > ax)
+		a = 9000 - a;
+	if (x < 0)
+		a = 18000 - a;
+	return (y < 0 ? -a : a);
+}
+
+/* Sine of "q" in [-WELL_ORIENT_MAX, WELL_ORIENT_MAX] quarter turns, Q14. */
+static int
+well_sin(int q)
+{
+	int a, i, s;
+
+	a = abs(q);
+	i = a >> 6;
+	s = well_sin_lut[i];
+	if (i < 256)
+		s += (well_sin_lut[i + 1] - s) * (a & 63) >> 6;
+	return (q < 0 ? -s : s);
+}
+
+/* Fill in the ellipse of a contact, scaling sensor units by "sx" and
+ * "sy" (Q8) into physical ones.
+ */
+void
+well_ellipse(int sx, int sy, int major, int minor, int orientation,
+    struct well_contact *c)
+{
+	int64_t ux, uy, vx, vy, p, q, r, d;
+	int k, o, sn, cs;
+
+	o = MIN(MAX(WELL_ORIENT_MAX - orientation, -WELL_ORIENT_MAX),
+	    WELL_ORIENT_MAX);
+	sn = well_sin(o);
+	cs = well_sin(WELL_ORIENT_MAX - abs(o));
+
+	/* Both axis vectors, scaled to physical units, Q4. */
+	ux = (int64_t)major * sx * cs >> WELL_GEOM_SHIFT;
+	uy = (int64_t)major * sy * sn >> WELL_GEOM_SHIFT;
+	vx = -(int64_t)minor * sx * sn >> WELL_GEOM_SHIFT;
+	vy = (int64_t)minor * sy * cs >> WELL_GEOM_SHIFT;
+
+	/* Eigenvalues of u u' + v v' are p +/- hypot(q, r). */
+	p = (ux * ux + vx * vx + uy * uy + vy * vy) / 2;
+	q = (ux * ux + vx * vx - uy * uy - vy * vy) / 2;
+	r = ux * uy + vx * vy;
+	d = MAX(q < 0 ? -q : q, r < 0 ? -r : r);
+	k = MAX(flsll(d) - 30, 0);
+	d = well_isqrt((q >> k) * (q >> k) + (r >> k) * (r >> k)) << k;
+
+	c->major = MIN((well_isqrt(p + d) + 8) >> 4, 0xffff);
+	c->minor = MIN((well_isqrt(MAX(p - d, 0)) + 8) >> 4, 0xffff);
+	c->angle = well_atan2(r, q) / 2;
+}
+
+
+/* Compute the acceleration table for "factor", once, when the curve
+ * is set.
+ */
+void
+well_accel_init(struct well_accel *accel, int factor)
+{
+	u_int gain, i;
+
+	for (i = 0; i < WELL_ACCEL_BUCKETS; i++) {
+		gain = WELL_ACCEL_ONE;
+		if (i > WELL_ACCEL_THRESHOLD)
+			gain += factor * (i - WELL_ACCEL_THRESHOLD) *
+			    WELL_ACCEL_ONE / WELL_ACCEL_SLOPE;
+		accel->gain[i] = MIN(gain, WELL_ACCEL_MAX);
+	}
+	accel->rx = 0;
+	accel->ry = 0;
+}
+
+/* Apply the acceleration curve to one frame's motion.  The speed is
+ * approximated as max + min / 2 of the axis deltas, and fractional
+ * output is carried over to the next frame so no motion is lost.
+ */
+void
+well_accel(struct well_accel *accel, int *dx, int *dy)
+{
+	u_int ax, ay, speed, gain;
+
+	ax = abs(*dx);
+	ay = abs(*dy);
+	speed = MAX(ax, ay) + (MIN(ax, ay) >> 1);
+	gain = accel->gain[MIN(speed, WELL_ACCEL_BUCKETS - 1)];
+
+	accel->rx += *dx * (int)gain;
+	accel->ry += *dy * (int)gain;
+	*dx = accel->rx >> WELL_ACCEL_SHIFT;
+	*dy = accel->ry >> WELL_ACCEL_SHIFT;
+	accel->rx -= *dx * WELL_ACCEL_ONE;
+	accel->ry -= *dy * WELL_ACCEL_ONE;
+}
+
+/* Motion of the primary finger since the previous frame, in output
+ * units through "norm".  Motion only counts while the finger count
+ * holds steady, so that a finger landing or lifting does not make the
+ * pointer jump; a change drops the remainder of the acceleration.
+ * Pointer motion is accelerated, scroll motion ("scroll") is not.
+ * Returns one of WELL_TRACK_*, with (dx, dy) zero unless it is
+ * WELL_TRACK_MOVE.  A change fires contacts:change.
+ */
+int
+well_track(struct well_track *track, const struct well_norm *norm,
+    const struct well_frame *frame, int scroll, int *dx, int *dy)
+{
+	int x, y, ret;
+
+	*dx = *dy = 0;
+	if (frame->nfingers != track->fingers) {
+		WELL_TRACE(contacts, change, track, track->fingers,
+		    frame->nfingers);
+		track->accel.rx = 0;
+		track->accel.ry = 0;
+		ret = WELL_TRACK_CHANGE;
+	} else
+		ret = frame->nfingers > 0 ? WELL_TRACK_MOVE : WELL_TRACK_IDLE;
+	track->fingers = frame->nfingers;
+	if (frame->nfingers == 0)
+		return (ret);
+
+	x = well_normalize(&norm[WELL_AXIS_X], frame->x[0]);
+	y = well_normalize(&norm[WELL_AXIS_Y], frame->y[0]);
+	if (ret == WELL_TRACK_MOVE) {
+		*dx = x - track->x;
+		*dy = y - track->y;
+		if (!scroll)
+			well_accel(&track->accel, dx, dy);
+	}
+	track->x = x;
+	track->y = y;
+	return (ret);
+}
+
+/* Start scrolling, with no motion yet.  The velocity and interval
+ * are seeded again by the first motion.
+ */
+void
+well_scroll_reset(struct well_scroll *scroll, const struct timeval *time)
+{
+	scroll->acc = 0;
+	scroll->v = 0;
+	scroll->dt = 0;
+	scroll->time = *time;
+}
+
+/* Turn vertical motion "dy" into wheel steps, and keep a running
+ * velocity for momentum.  Fingers moving down scroll down, like a
+ * wheel.  Returns the steps.
+ */
+int
+well_scroll(struct well_scroll *scroll, const struct timeval *time, int dy)
+{
+	int dt, dz;
+
+	scroll->acc -= dy * WELL_KINETIC_ONE;
+	dz = scroll->acc >> (WELL_KINETIC_SHIFT + WELL_SCROLL_SHIFT);
+	scroll->acc -= dz * WELL_SCROLL_STEP;
+
+	/* Exponential moving averages, weight 1/4, both seeded from the
+	 * first interval so that a fling right after the reset does not
+	 * divide a fraction of the velocity by a fraction of the
+	 * interval.
+	 */
+	dt = (time->tv_sec - scroll->time.tv_sec) * 1000000 +
+	    (time->tv_usec - scroll->time.tv_usec);
+	scroll->time = *time;
+	if (scroll->dt == 0) {
+		scroll->v = -dy * WELL_KINETIC_ONE;
+		if (dt > 0 && dt < 100000)
+			scroll->dt = dt;
+	} else {
+		scroll->v += (-dy * WELL_KINETIC_ONE - scroll->v) >> 2;
+		if (dt > 0 && dt < 100000)
+			scroll->dt += (dt - scroll->dt) >> 2;
+	}
+
+	return (dz);
+}
+
+/* Fingers lifted off a scroll: convert its velocity from per frame to
+ * per tick.  Returns non-zero if it was fast enough for momentum.
+ */
+int
+well_scroll_fling(struct well_scroll *scroll)
+{
+	int64_t v;
+
+	scroll->kv = 0;
+	if (scroll->dt <= 0)
+		return (0);
+
+	v = (int64_t)scroll->v * (WELL_KINETIC_TICK * 1000) / scroll->dt;
+	if (v > -WELL_KINETIC_START && v < WELL_KINETIC_START)
+		return (0);
+	scroll->kv = MIN(MAX(v, -WELL_KINETIC_MAX), WELL_KINETIC_MAX);
+	return (1);
+}
+
+/* One momentum tick: decay the velocity by "decay" (Q8, below
+ * WELL_KINETIC_ONE) and return the wheel steps it makes in "dz".
+ * Returns zero once the momentum has died out, with no steps.
+ */
+int
+well_scroll_coast(struct well_scroll *scroll, u_int decay, int *dz)
+{
+	*dz = 0;
+	scroll->kv = (scroll->kv * (int)MIN(decay, WELL_KINETIC_ONE - 1)) >>
+	    WELL_KINETIC_SHIFT;
+	if (abs(scroll->kv) < WELL_KINETIC_MIN) {
+		scroll->kv = 0;
+		return (0);
+	}
+
+	scroll->acc += scroll->kv;
+	*dz = scroll->acc >> (WELL_KINETIC_SHIFT + WELL_SCROLL_SHIFT);
+	scroll->acc -= *dz * WELL_SCROLL_STEP;
+	return (1);
+}
+
+/* Forget the motion history when tracking restarts or the finger
+ * rests.  Returns the offset predicting readers were given, negated,
+ * in "pdx" and "pdy", so that they can take it back.
+ */
+void
+well_predict_reset(struct well_pred *pred, const struct timeval *time,
+    int *pdx, int *pdy)
+{
+	*pdx = -pred->ox;
+	*pdy = -pred->oy;
+	pred->vx = 0;
+	pred->vy = 0;
+	pred->ox = 0;
+	pred->oy = 0;
+	pred->gain = 0;
+	pred->time = *time;
+}
+
+/* Extrapolate one axis "h" frames (Q8) ahead from its motion "v" and
+ * change of motion "a" per frame, scaled by "gain".
+ */
+static int
+well_predict_axis(int v, int a, int h, int gain)
+{
+	int64_t off;
+
+	off = ((int64_t)v * h * WELL_PREDICT_ONE +
+	    (int64_t)a * h * h / 2) >> (2 * WELL_PREDICT_SHIFT);
+	off = (off * gain) >> WELL_PREDICT_SHIFT;
+	return (MIN(MAX(off, -WELL_PREDICT_MAX), WELL_PREDICT_MAX));
+}
+
+/* Extrapolate the pointer position "horizon" ms ahead from the
+ * last two motions, in constant time.  The offset is taken back to
+ * zero on a direction reversal, then phased in again over a few
+ * frames, so that the prediction does not overshoot turns.  Returns
+ * the change of offset in "pdx" and "pdy"; predicting readers add it
+ * to the motion.
+ */
+void
+well_predict(struct well_pred *pred, const struct timeval *time,
+    u_int horizon, int dx, int dy, int *pdx, int *pdy)
+{
+	int dt, h, ox, oy;
+
+	dt = (time->tv_sec - pred->time.tv_sec) * 1000000 +
+	    (time->tv_usec - pred->time.tv_usec);
+	pred->time = *time;
+	if (dt > 0 && dt < 100000) {
+		if (pred->dt == 0)
+			pred->dt = dt;
+		else
+			pred->dt += (dt - pred->dt) >> 2;
+	}
+
+	if (dx * pred->vx + dy * pred->vy < 0)
+		pred->gain = 0;
+	else
+		pred->gain += (WELL_PREDICT_ONE - pred->gain) >> 1;
+
+	h = 0;
+	if (pred->dt > 0)
+		h = MIN(MIN(horizon, 1000) * 1000 *
+		    WELL_PREDICT_ONE / pred->dt,
+		    WELL_PREDICT_FRAMES * WELL_PREDICT_ONE);
+	ox = well_predict_axis(dx, dx - pred->vx, h, pred->gain);
+	oy = well_predict_axis(dy, dy - pred->vy, h, pred->gain);
+
+	*pdx = ox - pred->ox;
+	*pdy = oy - pred->oy;
+	pred->vx = dx;
+	pred->vy = dy;
+	pred->ox = ox;
+	pred->oy = oy;
+}
+
+/* Tell whether a frame would decode exactly like the previous one,
+ * and remember it otherwise.  The decoder only reads the finger
+ * records and the integrated button byte, so the other header bytes,
+ * which count frames, are left out of the comparison.  Frames of
+ * WELL_SCROLL_FINGERS contacts are not skipped: the scroll velocity
+ * has to see resting fingers to decay before a lift-off.  The count is
+ * the frame's own, from its header, so the filter does not depend on
+ * what the later stages remember.
+ */
+int
+well_filter(struct well_filter *filt, const struct well_dev_params *params,
+    const uint8_t *data, int len)
+{
+	const uint8_t *rec = data + params->finger_offset;
+	uint8_t button;
+	int fingers, n;
+
+	fingers = well_decode_header(params, data, len, &button);
+	n = fingers * WELL_FINGER_SIZE;
+	if (len == filt->len && button == filt->button &&
+	    fingers != WELL_SCROLL_FINGERS &&
+	    memcmp(rec, filt->data, n) == 0) {
+		filt->skipped++;
+		return (1);
+	}
+
+	filt->len = len;
+	filt->button = button;
+	memcpy(filt->data, rec, n);
+	return (0);
+}
+
+static const char *well_zone_names[WELL_ZONE_N] = {
+	[WELL_ZONE_NONE]    = "none",
+	[WELL_ZONE_RIGHT]   = "right",
+	[WELL_ZONE_MIDDLE]  = "middle",
+	[WELL_ZONE_VSCROLL] = "vscroll",
+};
+
+/* Compile a zone specification into "map".  The specification is a
+ * list of "name:x0,y0,x1,y1" rectangles in thousandths of the pad from
+ * its top left corner, separated by spaces; later rectangles win where
+ * they overlap.  Cells are assigned to every rectangle they touch.
+ * Returns EINVAL, with "map" undefined, if the specification is bad.
+ */
+int
+well_zone_compile(const struct well_dev_params *params, const char *spec,
+    struct well_zone_map *map)
+{
+	struct well_calib calib;
+	char buf[WELL_ZONE_SPEC_LEN], *p, *tok, *name, *end;
+	u_long v[4], row, col;
+	int i, n, type;
+
+	if (strlcpy(buf, spec, sizeof(buf)) >= sizeof(buf))
+		return (EINVAL);
+
+	memset(map, 0, sizeof(*map));
+	calib = params->x_calib;
+	calib.res = WELL_ZONE_COLS;
+	well_norm_init(&map->norm[0], &calib);
+	calib = params->y_calib;
+	calib.res = WELL_ZONE_ROWS;
+	well_norm_init(&map->norm[1], &calib);
+
+	p = buf;
+	n = 0;
+	while ((tok = strsep(&p, " \t\n")) != NULL) {
+		if (*tok == '\0')
+			continue;
+		name = strsep(&tok, ":");
+		if (tok == NULL || ++n > WELL_ZONE_MAX)
+			return (EINVAL);
+		for (type = 0; type < WELL_ZONE_N; type++)
+			if (strcmp(name, well_zone_names[type]) == 0)
+				break;
+		if (type == WELL_ZONE_N)
+			return (EINVAL);
+		for (i = 0; i < 4; i++) {
+			v[i] = strtoul(tok, &end, 10);
+			if (end == tok || v[i] > 1000 ||
+			    *end != (i < 3 ? ',' : '\0'))
+				return (EINVAL);
+			tok = end + 1;
+		}
+		if (v[0] >= v[2] || v[1] >= v[3])
+			return (EINVAL);
+
+		/* Rows count up from the bottom edge, like raw Y. */
+		for (row = v[1] * WELL_ZONE_ROWS / 1000;
+		    row < howmany(v[3] * WELL_ZONE_ROWS, 1000); row++)
+			for (col = v[0] * WELL_ZONE_COLS / 1000;
+			    col < howmany(v[2] * WELL_ZONE_COLS, 1000); col++)
+				map->cells[WELL_ZONE_ROWS - 1 - row][col] =
+				    type;
+	}
+	return (0);
+}
+
+/* Store one event at the head of the ring "events".  A change of
+ * buttons marks it urgent, and a click until a reader reads it.
+ * Returns the event, with no prediction correction.
+ */
+struct well_event *
+well_event_put(struct well_ring *ring, struct well_event *events,
+    const struct timeval *time, int dx, int dy, int dz, u_int buttons)
+{
+	struct well_event *ev;
+
+	ev = &events[ring->head & (WELL_RING_LEN - 1)];
+	ev->time = *time;
+	ev->dx = dx;
+	ev->dy = dy;
+	ev->dz = dz;
+	ev->pdx = 0;
+	ev->pdy = 0;
+	ev->buttons = buttons;
+	ev->flags = 0;
+	if (buttons != ring->buttons) {
+		ev->flags |= WELL_EV_URGENT | WELL_EV_CLICK;
+		ring->urgent = 1;
+		ring->buttons = buttons;
+	}
+	ring->head++;
+	ring->pending = 1;
+	return (ev);
+}
+
+/* Encode an event in sysmouse format for "mode", with the prediction
+ * correction if "predict".  Returns its length.
+ */
+int
+well_encode(const mousemode_t *mode, int predict,
+    const struct well_event *ev, uint8_t *buf)
+{
+	int dx, dy, dz;
+
+	dx = ev->dx;
+	dy = ev->dy;
+	if (predict) {
+		dx += ev->pdx;
+		dy += ev->pdy;
+	}
+	dx = MIN(MAX(dx, WELL_PACKET_MIN), WELL_PACKET_MAX);
+	dy = MIN(MAX(dy, WELL_PACKET_MIN), WELL_PACKET_MAX);
+	dz = MIN(MAX(ev->dz, WELL_PACKET_MIN), WELL_PACKET_MAX);
+
+	buf[0] = mode->syncmask[1] | MOUSE_MSC_BUTTONS;
+	if (ev->buttons & MOUSE_BUTTON1DOWN)
+		buf[0] &= ~MOUSE_MSC_BUTTON1UP;
+	if (ev->buttons & MOUSE_BUTTON2DOWN)
+		buf[0] &= ~MOUSE_MSC_BUTTON2UP;
+	if (ev->buttons & MOUSE_BUTTON3DOWN)
+		buf[0] &= ~MOUSE_MSC_BUTTON3UP;
+	buf[1] = dx >> 1;
+	buf[2] = dy >> 1;
+	buf[3] = dx - (dx >> 1);
+	buf[4] = dy - (dy >> 1);
+	if (mode->level == 0)
+		return (MOUSE_MSC_PACKETSIZE);
+
+	buf[5] = dz >> 1;
+	buf[6] = dz - (dz >> 1);
+	buf[7] = ((~ev->buttons) >> 3) & MOUSE_SYS_EXTBUTTONS;
+	return (MOUSE_SYS_PACKETSIZE);
+}
+
+/* Forget any recovery in progress.  The total stays. */
+void
+well_recover_clear(struct well_recover *rec)
+{
+	rec->state = WELL_RECOVER_NONE;
+	rec->errs = 0;
+	rec->tries = 0;
+}
+
+/* Start the next attempt, or give up if the budget is spent. */
+static int
+well_recover_schedule(struct well_recover *rec,
+    const struct well_recover_cfg *cfg, u_int *delay)
+{
+	if (rec->tries >= cfg->budget) {
+		rec->state = WELL_RECOVER_FAILED;
+		return (WELL_RECOVER_GIVEUP);
+	}
+
+	*delay = cfg->max;
+	if (rec->tries < 16 && (cfg->base << rec->tries) < *delay)
+		*delay = cfg->base << rec->tries;
+	rec->state = WELL_RECOVER_BACKOFF;
+	return (WELL_RECOVER_WAIT);
+}
+
+/* The pipe is about to be resubmitted, after a frame or an error
+ * counted in "errs".  Returns WELL_RECOVER_GO unless there were too
+ * many errors in a row: then the pipe stays idle, and the first time
+ * round the backoff starts, WELL_RECOVER_WAIT for "delay" ms.
+ */
+int
+well_recover_setup(struct well_recover *rec,
+    const struct well_recover_cfg *cfg, u_int *delay)
+{
+	if (rec->errs < WELL_ERR_THRESHOLD)
+		return (WELL_RECOVER_GO);
+	if (rec->state != WELL_RECOVER_NONE &&
+	    rec->state != WELL_RECOVER_RESUME)
+		return (WELL_RECOVER_STOP);
+	return (well_recover_schedule(rec, cfg, delay));
+}
+
+/* A good frame.  Returns the attempts it took if that ends an
+ * episode, zero otherwise.
+ */
+u_int
+well_recover_good(struct well_recover *rec)
+{
+	u_int tries;
+
+	rec->errs = 0;
+	if (rec->state != WELL_RECOVER_RESUME)
+		return (0);
+	tries = rec->tries;
+	rec->state = WELL_RECOVER_NONE;
+	rec->tries = 0;
+	return (tries);
+}
+
+/* The backoff timer expired.  Returns non-zero if the mode must be
+ * sent again now.
+ */
+int
+well_recover_timeout(struct well_recover *rec)
+{
+	if (rec->state != WELL_RECOVER_BACKOFF)
+		return (0);
+	rec->tries++;
+	rec->total++;
+	rec->state = WELL_RECOVER_RESET;
+	return (1);
+}
+
+/* The mode reset completed, "ok" if it went through.  Returns
+ * WELL_RECOVER_GO to resubmit the pipe, WELL_RECOVER_WAIT or
+ * WELL_RECOVER_GIVEUP when it failed, and WELL_RECOVER_STOP for a
+ * reset that was not ours.
+ */
+int
+well_recover_reset(struct well_recover *rec, int ok,
+    const struct well_recover_cfg *cfg, u_int *delay)
+{
+	if (rec->state != WELL_RECOVER_RESET)
+		return (WELL_RECOVER_STOP);
+	if (!ok)
+		return (well_recover_schedule(rec, cfg, delay));
+	rec->state = WELL_RECOVER_RESUME;
+	rec->errs = 0;
+	return (WELL_RECOVER_GO);
+}
+
+#ifdef WELL_PROFILE
+/* Account "cycles" to a stage. */
+void
+well_prof_add(struct well_prof *prof, uint64_t cycles)
+{
+	if (prof->count == 0 || cycles < prof->min)
+		prof->min = cycles;
+	if (cycles > prof->max)
+		prof->max = cycles;
+	prof->count++;
+	prof->total += cycles;
+	prof->hist[MIN(flsll(cycles), WELL_PROF_BUCKETS - 1)]++;
+}
+#endif
+
+#if !defined(_KERNEL) && !defined(WELL_NO_TRACE)
+well_trace_fn *well_trace_fns[WELL_TRACE_N];
+
+#define WELL_TRACE_NAME(func, name) \
+	[WELL_TRACE_##func##_##name] = #func ":" #name,
+const char *const well_trace_names[WELL_TRACE_N] = {
+	WELL_TRACE_POINTS(WELL_TRACE_NAME)
+};
+#undef WELL_TRACE_NAME
+
+/* Call "fn" whenever tracepoint "point" fires, or nothing if it is
+ * NULL.  Returns the function it replaces.
+ */
+well_trace_fn *
+well_trace_register(int point, well_trace_fn *fn)
+{
+	well_trace_fn *old;
+
+	if (point < 0 || point >= WELL_TRACE_N)
+		return (NULL);
+	old = well_trace_fns[point];
+	well_trace_fns[point] = fn;
+	return (old);
+}
+#endif
@@ -0,0 +1,553 @@
+/* Copyright (c) 2011 Eric McCorkle.  All rights reserved. */
+#ifndef _WELL_CORE_H_
+#define _WELL_CORE_H_
+
+#include <sys/param.h>
+#include <sys/ioccom.h>
+#include <sys/mouse.h>
+#include <sys/time.h>
+
+#include "well_ioctl.h"
+
+#ifdef _KERNEL
+#include <sys/sdt.h>
+#ifdef WELL_PROFILE
+#include <machine/cpu.h>
+#endif
+#elif defined(WELL_PROFILE)
+#include <time.h>
+#endif
+
+/* The part of the driver that only deals with the protocol: device
+ * parameters, frame decoding, calibration, contact geometry, and the
+ * pointer acceleration and prediction filters.  It has no kernel
+ * dependencies, so the kernel driver and the userspace one in
+ * well_user.c share it.
+ */
+
+#define WELL_BUTTON_DATALEN 4
+#define WELL_TYPE_1_OFFSET 26
+#define WELL_TYPE_2_OFFSET 30
+#define WELL_TYPE_2_BUTTON 15 /* header byte holding the integrated button */
+#define WELL_FINGER_SIZE 28
+#define WELL_FINGER_DATALEN (WELL_FINGER_SIZE * 16)
+#define WELL_MODE_LENGTH 8
+#define WELL_MAX_FINGERS 16
+#define WELL_MODE_REPORT 0x300 /* feature report holding the mode */
+
+/* Pointer acceleration.  Gains are Q8 fixed point, looked up by speed
+ * in output units per frame.  Speeds up to WELL_ACCEL_THRESHOLD are
+ * left alone; above it, the gain grows by accelfactor / WELL_ACCEL_SLOPE
+ * per unit of speed, up to WELL_ACCEL_MAX.
+ */
+#define WELL_ACCEL_SHIFT 8
+#define WELL_ACCEL_ONE (1 << WELL_ACCEL_SHIFT)
+#define WELL_ACCEL_MAX (8 * WELL_ACCEL_ONE)
+#define WELL_ACCEL_BUCKETS 32
+#define WELL_ACCEL_THRESHOLD 2
+#define WELL_ACCEL_SLOPE 16
+#define WELL_ACCEL_FACTOR_MAX 16
+
+/* Pointer prediction.  The horizon is converted to WELL_PREDICT_SHIFT
+ * fixed point frames, at most WELL_PREDICT_FRAMES ahead, and the
+ * predicted offset is clamped to WELL_PREDICT_MAX output units.
+ */
+#define WELL_PREDICT_SHIFT 8
+#define WELL_PREDICT_ONE (1 << WELL_PREDICT_SHIFT)
+#define WELL_PREDICT_FRAMES 8
+#define WELL_PREDICT_MAX 64
+
+/* Two-finger scrolling and momentum.  Scroll positions and velocities
+ * are Q8 fixed point, in output units; WELL_SCROLL_SHIFT more bits
+ * make one wheel step.  After lift-off the velocity decays by
+ * decay / 256 every WELL_KINETIC_TICK ms until it falls below
+ * WELL_KINETIC_MIN.  It starts at most WELL_KINETIC_MAX, so a decay
+ * below WELL_KINETIC_ONE cannot overflow it.  WELL_SCROLL_FINGERS
+ * fingers down scroll.
+ */
+#define WELL_SCROLL_FINGERS 2
+#define WELL_SCROLL_SHIFT 4
+#define WELL_KINETIC_SHIFT 8
+#define WELL_KINETIC_ONE (1 << WELL_KINETIC_SHIFT)
+#define WELL_SCROLL_STEP (1 << (WELL_KINETIC_SHIFT + WELL_SCROLL_SHIFT))
+#define WELL_KINETIC_TICK 8 /* ms */
+#define WELL_KINETIC_START (2 << WELL_KINETIC_SHIFT)
+#define WELL_KINETIC_MIN (1 << (WELL_KINETIC_SHIFT - 2))
+#define WELL_KINETIC_MAX (64 * WELL_SCROLL_STEP)
+
+/* define payload protocols */
+enum {
+	DEV_WELLSPRING,
+	DEV_WELLSPRING2,
+	DEV_WELLSPRING3,
+	DEV_WELLSPRING4,
+	DEV_WELLSPRING4a,
+	DEV_WELLSPRING5,
+	DEV_WELLSPRING5a,
+	DEV_WELLSPRING6,
+	DEV_WELLSPRING6a,
+	DEV_WELLSPRING_N
+};
+
+enum {
+        RES_PRESSURE = 256,
+	RES_WIDTH = 16,
+	RES_X = 1280,
+	RES_Y = 800,
+	NOISE_WIDTH = 1,
+	NOISE_PRESSURE = 6,
+	NOISE_X = 5,
+	NOISE_Y = 3
+};
+
+enum {
+        INTEGRATED_BUTTON = 0x1
+};
+
+/* Little-endian 16-bit fields of a finger record. */
+enum {
+	WELL_FINGER_ORIGIN,
+	WELL_FINGER_ABS_X,
+	WELL_FINGER_ABS_Y,
+	WELL_FINGER_REL_X,
+	WELL_FINGER_REL_Y,
+	WELL_FINGER_TOOL_MAJOR,
+	WELL_FINGER_TOOL_MINOR,
+	WELL_FINGER_ORIENTATION,
+	WELL_FINGER_TOUCH_MAJOR,
+	WELL_FINGER_TOUCH_MINOR,
+	WELL_FINGER_MULTI = 13
+};
+
+enum {
+        BUTTON_ENDPOINT = 0x84,
+	TRACKPAD_ENDPOINT = 0x81
+};
+
+typedef enum interface_mode {
+	RAW_SENSOR_MODE = 0x01,
+	HID_MODE        = 0x08
+} interface_mode;
+
+/* Apple product IDs of the supported pads, as X(product, model)
+ * entries.
+ */
+#define WELL_VENDOR_APPLE 0x05ac
+#define WELL_PRODUCTS(X)             \
+	/* MacBook Air 1.1 */        \
+	X(0x0223, DEV_WELLSPRING)    \
+	X(0x0224, DEV_WELLSPRING)    \
+	X(0x0225, DEV_WELLSPRING)    \
+	/* MacBook Pro Penryn */     \
+	X(0x0230, DEV_WELLSPRING2)   \
+	X(0x0231, DEV_WELLSPRING2)   \
+	X(0x0232, DEV_WELLSPRING2)   \
+	/* MacBook 5,1 */            \
+	X(0x0236, DEV_WELLSPRING3)   \
+	X(0x0237, DEV_WELLSPRING3)   \
+	X(0x0238, DEV_WELLSPRING3)   \
+	/* MacBook Air 3.2 */        \
+	X(0x023f, DEV_WELLSPRING4)   \
+	X(0x0240, DEV_WELLSPRING4)   \
+	X(0x0241, DEV_WELLSPRING4)   \
+	/* MacBook Air 3.1 */        \
+	X(0x0242, DEV_WELLSPRING4a)  \
+	X(0x0243, DEV_WELLSPRING4a)  \
+	X(0x0244, DEV_WELLSPRING4a)  \
+	/* MacBook Pro 8,2 */        \
+	X(0x0252, DEV_WELLSPRING5a)  \
+	X(0x0253, DEV_WELLSPRING5a)  \
+	X(0x0254, DEV_WELLSPRING5a)  \
+	/* MacBook Pro 8,1 */        \
+	X(0x0245, DEV_WELLSPRING5)   \
+	X(0x0246, DEV_WELLSPRING5)   \
+	X(0x0247, DEV_WELLSPRING5)   \
+	/* MacBook Air 4.2 */        \
+	X(0x024c, DEV_WELLSPRING6a)  \
+	X(0x024d, DEV_WELLSPRING6a)  \
+	X(0x024e, DEV_WELLSPRING6a)  \
+	/* MacBook Air 4.1 */        \
+	X(0x0249, DEV_WELLSPRING6)   \
+	X(0x024a, DEV_WELLSPRING6)   \
+	X(0x024b, DEV_WELLSPRING6)
+
+struct well_calib {
+        int res;
+        int noise;
+        int min;
+        int max;
+};
+
+struct well_dev_params {
+        int flags;
+        char* name;
+        int button_endpoint;
+        int trackpad_endpoint;
+        u_int button_datalen;
+        u_int trackpad_datalen;
+        u_int finger_offset;
+        struct well_calib press_calib;
+        struct well_calib width_calib;
+        struct well_calib x_calib;
+        struct well_calib y_calib;
+};
+
+extern const struct well_dev_params well_dev_params[DEV_WELLSPRING_N];
+
+/* A decoded trackpad frame.  Finger records are transposed into
+ * structure-of-arrays form, so field "f" of finger "i" is f[i].  All
+ * values are in raw sensor units.
+ */
+struct well_frame {
+	struct timeval     time;     /* uptime at completion */
+	u_int              buttons;  /* MOUSE_BUTTONxDOWN */
+	u_int              nfingers;
+	int16_t            x[WELL_MAX_FINGERS];
+	int16_t            y[WELL_MAX_FINGERS];
+	int16_t            touch_major[WELL_MAX_FINGERS];
+	int16_t            touch_minor[WELL_MAX_FINGERS];
+	int16_t            tool_major[WELL_MAX_FINGERS];
+	int16_t            tool_minor[WELL_MAX_FINGERS];
+	int16_t            orientation[WELL_MAX_FINGERS];
+};
+
+/* Axes normalized from raw sensor units to output units. */
+enum {
+	WELL_AXIS_X,
+	WELL_AXIS_Y,
+	WELL_AXIS_PRESSURE,
+	WELL_AXIS_WIDTH,
+	WELL_AXIS_N
+};
+
+/* Division-free mapping of a raw value in [min, max] to [0, res]:
+ * (raw - min) * mul >> shift, computed once per model at attach.
+ */
+struct well_norm {
+	int      min;
+	int      max;
+	uint64_t mul;
+	u_int    shift;
+};
+
+/* Acceleration curve and the sub-unit residue of the last frame. */
+struct well_accel {
+	uint16_t gain[WELL_ACCEL_BUCKETS]; /* Q8 */
+	int      rx;                       /* Q8 */
+	int      ry;
+};
+
+/* The primary finger between frames: its position in output units and
+ * the finger count it was seen with.
+ */
+struct well_track {
+	struct well_accel accel;
+	u_int             fingers;
+	int               x;
+	int               y;
+};
+
+/* What a frame did to the primary finger; see well_track(). */
+enum {
+	WELL_TRACK_IDLE,   /* no finger, before or now */
+	WELL_TRACK_CHANGE, /* the finger count changed */
+	WELL_TRACK_MOVE    /* same count: the motion is valid */
+};
+
+/* Scroll state, Q8 output units. */
+struct well_scroll {
+	int            acc; /* short of a wheel step */
+	int            v;   /* per frame, while scrolling */
+	int            dt;  /* frame interval, us */
+	int            kv;  /* momentum per tick, 0 when idle */
+	struct timeval time;
+};
+
+/* Pointer prediction state: last motion and offset, output units. */
+struct well_pred {
+	int            vx;
+	int            vy;
+	int            ox;
+	int            oy;
+	int            gain; /* Q8, 0 after a reversal */
+	int            dt;   /* frame interval, us */
+	struct timeval time;
+};
+
+/* Skipping repeated frames: what the decoder saw of the last one. */
+struct well_filter {
+	int     len;     /* 0 when unset */
+	uint8_t button;
+	u_int   skipped; /* frames skipped */
+	uint8_t data[WELL_FINGER_DATALEN];
+};
+
+/* Zone map.  Zones are rectangles in thousandths of the pad, compiled
+ * into a grid of WELL_ZONE_COLS by WELL_ZONE_ROWS cells so that each
+ * contact is classified with one lookup.
+ */
+#define WELL_ZONE_COLS 32
+#define WELL_ZONE_ROWS 16
+#define WELL_ZONE_MAX 16 /* rectangles in a specification */
+#define WELL_ZONE_SPEC_LEN 512
+
+enum {
+	WELL_ZONE_NONE,
+	WELL_ZONE_RIGHT,   /* click reports the right button */
+	WELL_ZONE_MIDDLE,  /* click reports the middle button */
+	WELL_ZONE_VSCROLL, /* single-finger motion scrolls */
+	WELL_ZONE_N
+};
+
+struct well_zone_map {
+	struct well_norm norm[2]; /* raw X and Y to columns and rows */
+	uint8_t          cells[WELL_ZONE_ROWS][WELL_ZONE_COLS];
+};
+
+/* Output events.  Events are stored once, in a device-neutral form,
+ * in a ring of WELL_RING_LEN indexed by sequence number, and encoded
+ * in each reader's format at read time.
+ */
+#define WELL_RING_LEN 256 /* events, must be a power of 2 */
+
+/* Range of a motion field in a packet.  Each field is split into two
+ * signed bytes, dx >> 1 and dx - (dx >> 1); 255 would make the second
+ * one 128 and wrap to -128, so the top is 254, as in ums(4).
+ */
+#define WELL_PACKET_MIN (-256)
+#define WELL_PACKET_MAX 254
+#define WELL_PACKET_FITS(d) ((d) >= WELL_PACKET_MIN && (d) <= WELL_PACKET_MAX)
+
+struct well_event {
+	struct timeval time;
+	int            dx;
+	int            dy;
+	int            dz;
+	int            pdx;      /* correction for predicting readers */
+	int            pdy;
+	u_int          buttons;  /* MOUSE_BUTTONxDOWN */
+	u_int          flags;    /* WELL_EV_* */
+};
+
+enum {
+	WELL_EV_URGENT = 0x1, /* button change or touch, never held back */
+	WELL_EV_CLICK  = 0x2  /* button change no reader has read yet */
+};
+
+/* The producer's side of the ring; the events live apart. */
+struct well_ring {
+	u_int head;    /* sequence of the next event */
+	u_int pending; /* readers need a wakeup */
+	u_int urgent;  /* ... paced ones too */
+	u_int buttons; /* of the last event */
+};
+
+/* Error recovery.  After WELL_ERR_THRESHOLD consecutive errors the
+ * pipe is left idle for a backoff delay, doubling with each attempt
+ * from "base" and capped at "max" ms, then the mode is sent again and
+ * the pipe resubmitted.  It gives up after "budget" attempts without a
+ * good frame.  The machine only keeps the state; the caller runs the
+ * timer and the transfers, as the action returned says.
+ */
+#define WELL_ERR_THRESHOLD 5 /* consecutive errors before recovery */
+
+enum {
+	WELL_RECOVER_NONE,    /* streaming normally */
+	WELL_RECOVER_BACKOFF, /* waiting on the backoff timer */
+	WELL_RECOVER_RESET,   /* mode reset in flight */
+	WELL_RECOVER_RESUME,  /* resubmitted, waiting for a good frame */
+	WELL_RECOVER_FAILED   /* budget exhausted, stopped */
+};
+
+/* What the caller does next. */
+enum {
+	WELL_RECOVER_GO,     /* (re)submit the pipe */
+	WELL_RECOVER_STOP,   /* leave the pipe idle */
+	WELL_RECOVER_WAIT,   /* leave it idle and arm the timer */
+	WELL_RECOVER_GIVEUP  /* leave it idle for good */
+};
+
+struct well_recover_cfg {
+	u_int budget; /* attempts per episode */
+	u_int base;   /* first backoff, ms */
+	u_int max;    /* longest backoff, ms */
+};
+
+struct well_recover {
+	u_int state; /* WELL_RECOVER_NONE... */
+	u_int errs;  /* consecutive errors */
+	u_int tries; /* attempts this episode */
+	u_int total; /* attempts since attach */
+};
+
+/* Back ends of the finger record transpose.  The kernel only has the
+ * scalar one.
+ */
+enum {
+	WELL_DECODE_SCALAR,
+	WELL_DECODE_SSE2,
+	WELL_DECODE_N
+};
+
+/* Tracepoints, as X(function, name) entries naming the probe
+ * well::function:name.  WELL_TRACE(function, name, a0, a1, a2) fires
+ * one with up to three arguments; see well.c for their types.  In the
+ * kernel each is an SDT probe for dtrace(1).  Elsewhere it calls the
+ * function well_trace_register() set for WELL_TRACE_function_name, if
+ * any.  With WELL_NO_TRACE defined, both compile to nothing.
+ */
+#define WELL_TRACE_POINTS(X)         \
+	X(xfer, done)                \
+	X(xfer, error)               \
+	X(frame, decoded)            \
+	X(contacts, change)          \
+	X(ring, put)                 \
+	X(ring, overrun)             \
+	X(mode, set)
+
+#define WELL_TRACE_ENUM(func, name) WELL_TRACE_##func##_##name,
+enum {
+	WELL_TRACE_POINTS(WELL_TRACE_ENUM)
+	WELL_TRACE_N
+};
+#undef WELL_TRACE_ENUM
+
+#if defined(WELL_NO_TRACE)
+#define WELL_TRACE(func, name, a0, a1, a2) do { } while (0)
+#elif defined(_KERNEL)
+#define WELL_TRACE_DECLARE(func, name) SDT_PROBE_DECLARE(well, , func, name);
+SDT_PROVIDER_DECLARE(well);
+WELL_TRACE_POINTS(WELL_TRACE_DECLARE)
+#undef WELL_TRACE_DECLARE
+
+#define WELL_TRACE(func, name, a0, a1, a2)                                  \
+	SDT_PROBE3(well, , func, name, a0, a1, a2)
+#else
+typedef void well_trace_fn(int point, uintptr_t a0, uintptr_t a1,
+    uintptr_t a2);
+
+extern well_trace_fn *well_trace_fns[WELL_TRACE_N];
+extern const char *const well_trace_names[WELL_TRACE_N];
+
+#define WELL_TRACE(func, name, a0, a1, a2)                                  \
+	well_trace_fire(WELL_TRACE_##func##_##name, (uintptr_t)(a0),        \
+	    (uintptr_t)(a1), (uintptr_t)(a2))
+
+well_trace_fn *well_trace_register(int point, well_trace_fn *fn);
+
+static __inline void
+well_trace_fire(int point, uintptr_t a0, uintptr_t a1, uintptr_t a2)
+{
+	if (well_trace_fns[point] != NULL)
+		well_trace_fns[point](point, a0, a1, a2);
+}
+#endif
+
+/* Cycle accounting, with WELL_PROFILE defined.  WELL_PROF_START(t)
+ * and WELL_PROF_ADD(prof, t) bracket a stage and add the cycles it
+ * took to a struct well_prof, whose histogram counts the samples below
+ * each power of two.  The kernel reads get_cyclecount(), x86 hosts the
+ * TSC, and other hosts count nanoseconds instead.  Without
+ * WELL_PROFILE the brackets compile to nothing.
+ */
+#ifdef WELL_PROFILE
+#define WELL_PROF_BUCKETS 32 /* log2 histogram of cycles */
+
+struct well_prof {
+	uint64_t count;
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+	u_int    hist[WELL_PROF_BUCKETS];
+};
+
+static __inline uint64_t
+well_cycles(void)
+{
+#if defined(_KERNEL)
+	return (get_cyclecount());
+#elif defined(__amd64__) || defined(__x86_64__) || defined(__i386__)
+	uint32_t hi, lo;
+
+	__asm __volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t)hi << 32 | lo);
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+#endif
+}
+
+void well_prof_add(struct well_prof *prof, uint64_t cycles);
+
+#define WELL_PROF_DECL(t) uint64_t t
+#define WELL_PROF_START(t) (t) = well_cycles()
+#define WELL_PROF_ADD(prof, t) well_prof_add((prof), well_cycles() - (t))
+#else
+#define WELL_PROF_DECL(t)
+#define WELL_PROF_START(t)
+#define WELL_PROF_ADD(prof, t)
+#endif
+
+int well_model(uint16_t vendor, uint16_t product);
+int well_frame_len(const struct well_dev_params *params, int len);
+u_int well_decode_header(const struct well_dev_params *params,
+    const uint8_t *data, int len, uint8_t *button);
+void well_decode_frame(const struct well_dev_params *params,
+    const uint8_t *data, int len, struct well_frame *frame);
+int well_decode_select(int backend);
+void well_norm_init(struct well_norm *norm, const struct well_calib *calib);
+void well_ellipse(int sx, int sy, int major, int minor, int orientation,
+    struct well_contact *c);
+void well_accel_init(struct well_accel *accel, int factor);
+void well_accel(struct well_accel *accel, int *dx, int *dy);
+int well_track(struct well_track *track, const struct well_norm *norm,
+    const struct well_frame *frame, int scroll, int *dx, int *dy);
+void well_scroll_reset(struct well_scroll *scroll, const struct timeval *time);
+int well_scroll(struct well_scroll *scroll, const struct timeval *time,
+    int dy);
+int well_scroll_fling(struct well_scroll *scroll);
+int well_scroll_coast(struct well_scroll *scroll, u_int decay, int *dz);
+int well_filter(struct well_filter *filt,
+    const struct well_dev_params *params, const uint8_t *data, int len);
+struct well_event *well_event_put(struct well_ring *ring,
+    struct well_event *events, const struct timeval *time, int dx, int dy,
+    int dz, u_int buttons);
+int well_encode(const mousemode_t *mode, int predict,
+    const struct well_event *ev, uint8_t *buf);
+int well_zone_compile(const struct well_dev_params *params,
+    const char *spec, struct well_zone_map *map);
+void well_recover_clear(struct well_recover *rec);
+int well_recover_setup(struct well_recover *rec,
+    const struct well_recover_cfg *cfg, u_int *delay);
+u_int well_recover_good(struct well_recover *rec);
+int well_recover_timeout(struct well_recover *rec);
+int well_recover_reset(struct well_recover *rec, int ok,
+    const struct well_recover_cfg *cfg, u_int *delay);
+void well_predict_reset(struct well_pred *pred, const struct timeval *time,
+    int *pdx, int *pdy);
+void well_predict(struct well_pred *pred, const struct timeval *time,
+    u_int horizon, int dx, int dy, int *pdx, int *pdy);
+
+/* Map a raw sensor value to output units. */
+static __inline int
+well_normalize(const struct well_norm *norm, int raw)
+{
+	raw = MIN(MAX(raw, norm->min), norm->max);
+	return (((uint64_t)(raw - norm->min) * norm->mul) >> norm->shift);
+}
+
+/* Zone of a contact at raw sensor position (x, y). */
+static __inline u_int
+well_zone(const struct well_zone_map *map, int x, int y)
+{
+	if (map == NULL)
+		return (WELL_ZONE_NONE);
+
+	return (map->cells[MIN(well_normalize(&map->norm[1], y),
+	    WELL_ZONE_ROWS - 1)][MIN(well_normalize(&map->norm[0], x),
+	    WELL_ZONE_COLS - 1)]);
+}
+
+#endif
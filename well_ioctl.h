@@ -0,0 +1,78 @@
+/* Copyright (c) 2011 Eric McCorkle.  All rights reserved. */
+#ifndef _WELL_IOCTL_H_
+#define _WELL_IOCTL_H_
+
+#include <sys/types.h>
+#include <sys/ioccom.h>
+
+/* Driver-specific ioctls of the well device, beside the sysmouse(4)
+ * ones.
+ */
+
+/* Per-reader pointer prediction (see hw.usb.well.predict_horizon).
+ * On by default; an int, 0 turns it off for this descriptor.
+ */
+#define WELL_GETPREDICT _IOR('W', 1, int)
+#define WELL_SETPREDICT _IOW('W', 2, int)
+
+/* Per-reader output rate, in Hz up to 1000.  Motion is accumulated
+ * and read(2) wakes at most once per period, returning it in as few
+ * packets as it fits; button changes are never merged.  0, the
+ * default, delivers every event as the pad reports it.
+ */
+#define WELL_GETRATE _IOR('W', 4, int)
+#define WELL_SETRATE _IOW('W', 5, int)
+
+/* Decoded contact frames.  Records are fixed size; a change in their
+ * layout bumps WELL_FRAME_VERSION.  Coordinates are in raw sensor
+ * units, as reported by the device.  The contact ellipse is also
+ * given in physical units: micrometres once the pad size is set in
+ * the dev.well.N.width_um and height_um sysctls, sensor units
+ * otherwise.  Every frame the device sends gets a record: a frame that
+ * only repeats the one before it is recorded as a copy of the previous
+ * record, with its own seq and time.
+ */
+#define WELL_FRAME_VERSION 2
+#define WELL_FRAME_CONTACTS 16
+
+struct well_contact {
+	int16_t  x;
+	int16_t  y;
+	int16_t  touch_major;
+	int16_t  touch_minor;
+	int16_t  orientation;
+	int16_t  angle;     /* of the major axis from X, 1/100 degree */
+	uint16_t major;     /* ellipse axes, physical units */
+	uint16_t minor;
+};
+
+struct well_frame_rec {
+	uint16_t version;   /* WELL_FRAME_VERSION */
+	uint16_t size;      /* sizeof(struct well_frame_rec) */
+	uint32_t seq;       /* frame sequence number, per device */
+	int64_t  tv_sec;    /* uptime of the frame */
+	int32_t  tv_usec;
+	uint16_t buttons;   /* MOUSE_BUTTONxDOWN */
+	uint16_t ncontacts; /* valid entries in contacts[] */
+	struct well_contact contacts[WELL_FRAME_CONTACTS];
+};
+
+/* Copy up to "max" frames that this descriptor has not seen yet into
+ * "frames".  If "min" is not zero, block until that many are
+ * available, unless the descriptor is non-blocking.  Returns the
+ * number of frames copied in "count", and in "lost" the frames
+ * overwritten before this descriptor could read them since the last
+ * call.
+ */
+struct well_read_frames {
+	uint32_t version;   /* in: WELL_FRAME_VERSION */
+	uint32_t max;       /* in: room in frames[] */
+	uint32_t min;       /* in: frames to wait for, 0 not to block */
+	uint32_t count;     /* out: frames copied */
+	uint32_t lost;      /* out: frames lost to overruns */
+	struct well_frame_rec *frames;
+};
+
+#define WELL_READFRAMES _IOWR('W', 3, struct well_read_frames)
+
+#endif
@@ -0,0 +1,537 @@
+/* Copyright (c) 2011 Eric McCorkle.  All rights reserved. */
+
+/* Userspace driver for the Wellspring touchpads, for working on the
+ * decoder without reloading the module.  It takes the trackpad
+ * interface from the kernel through libusb(3), switches it to raw
+ * sensor mode the way well_set_mode() does, and decodes the stream
+ * with the same core as the kernel driver.  It prints one line per
+ * frame, and the decode time distribution on exit.
+ *
+ * Frames can also come from a file instead of a pad, in the
+ * "len hexbytes" lines that hw.usb.well.fuzz prints; -w saves the
+ * frames read from a pad in that form.  -t prints the tracepoints
+ * the kernel driver has as SDT probes, on stderr as they fire; it is
+ * not there when built with -DWELL_NO_TRACE.  Built with
+ * -DWELL_PROFILE, it also counts the cycles of decoding and tracking
+ * with the counters of the kernel's dev.well.N.profile, and prints
+ * them in the same table on exit.
+ *
+ *   cc -O2 -o welluser well_user.c well_core.c -lusb
+ *   welluser [-qt] [-a accel] [-n frames] [-w file]
+ *   welluser [-qt] [-a accel] [-n frames] -m model -r file
+ */
+#include <sys/param.h>
+#include <sys/time.h>
+
+#include <err.h>
+#include <libusb.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "well_core.h"
+
+#define WELL_USER_BUFLEN 1024 /* above any wMaxPacketSize of the pads */
+#define WELL_USER_TIMEOUT 100 /* ms between checks for a signal */
+#define WELL_USER_SCALE (1 << 8) /* ellipses in sensor units */
+
+/* HID class requests used for the mode switch. */
+#define WELL_HID_GET_REPORT 0x01
+#define WELL_HID_SET_REPORT 0x09
+
+/* Where frames come from.  The libusb backend talks to a pad; the
+ * replay backend stands in for one with a file of recorded frames.
+ */
+struct well_backend {
+	/* Mode report request; returns the bytes transferred or -1. */
+	int  (*wb_control)(struct well_backend *wb, int in, uint8_t req,
+	    uint8_t *data, uint16_t len);
+	/* Next trackpad frame: its length, 0 at the end, -1 on error. */
+	int  (*wb_read)(struct well_backend *wb, uint8_t *data, int len);
+	void (*wb_close)(struct well_backend *wb);
+	int  wb_model;
+};
+
+struct well_usb {
+	struct well_backend   wu_backend;
+	libusb_context       *wu_ctx;
+	libusb_device_handle *wu_handle;
+	int                   wu_iface;
+};
+
+struct well_replay {
+	struct well_backend wr_backend;
+	FILE               *wr_file;
+	char               *wr_line;
+	size_t              wr_linecap;
+};
+
+/* Decoding and tracking state. */
+#ifdef WELL_PROFILE
+enum {
+	WELL_USER_PROF_DECODE,
+	WELL_USER_PROF_TRACK,
+	WELL_USER_PROF_N
+};
+
+static const char *well_user_prof_names[WELL_USER_PROF_N] = {
+	[WELL_USER_PROF_DECODE] = "decode",
+	[WELL_USER_PROF_TRACK]  = "track",
+};
+#endif
+
+struct well_user {
+	const struct well_dev_params *wu_params;
+	struct well_norm   wu_norm[2];
+	struct well_track  wu_track;
+	struct well_frame  wu_frame;
+	u_int              wu_bad;     /* frames refused */
+	uint32_t          *wu_ns;      /* decode times */
+	size_t             wu_count;
+	size_t             wu_cap;
+#ifdef WELL_PROFILE
+	struct well_prof   wu_prof[WELL_USER_PROF_N];
+#endif
+};
+
+static volatile sig_atomic_t well_user_stop;
+
+static void
+well_user_signal(int sig)
+{
+	well_user_stop = 1;
+}
+
+/* The interface holding the trackpad endpoint. */
+static int
+well_usb_iface(libusb_device *dev)
+{
+	struct libusb_config_descriptor *cd;
+	const struct libusb_interface_descriptor *id;
+	int i, j, iface = -1;
+
+	if (libusb_get_active_config_descriptor(dev, &cd) != 0)
+		return (-1);
+	for (i = 0; i < cd->bNumInterfaces; i++) {
+		if (cd->interface[i].num_altsetting < 1)
+			continue;
+		id = &cd->interface[i].altsetting[0];
+		for (j = 0; j < id->bNumEndpoints; j++)
+			if (id->endpoint[j].bEndpointAddress ==
+			    TRACKPAD_ENDPOINT)
+				iface = id->bInterfaceNumber;
+	}
+	libusb_free_config_descriptor(cd);
+	return (iface);
+}
+
+static int
+well_usb_control(struct well_backend *wb, int in, uint8_t req,
+    uint8_t *data, uint16_t len)
+{
+	struct well_usb *wu = (struct well_usb *)wb;
+	int ret;
+
+	ret = libusb_control_transfer(wu->wu_handle,
+	    (in ? LIBUSB_ENDPOINT_IN : LIBUSB_ENDPOINT_OUT) |
+	    LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE,
+	    req, WELL_MODE_REPORT, 0, data, len, 1000);
+	return (ret < 0 ? -1 : ret);
+}
+
+static int
+well_usb_read(struct well_backend *wb, uint8_t *data, int len)
+{
+	struct well_usb *wu = (struct well_usb *)wb;
+	int got, ret;
+
+	while (!well_user_stop) {
+		ret = libusb_interrupt_transfer(wu->wu_handle,
+		    TRACKPAD_ENDPOINT, data, len, &got, WELL_USER_TIMEOUT);
+		if (ret == 0)
+			return (got);
+		if (ret != LIBUSB_ERROR_TIMEOUT)
+			return (-1);
+	}
+	return (0);
+}
+
+static void
+well_usb_close(struct well_backend *wb)
+{
+	struct well_usb *wu = (struct well_usb *)wb;
+
+	libusb_release_interface(wu->wu_handle, wu->wu_iface);
+	libusb_attach_kernel_driver(wu->wu_handle, wu->wu_iface);
+	libusb_close(wu->wu_handle);
+	libusb_exit(wu->wu_ctx);
+	free(wu);
+}
+
+/* Open the first supported pad, taking it from the kernel. */
+static struct well_backend *
+well_usb_open(void)
+{
+	struct well_usb *wu;
+	struct libusb_device_descriptor dd;
+	libusb_device **list;
+	ssize_t i, n;
+	int model = -1;
+
+	if ((wu = calloc(1, sizeof(*wu))) == NULL)
+		err(1, "calloc");
+	if (libusb_init(&wu->wu_ctx) != 0)
+		errx(1, "cannot initialize libusb");
+	if ((n = libusb_get_device_list(wu->wu_ctx, &list)) < 0)
+		errx(1, "cannot list USB devices");
+	for (i = 0; i < n && model < 0; i++)
+		if (libusb_get_device_descriptor(list[i], &dd) == 0)
+			model = well_model(dd.idVendor, dd.idProduct);
+	if (model < 0)
+		errx(1, "no supported touchpad");
+	if (libusb_open(list[i - 1], &wu->wu_handle) != 0)
+		errx(1, "cannot open the touchpad");
+	wu->wu_iface = well_usb_iface(list[i - 1]);
+	libusb_free_device_list(list, 1);
+	if (wu->wu_iface < 0)
+		errx(1, "no trackpad interface");
+
+	if (libusb_kernel_driver_active(wu->wu_handle, wu->wu_iface) == 1 &&
+	    libusb_detach_kernel_driver(wu->wu_handle, wu->wu_iface) != 0)
+		errx(1, "cannot detach the kernel driver");
+	if (libusb_claim_interface(wu->wu_handle, wu->wu_iface) != 0)
+		errx(1, "cannot claim interface %d", wu->wu_iface);
+
+	wu->wu_backend.wb_control = well_usb_control;
+	wu->wu_backend.wb_read = well_usb_read;
+	wu->wu_backend.wb_close = well_usb_close;
+	wu->wu_backend.wb_model = model;
+	return (&wu->wu_backend);
+}
+
+/* The replay stand-in reads a mode of zeroes and accepts any mode. */
+static int
+well_replay_control(struct well_backend *wb, int in, uint8_t req,
+    uint8_t *data, uint16_t len)
+{
+	if (in)
+		memset(data, 0, len);
+	return (len);
+}
+
+/* Frames are the last two fields of a line, the length and the bytes
+ * in hex; other lines are skipped.
+ */
+static int
+well_replay_read(struct well_backend *wb, uint8_t *data, int len)
+{
+	struct well_replay *wr = (struct well_replay *)wb;
+	char *p, *last, *prev;
+	long n;
+	int i;
+
+	while (!well_user_stop &&
+	    getline(&wr->wr_line, &wr->wr_linecap, wr->wr_file) > 0) {
+		prev = last = NULL;
+		for (p = strtok(wr->wr_line, " \t\n"); p != NULL;
+		    p = strtok(NULL, " \t\n")) {
+			prev = last;
+			last = p;
+		}
+		if (prev == NULL)
+			continue;
+		n = strtol(prev, &p, 10);
+		if (*p != '\0' || n <= 0 || n > len ||
+		    strlen(last) != (size_t)n * 2)
+			continue;
+		for (i = 0; i < n; i++)
+			if (sscanf(last + 2 * i, "%2hhx", &data[i]) != 1)
+				break;
+		if (i == n)
+			return (n);
+	}
+	return (ferror(wr->wr_file) ? -1 : 0);
+}
+
+static void
+well_replay_close(struct well_backend *wb)
+{
+	struct well_replay *wr = (struct well_replay *)wb;
+
+	fclose(wr->wr_file);
+	free(wr->wr_line);
+	free(wr);
+}
+
+static struct well_backend *
+well_replay_open(const char *path, int model)
+{
+	struct well_replay *wr;
+
+	if ((wr = calloc(1, sizeof(*wr))) == NULL)
+		err(1, "calloc");
+	if ((wr->wr_file = fopen(path, "r")) == NULL)
+		err(1, "%s", path);
+
+	wr->wr_backend.wb_control = well_replay_control;
+	wr->wr_backend.wb_read = well_replay_read;
+	wr->wr_backend.wb_close = well_replay_close;
+	wr->wr_backend.wb_model = model;
+	return (&wr->wr_backend);
+}
+
+/* Switch modes like well_set_mode(): read the mode report, then write
+ * it back with the new mode.
+ */
+static int
+well_user_set_mode(struct well_backend *wb, interface_mode mode)
+{
+	uint8_t bytes[WELL_MODE_LENGTH];
+
+	memset(bytes, 0, sizeof(bytes));
+	if (wb->wb_control(wb, 1, WELL_HID_GET_REPORT, bytes,
+	    sizeof(bytes)) < 0)
+		return (-1);
+	bytes[0] = mode;
+	WELL_TRACE(mode, set, wb, mode, 0);
+	if (wb->wb_control(wb, 0, WELL_HID_SET_REPORT, bytes,
+	    sizeof(bytes)) < 0)
+		return (-1);
+	return (0);
+}
+
+static uint32_t
+well_user_ns(const struct timespec *t0, const struct timespec *t1)
+{
+	return ((t1->tv_sec - t0->tv_sec) * 1000000000 +
+	    (t1->tv_nsec - t0->tv_nsec));
+}
+
+/* Decode one frame as the frame task does, then track the primary
+ * finger with well_track() like well_emit_frame(), without scrolling
+ * or zones.
+ */
+static void
+well_user_frame(struct well_user *wu, const uint8_t *data, int len,
+    int quiet)
+{
+	struct well_frame *frame = &wu->wu_frame;
+	struct well_contact c;
+	struct timespec t0, t1;
+	int dx, dy;
+	u_int i;
+	WELL_PROF_DECL(t);
+
+	if ((len = well_frame_len(wu->wu_params, len)) < 0) {
+		wu->wu_bad++;
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	WELL_PROF_START(t);
+	well_decode_frame(wu->wu_params, data, len, frame);
+	WELL_PROF_ADD(&wu->wu_prof[WELL_USER_PROF_DECODE], t);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	frame->time.tv_sec = t1.tv_sec;
+	frame->time.tv_usec = t1.tv_nsec / 1000;
+
+	if (wu->wu_count == wu->wu_cap) {
+		wu->wu_cap = MAX(wu->wu_cap * 2, 1024);
+		wu->wu_ns = reallocf(wu->wu_ns,
+		    wu->wu_cap * sizeof(*wu->wu_ns));
+		if (wu->wu_ns == NULL)
+			err(1, "reallocf");
+	}
+	wu->wu_ns[wu->wu_count++] = well_user_ns(&t0, &t1);
+
+	WELL_PROF_START(t);
+	well_track(&wu->wu_track, wu->wu_norm, frame, 0, &dx, &dy);
+	WELL_PROF_ADD(&wu->wu_prof[WELL_USER_PROF_TRACK], t);
+
+	if (quiet)
+		return;
+	printf("%u %x %d %d", frame->nfingers, frame->buttons, dx, dy);
+	for (i = 0; i < frame->nfingers; i++) {
+		well_ellipse(WELL_USER_SCALE, WELL_USER_SCALE,
+		    frame->touch_major[i], frame->touch_minor[i],
+		    frame->orientation[i], &c);
+		printf(" %d,%d,%u,%u,%d", frame->x[i], frame->y[i], c.major,
+		    c.minor, c.angle);
+	}
+	printf("\n");
+}
+
+static int
+well_user_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+#ifdef WELL_PROFILE
+/* The cycle counts, as dev.well.N.profile prints them:
+ *
+ *   stage count min avg max [log2:count ...]
+ */
+static void
+well_user_prof(struct well_user *wu)
+{
+	const struct well_prof *prof;
+	int i, j;
+
+	for (i = 0; i < WELL_USER_PROF_N; i++) {
+		prof = &wu->wu_prof[i];
+		fprintf(stderr, "%s %ju %ju %ju %ju", well_user_prof_names[i],
+		    (uintmax_t)prof->count, (uintmax_t)prof->min,
+		    (uintmax_t)(prof->count ? prof->total / prof->count : 0),
+		    (uintmax_t)prof->max);
+		for (j = 0; j < WELL_PROF_BUCKETS; j++)
+			if (prof->hist[j] != 0)
+				fprintf(stderr, " %d:%u", j, prof->hist[j]);
+		fprintf(stderr, "\n");
+	}
+}
+#endif
+
+static void
+well_user_report(struct well_user *wu)
+{
+	size_t n = wu->wu_count;
+
+	fprintf(stderr, "%zu frames, %u refused\n", n, wu->wu_bad);
+	if (n == 0)
+		return;
+	qsort(wu->wu_ns, n, sizeof(*wu->wu_ns), well_user_cmp);
+	fprintf(stderr, "decode ns: p50 %u p99 %u max %u\n",
+	    wu->wu_ns[n / 2], wu->wu_ns[n * 99 / 100], wu->wu_ns[n - 1]);
+#ifdef WELL_PROFILE
+	well_user_prof(wu);
+#endif
+}
+
+#ifndef WELL_NO_TRACE
+#define WELL_USER_FLAGS "qt"
+
+static void
+well_user_trace(int point, uintptr_t a0, uintptr_t a1, uintptr_t a2)
+{
+	fprintf(stderr, "%s %#jx %#jx %#jx\n", well_trace_names[point],
+	    (uintmax_t)a0, (uintmax_t)a1, (uintmax_t)a2);
+}
+#else
+#define WELL_USER_FLAGS "q"
+#endif
+
+static void
+usage(void)
+{
+	int i;
+
+	fprintf(stderr,
+	    "usage: welluser [-" WELL_USER_FLAGS "] [-a accel] [-n frames] "
+	    "[-w file]\n"
+	    "       welluser [-" WELL_USER_FLAGS "] [-a accel] [-n frames] "
+	    "-m model -r file\n"
+	    "models:\n");
+	for (i = 0; i < DEV_WELLSPRING_N; i++)
+		fprintf(stderr, "  %d %s\n", i, well_dev_params[i].name);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct well_backend *wb;
+	struct well_user wu;
+	const char *replay = NULL;
+	FILE *out = NULL;
+	uint8_t buf[WELL_USER_BUFLEN];
+	long frames = -1;
+	int accel = 0, model = -1, quiet = 0;
+	int ch, i, len;
+
+	while ((ch = getopt(argc, argv, "a:m:n:" WELL_USER_FLAGS "r:w:")) !=
+	    -1)
+		switch (ch) {
+		case 'a':
+			accel = atoi(optarg);
+			if (accel < 0 || accel > WELL_ACCEL_FACTOR_MAX)
+				errx(1, "accel must be 0 to %d",
+				    WELL_ACCEL_FACTOR_MAX);
+			break;
+		case 'm':
+			model = atoi(optarg);
+			if (model < 0 || model >= DEV_WELLSPRING_N)
+				usage();
+			break;
+		case 'n':
+			frames = atol(optarg);
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		case 'r':
+			replay = optarg;
+			break;
+#ifndef WELL_NO_TRACE
+		case 't':
+			for (i = 0; i < WELL_TRACE_N; i++)
+				well_trace_register(i, well_user_trace);
+			break;
+#endif
+		case 'w':
+			if ((out = fopen(optarg, "w")) == NULL)
+				err(1, "%s", optarg);
+			break;
+		default:
+			usage();
+		}
+	if (optind != argc || (replay != NULL) != (model >= 0))
+		usage();
+
+	wb = replay != NULL ? well_replay_open(replay, model) :
+	    well_usb_open();
+	signal(SIGINT, well_user_signal);
+	signal(SIGTERM, well_user_signal);
+
+	memset(&wu, 0, sizeof(wu));
+	wu.wu_params = &well_dev_params[wb->wb_model];
+	well_norm_init(&wu.wu_norm[WELL_AXIS_X], &wu.wu_params->x_calib);
+	well_norm_init(&wu.wu_norm[WELL_AXIS_Y], &wu.wu_params->y_calib);
+	well_accel_init(&wu.wu_track.accel, accel);
+	fprintf(stderr, "%s\n", wu.wu_params->name);
+
+	if (well_user_set_mode(wb, RAW_SENSOR_MODE) != 0)
+		errx(1, "failed to set mode to 'RAW_SENSOR'");
+
+	while (frames-- != 0) {
+		if ((len = wb->wb_read(wb, buf, sizeof(buf))) <= 0) {
+			if (len < 0) {
+				WELL_TRACE(xfer, error, wb, len, 1);
+				warnx("cannot read a frame");
+			}
+			break;
+		}
+		WELL_TRACE(xfer, done, wb, len, 0);
+		if (out != NULL) {
+			fprintf(out, "%d ", len);
+			for (i = 0; i < len; i++)
+				fprintf(out, "%02x", buf[i]);
+			fprintf(out, "\n");
+		}
+		well_user_frame(&wu, buf, len, quiet);
+	}
+
+	well_user_set_mode(wb, HID_MODE);
+	wb->wb_close(wb);
+	if (out != NULL)
+		fclose(out);
+	well_user_report(&wu);
+	free(wu.wu_ns);
+	return (0);
+}